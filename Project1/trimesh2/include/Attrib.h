@@ -0,0 +1,366 @@
+#ifndef ATTRIB_H
+#define ATTRIB_H
+/*
+Szymon Rusinkiewicz
+Princeton University
+
+Attrib.h
+Named per-vertex and per-face attributes for TriMeshes.
+
+An Attrib<T> holds n elements of ncomp components each, with T one of
+float, int, or unsigned char.  By default each component is a separate
+array starting on a cache-line boundary (SoA), so that kernels can stream
+over x, y, and z separately; they may also be interleaved (AoS).  Either
+way, component c of element i is at data(c)[i * stride()].
+
+The attributes in a mesh's AttribSet are carried along by remap_verts,
+remove_faces, subdiv, HalfEdge::split, and ply input and output.  This
+file is included by TriMesh.h, which defines index_t.
+
+Sample usage:
+	Attrib<float> *temp = mesh->add_vert_attrib<float>("temperature");
+	temp->at(i) = 98.6f;
+
+	Attrib<float> *uvw = mesh->get_attrib<float>("uvw"); // NULL if none
+	float *u = uvw->data(0), *v = uvw->data(1), *w = uvw->data(2);
+*/
+
+#include <vector>
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include <cstddef>
+
+#ifndef ATTRIB_ALIGN
+# define ATTRIB_ALIGN 64
+#endif
+
+
+namespace trimesh {
+
+// Per-type details
+template <class T> struct AttribType;
+template <> struct AttribType<float> {
+	static const char *ply_name() { return "float"; }
+	static bool integral() { return false; }
+};
+template <> struct AttribType<int> {
+	static const char *ply_name() { return "int"; }
+	static bool integral() { return true; }
+};
+template <> struct AttribType<unsigned char> {
+	static const char *ply_name() { return "uchar"; }
+	static bool integral() { return true; }
+};
+
+
+// The type-independent interface, used by the code that moves attributes
+// around without caring what they hold
+class AttribBase {
+public:
+	enum Where { VERTEX, FACE };
+
+protected:
+	::std::string name_;
+	Where where_;
+	int ncomp_;
+	bool soa_;
+	size_t n_;
+
+	AttribBase(const ::std::string &name, Where where, int ncomp, bool soa) :
+		name_(name), where_(where), ncomp_(ncomp), soa_(soa), n_(0)
+		{}
+
+public:
+	virtual ~AttribBase() {}
+
+	const ::std::string &name() const { return name_; }
+	Where where() const { return where_; }
+	int ncomp() const { return ncomp_; }
+	bool soa() const { return soa_; }
+	size_t size() const { return n_; }
+
+	virtual AttribBase *clone() const = 0;
+
+	// Change the number of elements.  New ones are zero.
+	virtual void resize(size_t n) = 0;
+
+	// Move element i to table[i], dropping it if table[i] < 0
+	virtual void remap(const ::std::vector<index_t> &table,
+			   size_t newsize) = 0;
+
+	// Append a new element that is a weighted combination of the
+	// elements which[0..k-1].  Integer types, which don't interpolate
+	// well, take the value of the element with the largest weight.
+	virtual void append(int k, const index_t *which,
+			    const float *weights) = 0;
+	void append_copy(index_t i)
+		{ float w = 1.0f; append(1, &i, &w); }
+
+	// Set element i to a weighted combination, as above.  Different
+	// elements may be set in parallel.
+	virtual void combine(size_t i, int k, const index_t *which,
+			     const float *weights) = 0;
+
+	// Access for I/O: element i, component c
+	virtual const char *ply_type() const = 0;
+	virtual bool integral() const = 0;
+	virtual size_t elem_size() const = 0;
+	virtual void *ptr(size_t i, int c) = 0;
+	virtual double get(size_t i, int c) const = 0;
+	virtual void set(size_t i, int c, double val) = 0;
+};
+
+
+template <class T>
+class Attrib : public AttribBase {
+private:
+	T *mem, *base;
+	size_t cap;
+
+	// Elements per cache line
+	static size_t line() { return ATTRIB_ALIGN / sizeof(T); }
+
+	// Reallocate to hold at least newcap elements, keeping the first
+	// ncopy and zeroing the rest
+	void realloc(size_t newcap, size_t ncopy)
+	{
+		newcap = (newcap + line() - 1) / line() * line();
+		size_t total = ncomp_ * newcap;
+		T *newmem = new T[total + line()];
+		size_t mis = (size_t) newmem % ATTRIB_ALIGN / sizeof(T);
+		T *newbase = newmem + (mis ? line() - mis : 0);
+		memset(newbase, 0, total * sizeof(T));
+		if (ncopy) {
+			if (soa_) {
+				for (int c = 0; c < ncomp_; c++)
+					memcpy(newbase + c * newcap,
+					       base + c * cap,
+					       ncopy * sizeof(T));
+			} else {
+				memcpy(newbase, base, ncomp_ * ncopy * sizeof(T));
+			}
+		}
+		delete [] mem;
+		mem = newmem;
+		base = newbase;
+		cap = newcap;
+	}
+
+	// Not assignable - use clone()
+	Attrib &operator = (const Attrib &);
+
+public:
+	Attrib(const ::std::string &name, Where where, int ncomp = 1,
+	       bool soa = true) :
+		AttribBase(name, where, ncomp, soa), mem(0), base(0), cap(0)
+		{ realloc(0, 0); }
+	Attrib(const Attrib &a) :
+		AttribBase(a.name_, a.where_, a.ncomp_, a.soa_),
+		mem(0), base(0), cap(0)
+	{
+		realloc(a.n_, 0);
+		n_ = a.n_;
+		for (int c = 0; c < ncomp_; c++)
+			for (size_t i = 0; i < n_; i++)
+				at(i, c) = a.at(i, c);
+	}
+	~Attrib()
+		{ delete [] mem; }
+
+	// Raw access: component c of element i is data(c)[i * stride()]
+	T *data(int c = 0)
+		{ return soa_ ? base + c * cap : base + c; }
+	const T *data(int c = 0) const
+		{ return soa_ ? base + c * cap : base + c; }
+	int stride() const
+		{ return soa_ ? 1 : ncomp_; }
+	T &at(size_t i, int c = 0)
+		{ return data(c)[i * stride()]; }
+	const T &at(size_t i, int c = 0) const
+		{ return data(c)[i * stride()]; }
+	T &operator [] (size_t i)
+		{ return at(i); }
+	const T &operator [] (size_t i) const
+		{ return at(i); }
+
+	AttribBase *clone() const
+		{ return new Attrib(*this); }
+
+	void resize(size_t n)
+	{
+		if (n > cap)
+			realloc(n, n_);
+		else if (n < n_)
+			for (int c = 0; c < ncomp_; c++)
+				for (size_t i = n; i < n_; i++)
+					at(i, c) = T();
+		n_ = n;
+	}
+
+	void remap(const ::std::vector<index_t> &table, size_t newsize)
+	{
+		Attrib tmp(*this);
+		resize(0);
+		resize(newsize);
+		size_t n = ::std::min(table.size(), tmp.n_);
+		for (size_t i = 0; i < n; i++) {
+			if (table[i] < 0)
+				continue;
+			for (int c = 0; c < ncomp_; c++)
+				at(table[i], c) = tmp.at(i, c);
+		}
+	}
+
+	void append(int k, const index_t *which, const float *weights)
+	{
+		// Grow geometrically, so repeated appends are cheap
+		if (n_ == cap)
+			realloc(2 * cap + 1, n_);
+		combine(n_++, k, which, weights);
+	}
+
+	void combine(size_t i, int k, const index_t *which, const float *weights)
+	{
+		if (AttribType<T>::integral()) {
+			int best = 0;
+			for (int j = 1; j < k; j++)
+				if (weights[j] > weights[best])
+					best = j;
+			for (int c = 0; c < ncomp_; c++)
+				at(i, c) = at(which[best], c);
+		} else {
+			for (int c = 0; c < ncomp_; c++) {
+				float sum = 0;
+				for (int j = 0; j < k; j++)
+					sum += weights[j] * at(which[j], c);
+				at(i, c) = T(sum);
+			}
+		}
+	}
+
+	const char *ply_type() const
+		{ return AttribType<T>::ply_name(); }
+	bool integral() const
+		{ return AttribType<T>::integral(); }
+	size_t elem_size() const
+		{ return sizeof(T); }
+	void *ptr(size_t i, int c)
+		{ return &at(i, c); }
+	double get(size_t i, int c) const
+		{ return double(at(i, c)); }
+	void set(size_t i, int c, double val)
+		{ at(i, c) = T(val); }
+};
+
+
+// A collection of named attributes.  Copying an AttribSet copies all the
+// attributes, so copies of a TriMesh don't share data.
+class AttribSet {
+private:
+	::std::vector<AttribBase *> a;
+
+public:
+	AttribSet()
+		{}
+	AttribSet(const AttribSet &s)
+		{ *this = s; }
+	AttribSet &operator = (const AttribSet &s)
+	{
+		if (&s == this)
+			return *this;
+		clear();
+		for (size_t i = 0; i < s.a.size(); i++)
+			a.push_back(s.a[i]->clone());
+		return *this;
+	}
+	~AttribSet()
+		{ clear(); }
+
+	size_t size() const { return a.size(); }
+	bool empty() const { return a.empty(); }
+	AttribBase *operator [] (size_t i) { return a[i]; }
+	const AttribBase *operator [] (size_t i) const { return a[i]; }
+
+	AttribBase *find(const ::std::string &name) const
+	{
+		for (size_t i = 0; i < a.size(); i++)
+			if (a[i]->name() == name)
+				return a[i];
+		return 0;
+	}
+	// Takes ownership, replacing any attribute with the same name
+	void add(AttribBase *attr)
+	{
+		for (size_t i = 0; i < a.size(); i++) {
+			if (a[i]->name() == attr->name()) {
+				delete a[i];
+				a[i] = attr;
+				return;
+			}
+		}
+		a.push_back(attr);
+	}
+	void remove(const ::std::string &name)
+	{
+		for (size_t i = 0; i < a.size(); i++) {
+			if (a[i]->name() == name) {
+				delete a[i];
+				a.erase(a.begin() + i);
+				return;
+			}
+		}
+	}
+	void clear()
+	{
+		for (size_t i = 0; i < a.size(); i++)
+			delete a[i];
+		a.clear();
+	}
+
+	// Operations on all the per-vertex or all the per-face attributes
+	bool any(AttribBase::Where where) const
+	{
+		for (size_t i = 0; i < a.size(); i++)
+			if (a[i]->where() == where)
+				return true;
+		return false;
+	}
+	void resize(AttribBase::Where where, size_t n)
+	{
+		for (size_t i = 0; i < a.size(); i++)
+			if (a[i]->where() == where)
+				a[i]->resize(n);
+	}
+	void remap(AttribBase::Where where,
+		   const ::std::vector<index_t> &table, size_t newsize)
+	{
+		for (size_t i = 0; i < a.size(); i++)
+			if (a[i]->where() == where)
+				a[i]->remap(table, newsize);
+	}
+	void append(AttribBase::Where where, int k, const index_t *which,
+		    const float *weights)
+	{
+		for (size_t i = 0; i < a.size(); i++)
+			if (a[i]->where() == where)
+				a[i]->append(k, which, weights);
+	}
+	void append_copy(AttribBase::Where where, index_t i)
+	{
+		for (size_t j = 0; j < a.size(); j++)
+			if (a[j]->where() == where)
+				a[j]->append_copy(i);
+	}
+	void combine(AttribBase::Where where, size_t i, int k,
+		     const index_t *which, const float *weights)
+	{
+		for (size_t j = 0; j < a.size(); j++)
+			if (a[j]->where() == where)
+				a[j]->combine(i, k, which, weights);
+	}
+};
+
+}; // namespace trimesh
+
+#endif
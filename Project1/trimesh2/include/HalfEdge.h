@@ -0,0 +1,107 @@
+#ifndef HALFEDGE_H
+#define HALFEDGE_H
+/*
+Szymon Rusinkiewicz
+Princeton University
+
+HalfEdge.h
+Array-based half-edge connectivity for a TriMesh, with local edits
+(edge flip, collapse, and split) that keep it valid.
+
+Half-edge h is the edge of face h/3 that starts at corner h%3, so "next"
+and "prev" are implicit.  The structure stores the twin of each half-edge
+and one outgoing half-edge per vertex, and edits the mesh's faces in place.
+
+Sample usage, visiting the one-ring of vertex v:
+	HalfEdge he(mesh);
+	index_t h = he.out[v];
+	if (h >= 0) do {
+		... he.to(h) is a neighbor of v, HalfEdge::face(h) a face ...
+		h = he.ring_next(h);
+	} while (h >= 0 && h != he.out[v]);
+*/
+
+#include "TriMesh.h"
+
+namespace trimesh {
+
+class HalfEdge {
+private:
+	void touched();
+	void fix_out(index_t v, index_t h);
+	void do_collapse(index_t h);
+
+public:
+	TriMesh *mesh;
+
+	// For each half-edge, the oppositely-oriented half-edge on the
+	// neighboring face, or -1 on the boundary (or a non-manifold edge)
+	::std::vector<index_t> twin;
+
+	// For each vertex, one outgoing half-edge, or -1 for unused vertices.
+	// On the boundary this is the one with no twin, so that walking
+	// around with ring_next() visits all of the faces.
+	::std::vector<index_t> out;
+
+	// Constructor - builds the structure from mesh->faces.  Faces must be
+	// consistently oriented.  At non-manifold vertices, only one fan of
+	// faces is reachable by walking around the vertex.
+	HalfEdge(TriMesh *mesh_) : mesh(mesh_)
+		{ build(); }
+	void build();
+
+	// Implicit structure
+	static index_t face(index_t h)
+		{ return h / 3; }
+	static index_t next(index_t h)
+		{ return (h % 3 == 2) ? h - 2 : h + 1; }
+	static index_t prev(index_t h)
+		{ return (h % 3 == 0) ? h + 2 : h - 1; }
+	index_t from(index_t h) const
+		{ return mesh->faces[h/3][h%3]; }
+	index_t to(index_t h) const
+		{ return from(next(h)); }
+
+	// Walking around from(h): the next outgoing half-edge, or -1 once
+	// we have walked off a boundary
+	index_t ring_next(index_t h) const
+		{ return twin[prev(h)]; }
+
+	// Queries
+	bool is_bdy_edge(index_t h) const
+		{ return twin[h] < 0; }
+	bool is_bdy_vert(index_t v) const
+		{ return out[v] >= 0 && twin[out[v]] < 0; }
+	bool deleted(index_t f) const
+		{ return mesh->faces[f][0] < 0; }
+	int valence(index_t v) const;
+	void one_ring(index_t v, ::std::vector<index_t> &ring) const;
+	index_t find_edge(index_t v1, index_t v2) const;
+
+	// Local edits.  Each returns false (or -1) and does nothing if the
+	// edit would make the mesh non-manifold.
+	//
+	// Flip the interior edge h to join the two opposite vertices
+	bool flip(index_t h);
+	// Merge from(h) into to(h), deleting the faces on either side
+	bool can_collapse(index_t h) const;
+	bool collapse(index_t h);
+	// Collapse several edges at once, in parallel.  The endpoints of each
+	// edge, together with their one-rings, must not overlap those of any
+	// other.  Edges that can't be collapsed are set to -1.  Returns the
+	// number collapsed.
+	index_t collapse(::std::vector<index_t> &hs);
+	// Insert a new vertex at p on edge h, splitting the faces on either
+	// side.  Returns the index of the new vertex.
+	index_t split(index_t h, const point &p);
+
+	// Remove the faces and vertices deleted by collapse(), then rebuild
+	void compact();
+
+	// Sanity check - returns true if all the invariants hold
+	bool check() const;
+};
+
+}; // namespace trimesh
+
+#endif
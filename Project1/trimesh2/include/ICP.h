@@ -15,6 +15,95 @@ Routines for doing ICP.
 
 namespace trimesh {
 
+// Record of what happened during one ICP iteration.  Times are in msec.
+struct ICP_iter_stats {
+	int iter;		// Iteration number; negative for the initial
+				// point-to-point iterations, then counting
+				// up from 0 through the final one
+	bool pt2pt;		// Point-to-point (vs. point-to-plane) iteration
+	size_t npairs;		// Pairs kept after rejection
+	size_t nrejected;	// Pairs discarded by the distance threshold
+	size_t nreused;		// Samples whose match was the same as the
+				// last time they were sampled
+	float err;		// RMS error of the kept pairs, or -1 on failure
+	float maxdist;		// Search radius used for matching
+	int desired_pairs;	// Pair count the sampling rate was tuned for
+	float step_trans;	// Motion of s2's center due to this iteration
+	float step_rot;		// Rotation angle (radians) of this iteration
+	bool extrapolated;	// Transform was extrapolated after this step
+	float t_overlap, t_match, t_reject, t_solve, t_cdf;
+
+	ICP_iter_stats() : iter(0), pt2pt(false), npairs(0), nrejected(0),
+		nreused(0),
+		err(0.0f), maxdist(0.0f), desired_pairs(0),
+		step_trans(0.0f), step_rot(0.0f), extrapolated(false),
+		t_overlap(0.0f), t_match(0.0f), t_reject(0.0f),
+		t_solve(0.0f), t_cdf(0.0f)
+		{}
+};
+
+// Robust kernels for weighting point pairs in ICP
+enum { ICP_ROBUST_NONE, ICP_ROBUST_HUBER, ICP_ROBUST_TUKEY,
+       ICP_ROBUST_CAUCHY };
+
+// Called after every ICP iteration, if set in ICP_params
+typedef void (*ICP_callback)(const ICP_iter_stats &stats, void *data);
+
+// Parameters controlling ICP.  The defaults turn on extrapolation, adaptive
+// pair counts and step-based termination, which the simpler ICP()
+// interfaces below leave off, so the two do not give the same results.
+struct ICP_params {
+	float maxdist;		// 0 to figure it out
+	int verbose;
+	bool do_scale, do_affine;
+
+	// Termination: give up after max_iters, stop when the error has
+	// gone up in most of the recent iterations (if term_err_hist), and
+	// stop when the transform has changed by less than term_step for a
+	// few iterations in a row (0 disables).  term_step is measured as
+	// rotation in radians plus translation relative to the size of s2.
+	// A step also counts as small if it moves points by less than
+	// term_step_err times the current RMS error, i.e., it is in the noise.
+	int max_iters;
+	bool term_err_hist;
+	float term_step, term_step_err;
+
+	// Acceleration: extrapolate the sequence of transforms when it moves
+	// in a consistent direction [Besl and McKay 1992], and use fewer
+	// pairs while steps are much larger than the residual error.
+	bool extrapolate;
+	bool adaptive_pairs;
+
+	// Point-to-plane minimization: optional robust kernel, applied with
+	// irls_iters rounds of iteratively reweighted least squares, and
+	// optional symmetric objective (uses the normals at both points).
+	int robust;
+	int irls_iters;
+	bool symmetric;
+
+	// Seed for the random selection of points.  ICP is repeatable for a
+	// given seed.
+	unsigned seed;
+
+	// Start each KD-tree search from the point's match in an earlier
+	// iteration, if it has not moved far since.  Gives the same matches
+	// as searching from scratch, but faster once ICP has nearly converged.
+	bool warm_start;
+
+	ICP_callback callback;
+	void *callback_data;
+
+	ICP_params() : maxdist(0.0f), verbose(0),
+		do_scale(false), do_affine(false),
+		max_iters(100), term_err_hist(true),
+		term_step(1.0e-5f), term_step_err(0.5f),
+		extrapolate(true), adaptive_pairs(true),
+		robust(ICP_ROBUST_NONE), irls_iters(3), symmetric(false),
+		seed(0), warm_start(true), callback(NULL), callback_data(NULL)
+		{}
+};
+
+
 // Determine which points on s1 and s2 overlap the other, filling in o1 and o2
 // Also fills in maxdist, if it is <= 0 on input
 extern void compute_overlaps(TriMesh *s1, TriMesh *s2,
@@ -24,7 +113,9 @@ extern void compute_overlaps(TriMesh *s1, TriMesh *s2,
 			     float &maxdist, int verbose);
 
 // Do ICP.  Aligns mesh s2 to s1, updating xf2 with the new transform.
-// Returns alignment error, or -1 on failure.
+// Returns alignment error, or -1 on failure.  Iterates as ICP always has:
+// without extrapolation or adaptive pair counts, stopping only when the
+// error has gone up in most recent iterations or after max_iters.
 // Pass in 0 for maxdist to figure it out...
 // Pass in vector<float>() for weights to figure it out...
 extern float ICP(TriMesh *s1, TriMesh *s2,
@@ -34,11 +125,47 @@ extern float ICP(TriMesh *s1, TriMesh *s2,
 		 float maxdist = 0.0f, int verbose = 0,
 		 bool do_scale = false, bool do_affine = false);
 
+// Do ICP with the given parameters.  If stats is non-NULL, the record of
+// every iteration is appended to it.
+extern float ICP(TriMesh *s1, TriMesh *s2,
+		 const xform &xf1, xform &xf2,
+		 const KDtree *kd1, const KDtree *kd2,
+		 ::std::vector<float> &weights1, ::std::vector<float> &weights2,
+		 const ICP_params &params,
+		 ::std::vector<ICP_iter_stats> *stats = NULL);
+
 // Easier-to-use interface to ICP
 extern float ICP(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 		 int verbose = 0,
 		 bool do_scale = false, bool do_affine = false);
 
+
+// Parameters for global_register.  Radius and inlier distance of 0 are
+// figured out from the spacing of the samples.
+struct GlobalReg_params {
+	int nsamples;		// Points per mesh used for descriptors
+	float radius;		// Descriptor neighborhood radius
+	float inlier_dist;	// Max distance for a correspondence to count
+	int ransac_iters;
+	int min_inliers;
+	bool use_curvature;	// Include shape index in descriptors
+	unsigned seed;		// Same seed gives the same result
+	int verbose;
+
+	GlobalReg_params() : nsamples(3000), radius(0.0f), inlier_dist(0.0f),
+		ransac_iters(20000), min_inliers(10), use_curvature(true),
+		seed(0), verbose(0)
+		{}
+};
+
+// Coarse registration of s2 to s1 in arbitrary initial poses, by matching
+// local descriptors (FPFH plus curvature) and running RANSAC.  Sets xf2 to
+// a transform suitable for starting ICP.  Returns the fraction of feature
+// matches that agree with the result, or -1 on failure.
+extern float global_register(TriMesh *s1, TriMesh *s2,
+			     const xform &xf1, xform &xf2,
+			     const GlobalReg_params &params = GlobalReg_params());
+
 }; // namespace trimesh
 
 #endif
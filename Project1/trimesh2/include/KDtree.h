@@ -6,7 +6,7 @@ Princeton University
 
 KDtree.h
 A K-D tree for points, with limited capabilities (find nearest point to 
-a given point, or to a ray). 
+a given point, or to a ray, or all points within some radius). 
 
 Note that in order to be generic, this *doesn't* use Vecs and the like...
 */
@@ -19,6 +19,8 @@ class KDtree {
 private:
 	class Node;
 	Node *root;
+	const float *base;
+	::std::vector<const void *> leaf_of;
 	void build(const float *ptlist, size_t n);
 
 public:
@@ -45,6 +47,13 @@ public:
 	const float *closest_to_pt(const float *p,
 				   float maxdist2 = 0.0f,
 				   const CompatFunc *iscompat = NULL) const;
+	// Closest point to p, with the search started from hint, which must be
+	// a point in the tree (e.g., the result of an earlier query from a
+	// nearby point).  Much faster than closest_to_pt if the answer is
+	// close to hint, and the same result otherwise.  hint may be NULL.
+	const float *closest_to_pt(const float *p, const float *hint,
+				   float maxdist2,
+				   const CompatFunc *iscompat = NULL) const;
 	const float *closest_to_ray(const float *p, const float *dir,
 				    float maxdist2 = 0.0f,
 				    const CompatFunc *iscompat = NULL) const;
@@ -55,6 +64,17 @@ public:
 				  const float *p,
 				  float maxdist2 = 0.0f,
 				  const CompatFunc *iscompat = NULL) const;
+
+	// Find all points within sqrt(maxdist2), in no particular order
+	void find_in_radius(::std::vector<const float *> &pts,
+			    const float *p,
+			    float maxdist2,
+			    const CompatFunc *iscompat = NULL) const;
+
+	// The index, in the array the tree was built from, of a point
+	// returned by one of the above
+	size_t index_of(const float *p) const
+		{ return (p - base) / 3; }
 };
 
 }; // namespace trimesh
@@ -21,6 +21,22 @@ Class for triangle meshes.
 #endif
 
 
+namespace trimesh {
+
+// The type of vertex and face indices.  Define TRIMESH_INDEX64, when
+// compiling both the library and the code that uses it, to handle meshes
+// with more than 2^31 vertices or faces.
+#ifdef TRIMESH_INDEX64
+typedef long long index_t;
+#else
+typedef int index_t;
+#endif
+
+}; // namespace trimesh
+
+#include "Attrib.h"
+
+
 namespace trimesh {
 
 class TriMesh {
@@ -29,21 +45,21 @@ public:
 	// Types
 	//
 	struct Face {
-		int v[3];
+		index_t v[3];
 
 		Face() {}
-		Face(const int &v0, const int &v1, const int &v2)
+		Face(const index_t &v0, const index_t &v1, const index_t &v2)
 			{ v[0] = v0; v[1] = v1; v[2] = v2; }
-		Face(const int *v_)
+		Face(const index_t *v_)
 			{ v[0] = v_[0]; v[1] = v_[1]; v[2] = v_[2]; }
 		template <class S> explicit Face(const S &x)
 			{ v[0] = x[0];  v[1] = x[1];  v[2] = x[2]; }
-		int &operator[] (int i) { return v[i]; }
-		const int &operator[] (int i) const { return v[i]; }
-		operator const int * () const { return &(v[0]); }
-		operator const int * () { return &(v[0]); }
-		operator int * () { return &(v[0]); }
-		int indexof(int v_) const
+		index_t &operator[] (int i) { return v[i]; }
+		const index_t &operator[] (int i) const { return v[i]; }
+		operator const index_t * () const { return &(v[0]); }
+		operator const index_t * () { return &(v[0]); }
+		operator index_t * () { return &(v[0]); }
+		int indexof(index_t v_) const
 		{
 			return (v[0] == v_) ? 0 :
 			       (v[1] == v_) ? 1 :
@@ -59,6 +75,42 @@ public:
 			{}
 	};
 
+	// A list of indices for each vertex, stored in compressed sparse row
+	// form: the entries for vertex i are ind[off[i]] .. ind[off[i+1]-1].
+	// a[i] gives a lightweight read-only view of one list, which supports
+	// size(), empty(), [], begin(), and end() like a vector<int>.
+	struct Adjacency {
+		::std::vector<index_t> off, ind;
+
+		struct Row {
+			const index_t *b, *e;
+			Row(const index_t *b_, const index_t *e_) : b(b_), e(e_)
+				{}
+			size_t size() const { return e - b; }
+			bool empty() const { return b == e; }
+			const index_t &operator[] (size_t i) const { return b[i]; }
+			const index_t *begin() const { return b; }
+			const index_t *end() const { return e; }
+			operator ::std::vector<index_t> () const
+				{ return ::std::vector<index_t>(b, e); }
+		};
+
+		Row operator[] (size_t i) const
+		{
+			const index_t *p = ind.empty() ? 0 : &ind[0];
+			return Row(p + off[i], p + off[i+1]);
+		}
+		size_t size() const { return off.empty() ? 0 : off.size() - 1; }
+		bool empty() const { return off.empty(); }
+		void clear() { off.clear(); ind.clear(); }
+
+		// Renumber: list i becomes old list rows[i] (empty if
+		// rows[i] < 0), with each entry e replaced by elems[e] or
+		// dropped if that is negative.  Empty elems keeps entries.
+		void remap(const ::std::vector<index_t> &rows,
+			   const ::std::vector<index_t> &elems);
+	};
+
 	//
 	// Enums
 	//
@@ -68,11 +120,15 @@ public:
 		STAT_RMS, STAT_MEDIAN, STAT_STDEV, STAT_TOTAL };
 	enum StatVal { STAT_VALENCE, STAT_FACEAREA, STAT_ANGLE,
 		STAT_DIHEDRAL, STAT_EDGELEN, STAT_X, STAT_Y, STAT_Z };
+	enum NormWeight { NORM_MAX, NORM_AREA, NORM_ANGLE };
 
 	//
 	// Constructor
 	//
-	TriMesh() : grid_width(-1), grid_height(-1), flag_curr(0)
+	TriMesh() : grid_width(-1), grid_height(-1), flag_curr(0),
+		    version(0), all_changed(0), topology_version(0),
+		    normals_version(0), pointareas_version(0), curv_version(0),
+		    normals_weight(-1), normals_full(0), curv_normals_full(0)
 		{}
 
 	//
@@ -84,10 +140,10 @@ public:
 	::std::vector<Face> faces;
 
 	// Triangle strips
-	::std::vector<int> tstrips;
+	::std::vector<index_t> tstrips;
 
 	// Grid, if present
-	::std::vector<int> grid;
+	::std::vector<index_t> grid;
 	int grid_width, grid_height;
 
 	// Other per-vertex properties
@@ -108,20 +164,42 @@ public:
         ::std::vector<Face> texfaces;
         ::std::vector<vec> udirs, vdirs;
 
+	// Any other named per-vertex or per-face attributes
+	AttribSet attribs;
+
 	// Bounding structures
 	box bbox;
 	BSphere bsphere;
 
 	// Connectivity structures:
-	//  For each vertex, all neighboring vertices
-	::std::vector< ::std::vector<int> > neighbors;
-	//  For each vertex, all neighboring faces
-	::std::vector< ::std::vector<int> > adjacentfaces;
+	//  For each vertex, all neighboring vertices, in the order they are
+	//  encountered walking over the faces
+	Adjacency neighbors;
+	//  For each vertex, all neighboring faces, in increasing order
+	Adjacency adjacentfaces;
 	//  For each face, the three faces attached to its edges
 	//  (for example, across_edge[3][2] is the number of the face
 	//   that's touching the edge opposite vertex 2 of face 3)
 	::std::vector<Face> across_edge;
 
+	// Dirty tracking: version is bumped by each change, and derived data
+	// remembers the version it is up to date with.  vert_changed holds
+	// the version at which each vertex last changed (empty if never),
+	// and all_changed the version at which everything last changed.
+	// topology_version counts only changes to the faces and renumberings,
+	// for data that depends on connectivity but not on positions.
+	unsigned version, all_changed, topology_version;
+	::std::vector<unsigned> vert_changed;
+	unsigned normals_version, pointareas_version, curv_version;
+	// The NormWeight the normals were computed with, or -1 if they came
+	// from elsewhere (e.g., the file)
+	int normals_weight;
+	// Number of times the normals were replaced wholesale (recomputed in
+	// full, or set by diffuse_normals), and that count when the
+	// curvatures were computed: they only depend on the moved vertices'
+	// normals if the rest haven't been replaced since.
+	unsigned normals_full, curv_normals_full;
+
 	//
 	// Compute all this stuff...
 	//
@@ -138,9 +216,9 @@ public:
 		else if (!grid.empty())
 			triangulate_grid();
 	}
-	void need_normals();
+	void need_normals(NormWeight weight = NORM_MAX);
 	void need_pointareas();
-	void need_curvatures();
+	void need_curvatures(bool with_dcurv = false);
 	void need_dcurv();
 	void need_bbox();
 	void need_bsphere();
@@ -149,6 +227,62 @@ public:
 	void need_across_edge();
         void need_uv_dirs();
 
+	//
+	// Dirty tracking.  Code that moves vertices calls changed_vertices(),
+	// after which need_normals(), need_pointareas() and need_curvatures()
+	// recompute only the neighborhood of the vertices that moved.  Code
+	// that changes the faces calls changed_faces(), which clears the
+	// connectivity and marks everything else out of date.  Code that
+	// renumbers vertices or faces (and their data along with them) calls
+	// changed_numbering(), which only bumps the versions.
+	//
+	void changed_vertices(const ::std::vector<index_t> &which);
+	void changed_vertices();
+	void changed_faces();
+	void changed_numbering();
+
+	//
+	// Custom attributes.  These replace any existing attribute with the
+	// same name, and start out zero.
+	//
+	template <class T>
+	Attrib<T> *add_vert_attrib(const ::std::string &name, int ncomp = 1,
+				   bool soa = true)
+	{
+		Attrib<T> *a = new Attrib<T>(name, AttribBase::VERTEX,
+					     ncomp, soa);
+		a->resize(vertices.size());
+		attribs.add(a);
+		return a;
+	}
+	template <class T>
+	Attrib<T> *add_face_attrib(const ::std::string &name, int ncomp = 1,
+				   bool soa = true)
+	{
+		need_faces();
+		Attrib<T> *a = new Attrib<T>(name, AttribBase::FACE,
+					     ncomp, soa);
+		a->resize(faces.size());
+		attribs.add(a);
+		return a;
+	}
+	// Returns NULL if there is no attribute with this name and type
+	template <class T>
+	Attrib<T> *get_attrib(const ::std::string &name)
+		{ return dynamic_cast<Attrib<T> *>(attribs.find(name)); }
+	void remove_attrib(const ::std::string &name)
+		{ attribs.remove(name); }
+protected:
+	bool dirty_verts(unsigned since, int rings,
+			 ::std::vector<index_t> &verts);
+	void faces_of(const ::std::vector<index_t> &verts,
+		      ::std::vector<index_t> &f);
+	void update_normals(const ::std::vector<index_t> &verts,
+			    NormWeight weight);
+	void update_pointareas(const ::std::vector<index_t> &verts);
+	void update_curvatures(const ::std::vector<index_t> &verts);
+public:
+
 	//
 	// Delete everything
 	//
@@ -162,9 +296,16 @@ public:
 		curv1.clear(); curv2.clear(); dcurv.clear();
 		cornerareas.clear(); pointareas.clear();
                 texcoords.clear(); texfaces.clear(); udirs.clear(); vdirs.clear();
+		attribs.clear();
 
 		bbox.valid = bsphere.valid = false;
 		neighbors.clear(); adjacentfaces.clear(); across_edge.clear();
+		// The version keeps counting up, so that nothing computed
+		// from the old contents looks up to date
+		all_changed = ++version; vert_changed.clear();
+		topology_version++;
+		normals_version = pointareas_version = curv_version = 0;
+		normals_weight = -1;
 	}
 
 	//
@@ -184,7 +325,7 @@ public:
 	//
 
 	// Is vertex v on the mesh boundary?
-	bool is_bdy(int v)
+	bool is_bdy(index_t v)
 	{
 		if (neighbors.empty()) need_neighbors();
 		if (adjacentfaces.empty()) need_adjacentfaces();
@@ -192,7 +333,7 @@ public:
 	}
 
 	// Centroid of face f
-	vec centroid(int f)
+	vec centroid(index_t f)
 	{
 		if (faces.empty()) need_faces();
 		return (1.0f / 3.0f) *
@@ -202,7 +343,7 @@ public:
 	}
 
 	// Normal of face f
-	vec trinorm(int f)
+	vec trinorm(index_t f)
 	{
 		if (faces.empty()) need_faces();
 		return trimesh::trinorm(vertices[faces[f][0]], vertices[faces[f][1]],
@@ -28,9 +28,54 @@ extern void faceflip(TriMesh *mesh);
 // One iteration of umbrella-operator smoothing
 extern void umbrella(TriMesh *mesh, float stepsize, bool tangent = false);
 
+// Umbrella operator, precomputed for many iterations of explicit smoothing.
+// Rows are stored in groups of GROUP, each padded to its longest row and
+// interleaved (entry k of row g*GROUP+r is ind[start[g] + k*GROUP + r]), so
+// that a group can be processed with SIMD across its rows.  Padding refers
+// to index npad, which holds zero.  Boundary rows have keep == 0.  The
+// operator remembers the mesh's topology_version, and is refused once the
+// faces have changed or the vertices have been renumbered: rebuild it then.
+struct UmbrellaOp {
+	enum { GROUP = 8 };
+	index_t nv, npad;
+	unsigned topology;
+	::std::vector<index_t> start, ind;
+	::std::vector<float> count, keep;
+};
+extern void build_umbrella(TriMesh *mesh, UmbrellaOp &op);
+
+// Iterations of umbrella-operator smoothing with a precomputed operator
+extern void umbrella(TriMesh *mesh, const UmbrellaOp &op, float stepsize,
+	int niters = 1);
+
 // Taubin lambda/mu mesh smoothing
 extern void lmsmooth(TriMesh *mesh, int niters);
 
+// Taubin lambda/mu smoothing with a precomputed operator.  Both steps of
+// each iteration are done in one pass over memory, when the vertex order
+// allows it (see reorder_spatial).
+extern void lmsmooth(TriMesh *mesh, const UmbrellaOp &op, int niters,
+	float lambda = 0.330f, float mu = -0.331f);
+
+// Mesh Laplacian, as a sparse matrix: row i holds the neighbors of vertex i
+// (in the same layout as mesh->neighbors) and their weights, which add up
+// to diag[i].  bdy marks boundary and isolated vertices.
+enum { LAPLACIAN_UNIFORM, LAPLACIAN_COTAN };
+struct Laplacian {
+	int scheme;
+	::std::vector<index_t> off, ind;
+	::std::vector<float> wt, diag;
+	::std::vector<unsigned char> bdy;
+};
+extern void build_laplacian(TriMesh *mesh, Laplacian &L,
+	int scheme = LAPLACIAN_UNIFORM);
+
+// Implicit (backward Euler) Laplacian smoothing [Desbrun et al. 1999].  Each
+// of niters steps solves (I + lambda L) x = x0 by preconditioned conjugate
+// gradients, so there is no limit on lambda.  Boundaries stay fixed.
+extern void implicit_smooth(TriMesh *mesh, float lambda,
+	int scheme = LAPLACIAN_COTAN, int niters = 1);
+
 // Remove the indicated vertices from the TriMesh.
 extern void remove_vertices(TriMesh *mesh, const ::std::vector<bool> &toremove);
 
@@ -45,17 +90,131 @@ extern void remove_faces(TriMesh *mesh, const ::std::vector<bool> &toremove);
 // call to remove_unused_vertices()
 extern void remove_sliver_faces(TriMesh *mesh);
 
-// Remap vertices according to the given table
-extern void remap_verts(TriMesh *mesh, const ::std::vector<int> &remap_table);
+// Exclusive prefix sum of count[0..n-1] into off[0..n], in parallel
+extern void prefix_sum(const ::std::vector<index_t> &count,
+	::std::vector<index_t> &off);
+
+// Remap vertices according to the given table.  Normals, curvatures,
+// connectivity and areas are remapped along with them, or with
+// keep_derived == false dropped, to be recomputed when needed.
+extern void remap_verts(TriMesh *mesh, const ::std::vector<index_t> &remap_table,
+	bool keep_derived = true);
 
 // Reorder vertices in a mesh according to the order in which
 // they are referenced by the tstrips or faces.
 extern void reorder_verts(TriMesh *mesh);
 
-// Perform one iteration of subdivision on a mesh.
+// Reorder vertices along a Morton curve through the bounding box, then faces
+// by their lowest-numbered vertex, for memory locality in everything that
+// follows
+extern void reorder_spatial(TriMesh *mesh);
+
+// Permute faces according to the given table (face i moves to
+// remap_table[i]), along with per-face data.  Drops tstrips and grid.
+extern void remap_faces(TriMesh *mesh, const ::std::vector<index_t> &remap_table);
+
+// Reorder faces to make good use of a post-transform vertex cache of the
+// given size (Tipsify).  Drops tstrips and grid.
+extern void reorder_faces(TriMesh *mesh, int cache_size = 16);
+
+// Average cache miss ratio (misses per face) and average transform to vertex
+// ratio (misses per vertex) of the faces, for a FIFO cache of the given size
+extern void cache_stats(TriMesh *mesh, int cache_size, float &acmr, float &atvr);
+
+// reorder_faces() followed by reorder_verts(), reporting ACMR/ATVR
+extern void optimize_vertex_cache(TriMesh *mesh, int cache_size = 16);
+
+// Meshlets: clusters of at most max_verts vertices and max_tris faces.
+// Meshlet i uses the vertices verts[vert_offset .. vert_offset+vert_count-1]
+// of the mesh, and its faces are triples of indices into that list, at
+// tris[3*tri_offset .. 3*(tri_offset+tri_count)-1].
+struct Meshlet {
+	size_t vert_offset, tri_offset;
+	unsigned vert_count, tri_count;
+	point center;		// Bounding sphere
+	float radius;
+	vec cone_axis;		// All face normals are within the cone around
+	float cone_cutoff;	// cone_axis whose half-angle has this sine
+};
+struct Meshlets {
+	::std::vector<Meshlet> meshlets;
+	::std::vector<index_t> verts;
+	::std::vector<unsigned char> tris;
+};
+
+// Partition the faces of a mesh into spatially compact meshlets.
+// max_verts is at most 256.
+extern void build_meshlets(TriMesh *mesh, Meshlets &ml,
+	int max_verts = 64, int max_tris = 124);
+
+// Find the meshlets that may be visible: those whose bounding spheres touch
+// the view frustum and whose normal cones don't face away from the camera.
+// proj_view maps mesh coordinates to clip coordinates, and camera is the
+// eye point in mesh coordinates.
+extern void cull_meshlets(const Meshlets &ml, const xform &proj_view,
+	const point &camera, ::std::vector<int> &visible);
+
+// Pack the faces into 16-bit indices, for small meshes headed to the GPU.
+// Consecutive faces are grouped into chunks whose vertices all lie within
+// 65536 of the chunk's base; inds holds 3 indices per face, relative to the
+// base of its chunk.  Returns false if some face spans too many vertices
+// (reorder_verts() first usually helps).
+struct IndexChunk16 {
+	index_t base;		// Added to every index in the chunk
+	size_t first, count;	// Range of faces
+};
+extern bool pack_indices16(TriMesh *mesh, ::std::vector<unsigned short> &inds,
+	::std::vector<IndexChunk16> &chunks);
+
+// Perform the given number of iterations of subdivision on a mesh.
 enum { SUBDIV_PLANAR, SUBDIV_LOOP, SUBDIV_LOOP_ORIG, SUBDIV_LOOP_NEW,
        SUBDIV_BUTTERFLY, SUBDIV_BUTTERFLY_MODIFIED };
-extern void subdiv(TriMesh *mesh, int scheme = SUBDIV_LOOP);
+extern void subdiv(TriMesh *mesh, int scheme = SUBDIV_LOOP, int levels = 1);
+
+// Adaptive subdivision: one level of refinement of the faces marked in
+// refine, plus enough of their neighbors to keep the mesh conforming
+// (red-green refinement).  Original vertices stay put, so the interpolating
+// schemes (planar and butterfly) are the ones that make sense here.
+extern void subdiv_adaptive(TriMesh *mesh, const ::std::vector<bool> &refine,
+	int scheme = SUBDIV_BUTTERFLY_MODIFIED);
+
+// Choose faces for subdiv_adaptive: those across which the normal turns by
+// more than max_angle (in radians), according to the curvature...
+extern void mark_curved_faces(TriMesh *mesh, float max_angle,
+	::std::vector<bool> &refine);
+
+// ... or those that are in view and have an edge longer than max_len pixels,
+// given the matrix to clip coordinates and the size of the viewport
+extern void mark_large_faces(TriMesh *mesh, const xform &proj_view,
+	int width, int height, float max_len, ::std::vector<bool> &refine);
+
+// Simplify the mesh by edge collapses in order of quadric error [Garland
+// and Heckbert 1997], until it has at most target_faces faces or (if
+// max_error > 0) the next collapse would move the surface by more than
+// max_error.  Each collapse merges a vertex into a neighbor, so surviving
+// vertices keep their positions and all of their properties.  Boundaries
+// are preserved, and colors are part of the quadrics.  Collapses are done
+// in parallel batches whose neighborhoods don't overlap.
+extern void decimate(TriMesh *mesh, index_t target_faces,
+	float max_error = 0);
+
+// Levels of detail, all using the original vertices of the mesh.  Level i
+// consists of faces[off[i]] .. faces[off[i+1]-1], and error[i] is the
+// largest error of any collapse used to reach it.  Level 0 is the mesh.
+struct LODChain {
+	::std::vector<TriMesh::Face> faces;
+	::std::vector<index_t> off;
+	::std::vector<float> error;
+
+	int levels() const
+		{ return off.empty() ? 0 : (int) off.size() - 1; }
+};
+
+// Build up to max_levels levels of detail, each with about ratio times as
+// many faces as the last, by decimating a copy of the mesh.  Stops early if
+// the next level would need a collapse with more than max_error.
+extern void build_lods(TriMesh *mesh, LODChain &lods, int max_levels = 8,
+	float ratio = 0.5f, float max_error = 0);
 
 // Smooth the mesh geometry
 extern void smooth_mesh(TriMesh *themesh, float sigma);
@@ -63,18 +222,43 @@ extern void smooth_mesh(TriMesh *themesh, float sigma);
 // Bilateral smoothing
 extern void bilateral_smooth_mesh(TriMesh *themesh, float sigma1, float sigma2);
 
+// Precomputed weights for diffusing per-vertex fields: a sparse matrix
+// whose row i (stored as in TriMesh::Adjacency) holds the vertices near i
+// and their weights, which add up to sum[i].  Passing one of these to the
+// diffuse_* functions below finds the neighborhoods once instead of on
+// every call.  It is rebuilt when the mesh changes (according to its
+// version, which also counts renumberings) or sigma is different.  The
+// weights depend on the normals, so call clear() after changing them by
+// other means.
+struct DiffusionOp {
+	const TriMesh *mesh;
+	unsigned version;
+	float sigma;
+	::std::vector<index_t> off, ind;
+	::std::vector<float> wt, sum;
+	DiffusionOp() : mesh(NULL), version(0), sigma(0)
+		{}
+	void clear()
+		{ mesh = NULL; off.clear(); ind.clear(); wt.clear(); sum.clear(); }
+};
+extern void build_diffusion(TriMesh *themesh, float sigma, DiffusionOp &op);
+
 // Diffuse an arbitrary per-vertex vector (or scalar) field
 template <class T>
-extern void diffuse_vector(TriMesh *themesh, ::std::vector<T> &field, float sigma);
+extern void diffuse_vector(TriMesh *themesh, ::std::vector<T> &field, float sigma,
+	DiffusionOp *op = NULL);
 
 // Diffuse the normals across the mesh
-extern void diffuse_normals(TriMesh *themesh, float sigma);
+extern void diffuse_normals(TriMesh *themesh, float sigma,
+	DiffusionOp *op = NULL);
 
 // Diffuse the curvatures across the mesh
-extern void diffuse_curv(TriMesh *themesh, float sigma);
+extern void diffuse_curv(TriMesh *themesh, float sigma,
+	DiffusionOp *op = NULL);
 
 // Diffuse the curvature derivatives across the mesh
-extern void diffuse_dcurv(TriMesh *themesh, float sigma);
+extern void diffuse_dcurv(TriMesh *themesh, float sigma,
+	DiffusionOp *op = NULL);
 
 // Given a curvature tensor, find principal directions and curvatures
 extern void diagonalize_curv(const vec &old_u, const vec &old_v,
@@ -148,8 +332,8 @@ extern void orient(TriMesh *mesh);
 // Remove boundary vertices (and faces that touch them) 
 extern void erode(TriMesh *mesh);
 
-// Add a bit of noise to the mesh 
-extern void noisify(TriMesh *mesh, float amount);
+// Add a bit of noise to the mesh.  The same seed gives the same noise.
+extern void noisify(TriMesh *mesh, float amount, unsigned seed = 0);
 
 // Find connected components.
 // Considers components to be connected if they touch at a vertex if
@@ -159,25 +343,27 @@ extern void noisify(TriMesh *mesh, float amount);
 //   associated connected component.
 //  compsizes holds the size of each connected component.
 // Connected components are sorted from largest to smallest.
-extern void find_comps(TriMesh *mesh, ::std::vector<int> &comps,
-	::std::vector<int> &compsizes, bool conn_vert = false);
+extern void find_comps(TriMesh *mesh, ::std::vector<index_t> &comps,
+	::std::vector<index_t> &compsizes, bool conn_vert = false);
 
 // Select a particular connected component, and delete all other vertices from
 // the mesh.
-extern void select_comp(TriMesh *mesh, const ::std::vector<int> &comps,
-	int whichcc);
+extern void select_comp(TriMesh *mesh, const ::std::vector<index_t> &comps,
+	index_t whichcc);
 
 // Select the connected components no smaller than min_size (but no more than
 // total_largest components), and delete all other vertices from the mesh.
-extern void select_big_comps(TriMesh *mesh, const ::std::vector<int> &comps,
-	const ::std::vector<int> &compsizes, int min_size,
-	int total_largest = ::std::numeric_limits<int>::max());
+extern void select_big_comps(TriMesh *mesh,
+	const ::std::vector<index_t> &comps,
+	const ::std::vector<index_t> &compsizes, index_t min_size,
+	index_t total_largest = ::std::numeric_limits<index_t>::max());
 
 // Select the connected components no bigger than max_size (but no more than
 // total_smallest components), and delete all other vertices from the mesh.
-extern void select_small_comps(TriMesh *mesh, const ::std::vector<int> &comps,
-	const ::std::vector<int> &compsizes, int max_size,
-	int total_smallest = ::std::numeric_limits<int>::max());
+extern void select_small_comps(TriMesh *mesh,
+	const ::std::vector<index_t> &comps,
+	const ::std::vector<index_t> &compsizes, index_t max_size,
+	index_t total_smallest = ::std::numeric_limits<index_t>::max());
 
 // Find overlap area and RMS distance between mesh1 and mesh2.
 // rmsdist is unchanged if area returned as zero
@@ -195,7 +381,13 @@ extern void find_overlap(TriMesh *mesh1, TriMesh *mesh2,
 
 // Find separate mesh vertices that should be "shared": they lie on separate
 // connected components, but they are within "tol" of each other.
-extern void shared(TriMesh *mesh, float tol);
+// If stats is given, reports how many vertices were merged into others and
+// the farthest any of them moved.
+struct SharedStats {
+	int merged;
+	float max_dist;
+};
+extern void shared(TriMesh *mesh, float tol, SharedStats *stats = NULL);
 
 }; // namespace trimesh
 
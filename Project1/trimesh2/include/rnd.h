@@ -0,0 +1,79 @@
+#ifndef RND_H
+#define RND_H
+/*
+Szymon Rusinkiewicz
+Princeton University
+
+rnd.h
+Counter-based random numbers.  The number for a given (seed, index, k) is
+a pure function of those values, so parallel loops can draw numbers for
+element i without any shared state, and results do not depend on thread
+count or call order.
+
+Sample usage:
+	rnd_float(seed, i)		// Uniform in [0,1) for element i
+	rnd_float(seed, i, k)		// k-th number for element i
+	rnd_uint(seed, i, k)		// 32 random bits
+	Rnd r(seed); r.unif();		// Sequential stream, seeded
+*/
+
+
+namespace trimesh {
+
+// The SplitMix64 finalizer, a bijective mixing of 64 bits
+static inline unsigned long long rnd_mix(unsigned long long x)
+{
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ull;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebull;
+	x ^= x >> 31;
+	return x;
+}
+
+// 64 random bits for (seed, index, k)
+static inline unsigned long long rnd_bits(unsigned long long seed,
+					  unsigned long long index,
+					  unsigned long long k = 0)
+{
+	const unsigned long long golden = 0x9e3779b97f4a7c15ull;
+	unsigned long long key = rnd_mix(seed + golden);
+	key = rnd_mix(key + k * golden);
+	return rnd_mix(key ^ (index * golden + golden));
+}
+
+// 32 random bits for (seed, index, k)
+static inline unsigned rnd_uint(unsigned long long seed,
+				unsigned long long index,
+				unsigned long long k = 0)
+{
+	return (unsigned) (rnd_bits(seed, index, k) >> 32);
+}
+
+// Uniform float in [0,1) for (seed, index, k)
+static inline float rnd_float(unsigned long long seed,
+			      unsigned long long index,
+			      unsigned long long k = 0)
+{
+	return (rnd_bits(seed, index, k) >> 40) * (1.0f / 16777216.0f);
+}
+
+
+// A sequential stream, for code that just wants "the next number".
+// Equivalent to rnd_float(seed, 0), rnd_float(seed, 1), ...
+class Rnd {
+private:
+	unsigned long long seed, counter;
+
+public:
+	explicit Rnd(unsigned long long seed_ = 0) : seed(seed_), counter(0)
+		{}
+	float unif()
+		{ return rnd_float(seed, counter++); }
+	unsigned uint()
+		{ return rnd_uint(seed, counter++); }
+};
+
+}; // namespace trimesh
+
+#endif
@@ -0,0 +1,498 @@
+/*
+Szymon Rusinkiewicz
+Princeton University
+
+HalfEdge.cc
+Array-based half-edge connectivity, with local edits.
+*/
+
+#include "HalfEdge.h"
+#include "TriMesh_algo.h"
+#include <algorithm>
+using namespace std;
+#define dprintf TriMesh::dprintf
+
+
+namespace trimesh {
+
+// Build twins and outgoing half-edges from the faces
+void HalfEdge::build()
+{
+	mesh->need_faces();
+	index_t nv = mesh->vertices.size(), nf = mesh->faces.size();
+	twin.assign(3 * nf, -1);
+	out.assign(nv, -1);
+	if (!nf)
+		return;
+
+	mesh->need_adjacentfaces();
+	dprintf("Building half-edge structure... ");
+	const vector<TriMesh::Face> &faces = mesh->faces;
+
+	// The candidate twin of each half-edge is the first one running the
+	// other way, found by looking at the faces around its endpoint.
+	vector<index_t> cand(3 * nf, -1);
+#pragma omp parallel for
+	for (index_t h = 0; h < 3 * nf; h++) {
+		index_t v1 = from(h), v2 = to(h);
+		if (v1 == v2)
+			continue;
+		TriMesh::Adjacency::Row a = mesh->adjacentfaces[v2];
+		for (size_t k = 0; k < a.size() && cand[h] < 0; k++) {
+			const TriMesh::Face &f = faces[a[k]];
+			for (int j = 0; j < 3; j++) {
+				if (f[j] == v2 && f[(j+1)%3] == v1) {
+					cand[h] = 3 * a[k] + j;
+					break;
+				}
+			}
+		}
+	}
+
+	// Keep only the pairs that agree, so that non-manifold edges
+	// end up as boundaries rather than inconsistent twins
+#pragma omp parallel for
+	for (index_t h = 0; h < 3 * nf; h++) {
+		index_t t = cand[h];
+		if (t >= 0 && cand[t] == h)
+			twin[h] = t;
+	}
+
+	// Outgoing half-edge for each vertex, preferring one on the boundary
+#pragma omp parallel for
+	for (index_t i = 0; i < nv; i++) {
+		TriMesh::Adjacency::Row a = mesh->adjacentfaces[i];
+		for (size_t k = 0; k < a.size(); k++) {
+			const TriMesh::Face &f = faces[a[k]];
+			int j = f.indexof(i);
+			index_t h = 3 * a[k] + j;
+			if (out[i] < 0)
+				out[i] = h;
+			if (twin[h] < 0) {
+				out[i] = h;
+				break;
+			}
+		}
+	}
+
+	dprintf("Done.\n");
+}
+
+
+// Mark the mesh's derived structures as out of date after an edit
+void HalfEdge::touched()
+{
+	mesh->tstrips.clear();
+	mesh->grid.clear();
+	mesh->changed_faces();
+	mesh->pointareas.clear();
+	mesh->curv1.clear();
+	mesh->curv2.clear();
+	mesh->pdir1.clear();
+	mesh->pdir2.clear();
+	mesh->dcurv.clear();
+}
+
+
+// Set out[v], given any outgoing half-edge h of v (or -1).  Walks backwards
+// around v to the boundary, if there is one.
+void HalfEdge::fix_out(index_t v, index_t h)
+{
+	if (h >= 0) {
+		index_t start = h;
+		while (twin[h] >= 0) {
+			index_t g = next(twin[h]);
+			if (g == start)
+				break;
+			h = g;
+		}
+	}
+	out[v] = h;
+}
+
+
+// Number of neighbors of v
+int HalfEdge::valence(index_t v) const
+{
+	index_t h = out[v];
+	if (h < 0)
+		return 0;
+	int n = 0;
+	do {
+		n++;
+		h = ring_next(h);
+	} while (h >= 0 && h != out[v]);
+
+	// Walked off the boundary: one more neighbor than outgoing edges
+	if (h < 0)
+		n++;
+	return n;
+}
+
+
+// The neighbors of v, in order around it
+void HalfEdge::one_ring(index_t v, vector<index_t> &ring) const
+{
+	ring.clear();
+	index_t h = out[v];
+	if (h < 0)
+		return;
+	index_t last;
+	do {
+		ring.push_back(to(h));
+		last = h;
+		h = ring_next(h);
+	} while (h >= 0 && h != out[v]);
+	if (h < 0)
+		ring.push_back(from(prev(last)));
+}
+
+
+// The half-edge from v1 to v2, or -1 if there is none
+index_t HalfEdge::find_edge(index_t v1, index_t v2) const
+{
+	index_t h = out[v1];
+	if (h < 0)
+		return -1;
+	do {
+		if (to(h) == v2)
+			return h;
+		h = ring_next(h);
+	} while (h >= 0 && h != out[v1]);
+	return -1;
+}
+
+
+/*
+            c                               c
+           +                               +
+          / \                             /|\
+         /   \                           / | \
+      a +--h->+ b         --->        a +  |  + b
+         \   /                           \ | /
+          \ /                             \|/
+           +                               +
+            d                               d
+
+   Edge flip: faces (a,b,c) and (b,a,d) become (d,b,c) and (c,a,d).
+   Each face keeps its corner order, so only one corner of each changes.
+*/
+bool HalfEdge::flip(index_t h)
+{
+	index_t t = twin[h];
+	if (t < 0)
+		return false;
+
+	index_t h1 = next(h), h2 = prev(h), t1 = next(t), t2 = prev(t);
+	index_t a = from(h), b = to(h), c = from(h2), d = from(t2);
+	if (c == d || find_edge(c, d) >= 0 || find_edge(d, c) >= 0)
+		return false;
+
+	TriMesh::Face &f1 = mesh->faces[face(h)], &f2 = mesh->faces[face(t)];
+	f1[h % 3] = d;
+	f2[t % 3] = c;
+
+	// h is now d->b, h2 is c->d, t is c->a, t2 is d->c
+	index_t xdb = twin[t2], xca = twin[h2];
+	twin[h] = xdb;
+	if (xdb >= 0)
+		twin[xdb] = h;
+	twin[t] = xca;
+	if (xca >= 0)
+		twin[xca] = t;
+	twin[h2] = t2;
+	twin[t2] = h2;
+
+	// Outgoing half-edges that now start somewhere else
+	if (out[a] == h)
+		out[a] = t1;
+	if (out[b] == t)
+		out[b] = h1;
+	if (out[c] == h2)
+		out[c] = t;
+	if (out[d] == t2)
+		out[d] = h;
+
+	touched();
+	return true;
+}
+
+
+/*
+            c                               c
+           +                               +
+          / \                              |
+         /   \                             |
+      a +--h->+ b         --->             + b
+         \   /                             |
+          \ /                              |
+           +                               +
+            d                               d
+
+   Edge collapse: a is merged into b, and faces (a,b,c) and (b,a,d) are
+   deleted.  Fails unless the only common neighbors of a and b are c and d
+   (the "link condition"), which keeps the mesh manifold.
+*/
+bool HalfEdge::can_collapse(index_t h) const
+{
+	if (h < 0 || deleted(face(h)))
+		return false;
+	index_t t = twin[h];
+	index_t a = from(h), b = to(h);
+	index_t c = to(next(h));
+	index_t d = (t >= 0) ? to(next(t)) : -1;
+	if (a == b || c == a || c == b || c == d)
+		return false;
+
+	// An interior edge between two boundary vertices would pinch
+	if (t >= 0 && is_bdy_vert(a) && is_bdy_vert(b))
+		return false;
+
+	// Walk around a, looking for other neighbors of b
+	index_t g = out[a], last;
+	do {
+		index_t v = to(g);
+		if (v != c && v != d && (find_edge(b, v) >= 0 ||
+		    find_edge(v, b) >= 0))
+			return false;
+		last = g;
+		g = ring_next(g);
+	} while (g >= 0 && g != out[a]);
+	if (g < 0) {
+		index_t v = from(prev(last));
+		if (v != c && v != d && (find_edge(b, v) >= 0 ||
+		    find_edge(v, b) >= 0))
+			return false;
+	}
+	return true;
+}
+
+
+bool HalfEdge::collapse(index_t h)
+{
+	if (!can_collapse(h))
+		return false;
+	do_collapse(h);
+	touched();
+	return true;
+}
+
+
+index_t HalfEdge::collapse(vector<index_t> &hs)
+{
+	index_t n = hs.size(), ndone = 0;
+#pragma omp parallel for reduction(+:ndone)
+	for (index_t i = 0; i < n; i++) {
+		if (!can_collapse(hs[i])) {
+			hs[i] = -1;
+			continue;
+		}
+		do_collapse(hs[i]);
+		ndone++;
+	}
+	if (ndone)
+		touched();
+	return ndone;
+}
+
+
+// The work of collapse(), once it has been checked
+void HalfEdge::do_collapse(index_t h)
+{
+	index_t t = twin[h];
+	index_t a = from(h), b = to(h);
+	index_t h1 = next(h), h2 = prev(h);
+	index_t c = to(h1);
+	index_t d = (t >= 0) ? to(next(t)) : -1;
+
+	// Half-edges on the far side of the faces being deleted, which are
+	// stitched together: c->b with a->c, and d->a with b->d
+	index_t xcb = twin[h1], xac = twin[h2];
+	index_t xda = (t >= 0) ? twin[next(t)] : -1;
+	index_t xbd = (t >= 0) ? twin[prev(t)] : -1;
+
+	// Move everything at a over to b
+	index_t g = out[a];
+	do {
+		mesh->faces[face(g)][g % 3] = b;
+		g = ring_next(g);
+	} while (g >= 0 && g != out[a]);
+
+	// Delete the faces
+	index_t fdel[2] = { face(h), (t >= 0) ? face(t) : -1 };
+	for (int i = 0; i < 2; i++) {
+		if (fdel[i] < 0)
+			continue;
+		mesh->faces[fdel[i]] = TriMesh::Face(-1, -1, -1);
+		twin[3*fdel[i]] = twin[3*fdel[i]+1] = twin[3*fdel[i]+2] = -1;
+	}
+
+	if (xcb >= 0)
+		twin[xcb] = xac;
+	if (xac >= 0)
+		twin[xac] = xcb;
+	if (xda >= 0)
+		twin[xda] = xbd;
+	if (xbd >= 0)
+		twin[xbd] = xda;
+
+	// Find new outgoing half-edges for the vertices that lost theirs
+	out[a] = -1;
+	index_t hb = (xac >= 0) ? xac : (xbd >= 0) ? xbd :
+		 (xcb >= 0) ? next(xcb) : (xda >= 0) ? next(xda) : -1;
+	fix_out(b, hb);
+	fix_out(c, (xcb >= 0) ? xcb : (xac >= 0) ? next(xac) : -1);
+	if (d >= 0)
+		fix_out(d, (xda >= 0) ? xda : (xbd >= 0) ? next(xbd) : -1);
+}
+
+
+/*
+            c                               c
+           +                               +
+          / \                             /|\
+         /   \                           / | \
+      a +--h->+ b         --->        a +--m--+ b
+         \   /                           \ | /
+          \ /                             \|/
+           +                               +
+            d                               d
+
+   Edge split: faces (a,b,c) and (b,a,d) become (a,m,c), (b,m,d), and the
+   new faces (m,b,c), (m,a,d).
+*/
+index_t HalfEdge::split(index_t h, const point &p)
+{
+	index_t t = twin[h];
+	index_t h1 = next(h), h2 = prev(h);
+	index_t a = from(h), b = to(h), c = from(h2);
+
+	// The new vertex, with interpolated properties
+	index_t m = mesh->vertices.size();
+	mesh->vertices.push_back(p);
+	if ((index_t) mesh->normals.size() == m) {
+		vec n = mesh->normals[a] + mesh->normals[b];
+		mesh->normals.push_back(normalize(n));
+	}
+	if ((index_t) mesh->colors.size() == m)
+		mesh->colors.push_back(0.5f * (mesh->colors[a] +
+					       mesh->colors[b]));
+	if ((index_t) mesh->confidences.size() == m)
+		mesh->confidences.push_back(0.5f * (mesh->confidences[a] +
+						    mesh->confidences[b]));
+	if ((index_t) mesh->flags.size() == m)
+		mesh->flags.push_back(mesh->flags[a]);
+	index_t ends[2] = { a, b };
+	float w[2] = { 0.5f, 0.5f };
+	mesh->attribs.append(AttribBase::VERTEX, 2, ends, w);
+	out.push_back(-1);
+	mesh->bbox.valid = false;
+	mesh->bsphere.valid = false;
+
+	// Split face (a,b,c) into (a,m,c) and (m,b,c)
+	index_t xbc = twin[h1];
+	mesh->faces[face(h)][h1 % 3] = m;
+	index_t f3 = mesh->faces.size();
+	mesh->faces.push_back(TriMesh::Face(m, b, c));
+	mesh->attribs.append_copy(AttribBase::FACE, face(h));
+	twin.resize(3 * (f3 + 1), -1);
+	twin[3*f3+1] = xbc;
+	if (xbc >= 0)
+		twin[xbc] = 3*f3+1;
+	twin[h1] = 3*f3+2;
+	twin[3*f3+2] = h1;
+	if (out[b] == h1)
+		out[b] = 3*f3+1;
+
+	if (t < 0) {
+		twin[h] = -1;
+		twin[3*f3] = -1;
+		out[m] = 3*f3;
+		touched();
+		return m;
+	}
+
+	// Split face (b,a,d) into (b,m,d) and (m,a,d)
+	index_t t1 = next(t);
+	index_t d = to(t1);
+	index_t xad = twin[t1];
+	mesh->faces[face(t)][t1 % 3] = m;
+	index_t f4 = mesh->faces.size();
+	mesh->faces.push_back(TriMesh::Face(m, a, d));
+	mesh->attribs.append_copy(AttribBase::FACE, face(t));
+	twin.resize(3 * (f4 + 1), -1);
+	twin[3*f4+1] = xad;
+	if (xad >= 0)
+		twin[xad] = 3*f4+1;
+	twin[t1] = 3*f4+2;
+	twin[3*f4+2] = t1;
+	if (out[a] == t1)
+		out[a] = 3*f4+1;
+
+	// Across the split edge: a->m with m->a, and b->m with m->b
+	twin[h] = 3*f4;
+	twin[3*f4] = h;
+	twin[t] = 3*f3;
+	twin[3*f3] = t;
+	out[m] = 3*f3;
+
+	touched();
+	return m;
+}
+
+
+// Remove deleted faces and unused vertices, then rebuild
+void HalfEdge::compact()
+{
+	index_t nf = mesh->faces.size();
+	vector<bool> dead(nf);
+	bool any = false;
+	for (index_t i = 0; i < nf; i++) {
+		if (deleted(i))
+			dead[i] = any = true;
+	}
+	if (any) {
+		remove_faces(mesh, dead);
+		remove_unused_vertices(mesh);
+	}
+	build();
+}
+
+
+// Check all the invariants
+bool HalfEdge::check() const
+{
+	index_t nv = mesh->vertices.size(), nf = mesh->faces.size();
+	if ((index_t) twin.size() != 3 * nf || (index_t) out.size() != nv)
+		return false;
+
+	bool ok = true;
+	vector<bool> has_bdy(nv);
+	for (index_t h = 0; h < 3 * nf; h++) {
+		if (deleted(face(h))) {
+			if (twin[h] >= 0)
+				ok = false;
+			continue;
+		}
+		index_t t = twin[h];
+		if (t < 0) {
+			has_bdy[from(h)] = true;
+			continue;
+		}
+		if (t >= 3 * nf || deleted(face(t)) || twin[t] != h ||
+		    from(t) != to(h) || to(t) != from(h))
+			ok = false;
+	}
+	for (index_t i = 0; i < nv; i++) {
+		index_t h = out[i];
+		if (h < 0)
+			continue;
+		if (h >= 3 * nf || deleted(face(h)) || from(h) != i)
+			ok = false;
+		else if (has_bdy[i] && twin[h] >= 0)
+			ok = false;
+	}
+	return ok;
+}
+
+}; // namespace trimesh
@@ -12,6 +12,7 @@ Routines for doing ICP.
 #include "KDtree.h"
 #include "timestamp.h"
 #include "lineqn.h"
+#include "rnd.h"
 using namespace std;
 
 
@@ -23,7 +24,10 @@ using namespace std;
 #define COMPAT_THRESH 0.7f
 #define TERM_THRESH 5
 #define TERM_HIST 7
+#define TERM_STEP_HIST 3
 #define EIG_THRESH 0.01f
+#define EXTRAP_ANGLE 0.1745f
+#define EXTRAP_MAX 25.0f
 #define dprintf TriMesh::dprintf
 
 
@@ -34,21 +38,18 @@ using namespace std;
 
 namespace trimesh {
 
-// Quick 'n dirty portable random number generator 
-static inline float tinyrnd()
-{
-	static unsigned trand = 0;
-	trand = 1664525u * trand + 1013904223u;
-	return (float) trand / 4294967296.0f;
-}
+// Stages of ICP.  Each draws its own random samples, keyed by the stage and
+// the iteration number within it.
+enum { ICP_STAGE_PT2PT, ICP_STAGE_INITIAL, ICP_STAGE_MAIN, ICP_STAGE_FINAL };
 
-
-// A pair of points, with an associated normal
+// A pair of points, with the normal at p1 (used for point-to-plane) and
+// the normal at p2 (used only by the symmetric objective)
 struct PtPair {
 	point p1, p2;
-	vec norm;
-	PtPair(const point &p1_, const point &p2_, const vec &norm_) :
-			p1(p1_), p2(p2_), norm(norm_)
+	vec norm, norm2;
+	PtPair(const point &p1_, const point &p2_,
+	       const vec &norm_, const vec &norm2_) :
+			p1(p1_), p2(p2_), norm(norm_), norm2(norm2_)
 		{}
 };
 
@@ -183,7 +184,7 @@ void compute_overlaps(TriMesh *s1, TriMesh *s2,
 		if (!match)
 			continue;
 		if (!pointcloud2 &&
-		    s2->is_bdy((match - (const float *) &s2->vertices[0][0]) / 3))
+		    s2->is_bdy(kd2->index_of(match)))
 			continue;
 #endif
 		o1[i] = 1;
@@ -202,7 +203,7 @@ void compute_overlaps(TriMesh *s1, TriMesh *s2,
 		if (!match)
 			continue;
 		if (!pointcloud1 &&
-		    s1->is_bdy((match - (const float *) &s1->vertices[0][0]) / 3))
+		    s1->is_bdy(kd1->index_of(match)))
 			continue;
 #endif
 		o2[i] = 1;
@@ -214,12 +215,28 @@ void compute_overlaps(TriMesh *s1, TriMesh *s2,
 }
 
 
-// Select a number of points and find correspondences 
-static void select_and_match(TriMesh *s1, TriMesh *s2,
-			     const xform &xf1, const xform &xf2,
-			     const KDtree *kd2, const vector<float> &sampcdf1,
-			     float incr, float maxdist, int /* verbose */,
-			     vector<PtPair> &pairs, bool flip)
+// The match found for each point of s1 the last time it was sampled,
+// together with the transform in effect for the most recent matching.
+// Used to start KD-tree searches near the previous answer.
+struct MatchCache {
+	vector<int> prev;
+	xform xf12;
+	bool valid;
+	MatchCache() : valid(false) {}
+};
+
+
+// Select a number of points and find correspondences.  The random sampling
+// depends only on seed, and the matching is done in parallel.  If cache
+// is given, points that have moved by less than maxdist since the last
+// matching start their search from their previous match.  Returns the
+// number of points whose match did not change.
+static size_t select_and_match(TriMesh *s1, TriMesh *s2,
+			       const xform &xf1, const xform &xf2,
+			       const KDtree *kd2, const vector<float> &sampcdf1,
+			       float incr, float maxdist, int /* verbose */,
+			       vector<PtPair> &pairs, bool flip,
+			       unsigned long long seed, MatchCache *cache)
 {
 	xform xf1r = norm_xf(xf1);
 	xform xf2r = norm_xf(xf2);
@@ -227,113 +244,255 @@ static void select_and_match(TriMesh *s1, TriMesh *s2,
 	xform xf12r = norm_xf(xf12);
 	float maxdist2 = sqr(maxdist);
 
+	// Select
+	vector<int> samples;
 	size_t i = 0;
 	float cval = 0.0f;
 	while (1) {
-		cval += incr * tinyrnd();
+		cval += incr * rnd_float(seed, samples.size());
 		if (cval >= 1.0f)
 			break;
 		while (sampcdf1[i] <= cval)
 			i++;
 		cval = sampcdf1[i];
+		samples.push_back(i);
+	}
 
+	// Match
+	int nsamp = samples.size();
+	vector<int> matches(nsamp, -1);
+	bool pointcloud2 = (s2->faces.empty() && s2->tstrips.empty());
+	bool warm = cache && cache->valid;
+	if (cache && cache->prev.size() != s1->vertices.size())
+		cache->prev.assign(s1->vertices.size(), -1);
+	size_t nreused = 0;
+#pragma omp parallel for schedule(dynamic,64) reduction(+:nreused)
+	for (int k = 0; k < nsamp; k++) {
+		int i = samples[k];
 		point p = xf12 * s1->vertices[i];
 		vec n = xf12r * s1->normals[i];
 
-		// Do the matching
-		bool pointcloud2 = (s2->faces.empty() && s2->tstrips.empty());
-		NormCompat nc(n, s2, pointcloud2);
+		const float *hint = NULL;
+		int iprev = cache ? cache->prev[i] : -1;
+		if (warm && iprev >= 0 &&
+		    dist2(p, cache->xf12 * s1->vertices[i]) < maxdist2)
+			hint = s2->vertices[iprev];
 
-		const float *match = kd2->closest_to_pt(p, maxdist2, &nc);
-		if (!match)
+		NormCompat nc(n, s2, pointcloud2);
+		const float *match = kd2->closest_to_pt(p, hint, maxdist2, &nc);
+		if (!match) {
+			if (cache)
+				cache->prev[i] = -1;
 			continue;
-		int imatch = (match - (const float *) &(s2->vertices[0][0])) / 3;
+		}
+		int imatch = kd2->index_of(match);
+		if (cache)
+			cache->prev[i] = imatch;
+		if (imatch == iprev)
+			nreused++;
 		if (!pointcloud2 && s2->is_bdy(imatch))
 			continue;
+		matches[k] = imatch;
+	}
+	if (cache) {
+		cache->xf12 = xf12;
+		cache->valid = true;
+	}
 
-		// Project both points into world coords and save 
+	// Project both points into world coords and save
+	for (int k = 0; k < nsamp; k++) {
+		int i = samples[k], imatch = matches[k];
+		if (imatch < 0)
+			continue;
 		if (flip) {
 			pairs.push_back(PtPair(xf2  * s2->vertices[imatch],
 					       xf1  * s1->vertices[i],
-					       xf2r * s2->normals[imatch]));
+					       xf2r * s2->normals[imatch],
+					       xf1r * s1->normals[i]));
 		} else {
 			pairs.push_back(PtPair(xf1  * s1->vertices[i],
 					       xf2  * s2->vertices[imatch],
-					       xf1r * s1->normals[i]));
+					       xf1r * s1->normals[i],
+					       xf2r * s2->normals[imatch]));
+		}
+	}
+
+	return nreused;
+}
+
+
+// The normal used for the residual of a pair.  For the symmetric objective
+//  Rusinkiewicz, S.
+//  "A Symmetric Objective Function for ICP,"
+//  Proc. SIGGRAPH, 2019.
+// this is the (normalized) sum of the normals at both points.
+static inline vec pair_normal(const PtPair &pair, bool symmetric)
+{
+	if (!symmetric)
+		return pair.norm;
+	vec n = pair.norm;
+	if ((n DOT pair.norm2) < 0.0f)
+		n -= pair.norm2;
+	else
+		n += pair.norm2;
+	normalize(n);
+	return n;
+}
+
+
+// Compute IRLS weights for the given robust kernel, from the residuals of
+// the pairs after applying alignxf to p2.  The kernel width is scaled by
+// a robust (MAD) estimate of the standard deviation of the residuals.
+static void robust_weights(const vector<PtPair> &pairs, const xform &alignxf,
+			   int robust, bool symmetric, vector<double> &w)
+{
+	int n = pairs.size();
+	w.resize(n);
+	if (robust == ICP_ROBUST_NONE) {
+		fill(w.begin(), w.end(), 1.0);
+		return;
+	}
+
+	vector<float> r(n), absr(n);
+	for (int i = 0; i < n; i++) {
+		r[i] = (pairs[i].p1 - alignxf * pairs[i].p2) DOT
+		       pair_normal(pairs[i], symmetric);
+		absr[i] = fabs(r[i]);
+	}
+	nth_element(absr.begin(), absr.begin() + n/2, absr.end());
+	float sigma = 1.4826f * absr[n/2];
+	if (sigma <= 0.0f) {
+		fill(w.begin(), w.end(), 1.0);
+		return;
+	}
+
+	if (robust == ICP_ROBUST_HUBER) {
+		float k = 1.345f * sigma;
+		for (int i = 0; i < n; i++)
+			w[i] = (fabs(r[i]) <= k) ? 1.0 : k / fabs(r[i]);
+	} else if (robust == ICP_ROBUST_TUKEY) {
+		float c2inv = 1.0f / sqr(4.685f * sigma);
+		for (int i = 0; i < n; i++) {
+			float u2 = sqr(r[i]) * c2inv;
+			w[i] = (u2 < 1.0f) ? sqr(1.0 - u2) : 0.0;
 		}
+	} else { // ICP_ROBUST_CAUCHY
+		float c2inv = 1.0f / sqr(2.3849f * sigma);
+		for (int i = 0; i < n; i++)
+			w[i] = 1.0 / (1.0 + sqr(r[i]) * c2inv);
 	}
 }
 
 
-// Compute ICP alignment matrix, including eigenvector decomposition
+// Compute ICP alignment matrix, including eigenvector decomposition.
+// Each pair contributes a row x = (c, n) of the linearized system, with
+// weight w.  The rows are laid out as separate arrays of doubles so that
+// the accumulation of the normal equations vectorizes over pairs.
 static void compute_ICPmatrix(const vector<PtPair> &pairs,
-			      float evec[6][6], float eval[6], float b[6],
+			      const vector<double> &w, bool symmetric,
+			      double evec[6][6], double eval[6], double b[6],
 			      point &centroid, float &scale, float &err)
 {
-	size_t n = pairs.size();
+	int n = pairs.size();
 
 	centroid = point(0,0,0);
-	for (size_t i = 0; i < n; i++)
+	for (int i = 0; i < n; i++)
 		centroid += pairs[i].p2;
 	centroid /= float(n);
 
 	scale = 0.0f;
-	for (size_t i = 0; i < n; i++)
+	for (int i = 0; i < n; i++)
 		scale += dist2(pairs[i].p2, centroid);
 	scale /= float(n);
 	scale = 1.0f / sqrt(scale);
 
-	memset(&evec[0][0], 0, 6*6*sizeof(float));
-	memset(&b[0], 0, 6*sizeof(float));
+	vector<double> x[6], wx[6], wd(n);
+	for (int j = 0; j < 6; j++) {
+		x[j].resize(n);
+		wx[j].resize(n);
+	}
 
-	err = 0.0f;
-	for (size_t i = 0; i < n; i++) {
+	double sumerr = 0.0;
+	for (int i = 0; i < n; i++) {
 		const point &p1 = pairs[i].p1;
 		const point &p2 = pairs[i].p2;
-		const vec &n = pairs[i].norm;
+		vec nn = pair_normal(pairs[i], symmetric);
 
-		float d = (p1 - p2) DOT n;
+		float d = (p1 - p2) DOT nn;
 		d *= scale;
-		vec p2c = p2 - centroid;
-		p2c *= scale;
-		vec c = p2c CROSS n;
+		vec pc = p2 - centroid;
+		if (symmetric)
+			pc += p1 - centroid;
+		pc *= scale;
+		vec c = pc CROSS nn;
+
+		sumerr += sqr(d);
+		x[0][i] = c[0]; x[1][i] = c[1]; x[2][i] = c[2];
+		x[3][i] = nn[0]; x[4][i] = nn[1]; x[5][i] = nn[2];
+		for (int j = 0; j < 6; j++)
+			wx[j][i] = w[i] * x[j][i];
+		wd[i] = w[i] * d;
+	}
 
-		err += d * d;
-		float x[6] = { c[0], c[1], c[2], n[0], n[1], n[2] };
-		for (int j = 0; j < 6; j++) {
-			b[j] += d * x[j];
-			for (int k = 0; k < 6; k++)
-				evec[j][k] += x[j] * x[k];
+	for (int j = 0; j < 6; j++) {
+		const double *wxj = &wx[j][0], *wdp = &wd[0];
+		double bj = 0.0;
+#pragma omp simd reduction(+:bj)
+		for (int i = 0; i < n; i++)
+			bj += wdp[i] * wxj[i];
+		b[j] = bj;
+		for (int k = j; k < 6; k++) {
+			const double *xk = &x[k][0];
+			double ajk = 0.0;
+#pragma omp simd reduction(+:ajk)
+			for (int i = 0; i < n; i++)
+				ajk += wxj[i] * xk[i];
+			evec[j][k] = evec[k][j] = ajk;
 		}
 	}
 
-	err /= float(n);
-	err = sqrt(err) / scale;
-	eigdc<float,6>(evec, eval);
+	err = (float) sqrt(sumerr / n) / scale;
+	eigdc<double,6>(evec, eval);
 }
 
 
 // Compute ICP alignment, given matrix computed by compute_ICPmatrix
-static void compute_alignxf(float evec[6][6], float eval[6], float b[6],
-			    point &centroid, float scale, xform &alignxf)
+static void compute_alignxf(double evec[6][6], double eval[6], double b[6],
+			    point &centroid, float scale, bool symmetric,
+			    xform &alignxf)
 {
-	float einv[6];
+	double einv[6];
 	for (int i = 0; i < 6; i++) {
 		if (eval[i] < EIG_THRESH * eval[5])
-			einv[i] = 0.0f;
+			einv[i] = 0.0;
 		else
-			einv[i] = 1.0f / eval[i];
+			einv[i] = 1.0 / eval[i];
+	}
+	double x[6];
+	eigmult<double,6>(evec, einv, b, x);
+
+	if (symmetric) {
+		// Half of the rotation is applied before the translation,
+		// and half after
+		Vec<3,double> axis(x[0], x[1], x[2]);
+		double ang = atan(len(axis));
+		double cosang = cos(ang);
+		xform R = xform::rot(ang, axis);
+		alignxf = xform::trans(centroid) * R *
+			  xform::trans(cosang * x[3] / scale,
+				       cosang * x[4] / scale,
+				       cosang * x[5] / scale) *
+			  R * xform::trans(-centroid);
+		return;
 	}
-	float x[6];
-	eigmult<float,6>(evec, einv, b, x);
 
 	// Interpret results
-	float sx = min(max(x[0], -1.0f), 1.0f);
-	float sy = min(max(x[1], -1.0f), 1.0f);
-	float sz = min(max(x[2], -1.0f), 1.0f);
-	float cx = sqrt(1.0f - sx*sx);
-	float cy = sqrt(1.0f - sy*sy);
-	float cz = sqrt(1.0f - sz*sz);
+	double sx = min(max(x[0], -1.0), 1.0);
+	double sy = min(max(x[1], -1.0), 1.0);
+	double sz = min(max(x[2], -1.0), 1.0);
+	double cx = sqrt(1.0 - sx*sx);
+	double cy = sqrt(1.0 - sy*sy);
+	double cz = sqrt(1.0 - sz*sz);
 
 	alignxf[0]  = cy*cz;
 	alignxf[1]  = sx*sy*cz + cx*sz;
@@ -446,21 +605,31 @@ static float ICP_iter(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 		      const vector<float> &weights1, const vector<float> &weights2,
 		      float &maxdist, int verbose,
 		      vector<float> &sampcdf1, vector<float> &sampcdf2,
-		      float &incr, bool update_cdfs,
-		      bool do_scale, bool do_affine)
+		      float &incr, int desired_pairs, bool update_cdfs,
+		      bool do_scale, bool do_affine, int stage,
+		      MatchCache *caches,
+		      const ICP_params &params, ICP_iter_stats &st)
 {
 	// Compute pairs
 	timestamp t1 = now();
+	st.pt2pt = false;
+	st.maxdist = maxdist;
+	st.desired_pairs = desired_pairs;
 	if (verbose > 1)
 		dprintf("maxdist = %f\n", maxdist);
 	vector<PtPair> pairs;
-	select_and_match(s1, s2, xf1, xf2, kd2, sampcdf1, incr,
-			 maxdist, verbose, pairs, false);
-	select_and_match(s2, s1, xf2, xf1, kd1, sampcdf2, incr,
-			 maxdist, verbose, pairs, true);
+	unsigned long long seed = rnd_bits(params.seed, st.iter, stage);
+	st.nreused =
+		select_and_match(s1, s2, xf1, xf2, kd2, sampcdf1, incr,
+				 maxdist, verbose, pairs, false, seed,
+				 caches ? &caches[0] : NULL) +
+		select_and_match(s2, s1, xf2, xf1, kd1, sampcdf2, incr,
+				 maxdist, verbose, pairs, true, seed + 1,
+				 caches ? &caches[1] : NULL);
 
 	timestamp t2 = now();
 	size_t np = pairs.size();
+	st.t_match = (t2-t1) * 1000.0f;
 	if (verbose > 1) {
 		dprintf("Generated %lu pairs in %.2f msec.\n",
 			(unsigned long) np, (t2-t1) * 1000.0);
@@ -478,6 +647,9 @@ static float ICP_iter(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 	pairs.erase(pairs.begin() + next, pairs.end());
 
 	timestamp t3 = now();
+	st.npairs = pairs.size();
+	st.nrejected = np - pairs.size();
+	st.t_reject = (t3-t2) * 1000.0f;
 	if (verbose > 1) {
 		dprintf("Rejected %lu pairs in %.2f msec.\n",
 			(unsigned long) (np - pairs.size()), (t3-t2) * 1000.0);
@@ -489,21 +661,39 @@ static float ICP_iter(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 	}
 
 	// Update incr and maxdist based on what happened here
-	incr *= (float) pairs.size() / DESIRED_PAIRS;
+	incr *= (float) pairs.size() / desired_pairs;
 	maxdist = max(2.0f * sqrt(thresh), 0.7f * maxdist);
 
-	// Do the minimization
-	float evec[6][6], eval[6], b[6], scale, err;
+	// Do the minimization.  With a robust kernel, this is iteratively
+	// reweighted least squares: the weights come from the residuals left
+	// by the previous solution.
+	double evec[6][6], eval[6], b[6];
+	float scale, err = 0.0f;
 	point centroid;
 	xform alignxf;
-	compute_ICPmatrix(pairs, evec, eval, b, centroid, scale, err);
+	bool symmetric = params.symmetric;
+	vector<double> w;
+	robust_weights(pairs, alignxf, params.robust, symmetric, w);
+	int nsolves = (params.robust == ICP_ROBUST_NONE) ? 1 :
+		      max(params.irls_iters, 1);
+	for (int iter = 0; iter < nsolves; iter++) {
+		if (iter)
+			robust_weights(pairs, alignxf, params.robust,
+				       symmetric, w);
+		float iter_err;
+		compute_ICPmatrix(pairs, w, symmetric, evec, eval, b,
+				  centroid, scale, iter_err);
+		if (!iter)
+			err = iter_err;
+		compute_alignxf(evec, eval, b, centroid, scale, symmetric,
+				alignxf);
+	}
 	if (verbose > 1) {
 		dprintf("RMS point-to-plane error = %f\n", err);
 		for (int i = 0; i < 5; i++)
 			if (eval[i] < EIG_THRESH * eval[5])
 				dprintf("Small eigenvalue %f (largest is %f)\n", eval[i], eval[5]);
 	}
-	compute_alignxf(evec, eval, b, centroid, scale, alignxf);
 	xf2 = alignxf * xf2;
 
 	if (do_scale || do_affine) {
@@ -514,6 +704,7 @@ static float ICP_iter(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 	}
 
 	timestamp t4 = now();
+	st.t_solve = (t4-t3) * 1000.0f;
 	if (verbose > 1) {
 		dprintf("Computed xform in %.2f msec.\n",
 			(t4-t3) * 1000.0);
@@ -523,17 +714,17 @@ static float ICP_iter(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 	if (!update_cdfs)
 		return err;
 
-	float einv[6];
+	double einv[6];
 	for (int i = 0; i < 6; i++)
-		einv[i] = 1.0f / max(eval[i], EIG_THRESH * eval[5]);
+		einv[i] = 1.0 / max(eval[i], EIG_THRESH * eval[5]);
 	float Cinv[6][6];
 	for (int i = 0; i < 6; i++) {
-		float x[6];
+		double x[6];
 		for (int j = 0; j < 6; j++)
-			x[j] = (j == i) ? 1.0f : 0.0f;
-		eigmult<float,6>(evec, einv, x, x);
+			x[j] = (j == i) ? 1.0 : 0.0;
+		eigmult<double,6>(evec, einv, x, x);
 		for (int j = 0; j < 6; j++)
-			Cinv[i][j] = x[j];
+			Cinv[i][j] = (float) x[j];
 	}
 
 	xform xf1r = norm_xf(xf1);
@@ -605,6 +796,7 @@ static float ICP_iter(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 	sampcdf2[n2-1] = 1.0f;
 
 	timestamp t5 = now();
+	st.t_cdf = (t5-t4) * 1000.0f;
 	if (verbose > 1) {
 		dprintf("Updated CDFs in %.2f msec.\n",
 			(t5-t4) * 1000.0);
@@ -620,20 +812,29 @@ static float ICP_p2pt(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 		      const KDtree *kd1, const KDtree *kd2,
 		      float &maxdist, int verbose,
 		      vector<float> &sampcdf1, vector<float> &sampcdf2,
-		      float &incr, bool trans_only)
+		      float &incr, bool trans_only, MatchCache *caches,
+		      const ICP_params &params, ICP_iter_stats &st)
 {
 	// Compute pairs
 	timestamp t1 = now();
+	st.pt2pt = true;
+	st.maxdist = maxdist;
+	st.desired_pairs = DESIRED_PAIRS_EARLY;
 	if (verbose > 1)
 		dprintf("maxdist = %f\n", maxdist);
 	vector<PtPair> pairs;
-	select_and_match(s1, s2, xf1, xf2, kd2, sampcdf1, incr,
-			 maxdist, verbose, pairs, false);
-	select_and_match(s2, s1, xf2, xf1, kd1, sampcdf2, incr,
-			 maxdist, verbose, pairs, true);
+	unsigned long long seed = rnd_bits(params.seed, st.iter, ICP_STAGE_PT2PT);
+	st.nreused =
+		select_and_match(s1, s2, xf1, xf2, kd2, sampcdf1, incr,
+				 maxdist, verbose, pairs, false, seed,
+				 caches ? &caches[0] : NULL) +
+		select_and_match(s2, s1, xf2, xf1, kd1, sampcdf2, incr,
+				 maxdist, verbose, pairs, true, seed + 1,
+				 caches ? &caches[1] : NULL);
 
 	timestamp t2 = now();
 	size_t np = pairs.size();
+	st.t_match = (t2-t1) * 1000.0f;
 	if (verbose > 1) {
 		dprintf("Generated %lu pairs in %.2f msec.\n",
 			(unsigned long) np, (t2-t1) * 1000.0);
@@ -651,6 +852,9 @@ static float ICP_p2pt(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 	pairs.erase(pairs.begin() + next, pairs.end());
 
 	timestamp t3 = now();
+	st.npairs = pairs.size();
+	st.nrejected = np - pairs.size();
+	st.t_reject = (t3-t2) * 1000.0f;
 	if (verbose > 1) {
 		dprintf("Rejected %lu pairs in %.2f msec.\n",
 			(unsigned long) (np - pairs.size()), (t3-t2) * 1000.0);
@@ -710,6 +914,7 @@ static float ICP_p2pt(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 	xf2 = alignxf * xf2;
 
 	timestamp t4 = now();
+	st.t_solve = (t4-t3) * 1000.0f;
 	if (verbose > 1) {
 		dprintf("Computed xform in %.2f msec.\n",
 			(t4-t3) * 1000.0);
@@ -718,14 +923,107 @@ static float ICP_p2pt(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 }
 
 
+// Size of the incremental transform that took xf2 from oldxf to newxf:
+// rotation angle, and how far it moved the point c (in s2's coordinates)
+static void xform_step(const xform &oldxf, const xform &newxf, const point &c,
+		       float &step_trans, float &step_rot)
+{
+	xform d = newxf * inv(oldxf);
+	double cosang = d[0] + d[5] + d[10] - 1.0;
+	double sinang = len(Vec<3,double>(d[6] - d[9], d[8] - d[2], d[1] - d[4]));
+	step_rot = (float) atan2(sinang, cosang);
+	point wc = oldxf * c;
+	step_trans = dist(d * wc, wc);
+}
+
+
+// Convert a rigid transform to a 6-vector of rotation vector and
+// translation (divided by size), and back.  Used for extrapolation.
+static bool xf_to_state(const xform &xf, double size, Vec<6,double> &q)
+{
+	Vec<3,double> axis(xf[6] - xf[9], xf[8] - xf[2], xf[1] - xf[4]);
+	double l = len(axis);
+	double ang = atan2(l, xf[0] + xf[5] + xf[10] - 1.0);
+	if (ang > 0.9 * M_PI)
+		return false;
+	if (l > 0.0)
+		axis *= ang / l;
+	for (int i = 0; i < 3; i++) {
+		q[i] = axis[i];
+		q[i+3] = xf[12+i] / size;
+	}
+	return true;
+}
+
+static xform state_to_xf(const Vec<6,double> &q, double size)
+{
+	Vec<3,double> axis(q[0], q[1], q[2]);
+	return xform::trans(q[3] * size, q[4] * size, q[5] * size) *
+	       xform::rot(len(axis), axis);
+}
+
+
+// Besl-McKay extrapolation.  Given the states before the last three
+// iterations (with the errors measured there), plus the current state,
+// decide how far to jump along the direction of the last step.
+// Returns false if the steps are not consistent enough to extrapolate.
+static bool extrapolate_state(const Vec<6,double> q[4], const float e[3],
+			      Vec<6,double> &qnew)
+{
+	Vec<6,double> d1 = q[1] - q[0], d2 = q[2] - q[1], d3 = q[3] - q[2];
+	double l1 = len(d1), l2 = len(d2), l3 = len(d3);
+	if (l1 == 0.0 || l2 == 0.0 || l3 == 0.0)
+		return false;
+	if (((d1 DOT d2) / (l1 * l2)) < cos(EXTRAP_ANGLE) ||
+	    ((d2 DOT d3) / (l2 * l3)) < cos(EXTRAP_ANGLE))
+		return false;
+
+	// Arc length along the path, with 0 at q[2]
+	double v0 = -(l1 + l2), v1 = -l2;
+
+	// Zero crossing of the line through the first and last errors
+	double slope = (e[2] - e[0]) / (0.0 - v0);
+	double vlin = (slope < 0.0) ? -e[2] / slope : 0.0;
+
+	// Vertex of the parabola through all three
+	double c1 = (e[1] - e[0]) / (v1 - v0);
+	double c2 = ((e[2] - e[1]) / (0.0 - v1) - c1) / (0.0 - v0);
+	double b = c1 - c2 * (v0 + v1);
+	double vpar = (c2 > 0.0) ? -b / (2.0 * c2) : 0.0;
+
+	double v = (vpar > 0.0 && vpar < vlin) ? vpar : vlin;
+	v = min(v, EXTRAP_MAX * l3) - l3;
+	if (v <= 0.0)
+		return false;
+	qnew = q[3] + (v / l3) * d3;
+	return true;
+}
+
+
+// Save and/or report the record of one iteration
+static void report_iter(const ICP_params &params,
+			vector<ICP_iter_stats> *stats,
+			const ICP_iter_stats &st)
+{
+	if (stats)
+		stats->push_back(st);
+	if (params.callback)
+		params.callback(st, params.callback_data);
+}
+
+
 // Do ICP.  Aligns mesh s2 to s1, updating xf2 with the new transform.
 // Returns alignment error, or -1 on failure
 float ICP(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 	  const KDtree *kd1, const KDtree *kd2,
 	  vector<float> &weights1, vector<float> &weights2,
-	  float maxdist /* = 0.0f */, int verbose /* = 0 */,
-	  bool do_scale /* = false */, bool do_affine /* = false */)
+	  const ICP_params &params,
+	  vector<ICP_iter_stats> *stats /* = NULL */)
 {
+	float maxdist = params.maxdist;
+	int verbose = params.verbose;
+	bool do_scale = params.do_scale, do_affine = params.do_affine;
+
 	// Make sure we have everything precomputed
 	s1->need_normals();  s2->need_normals();
 	if (!s1->faces.empty() || !s1->tstrips.empty()) {
@@ -740,11 +1038,13 @@ float ICP(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 
 	timestamp t = now();
 
-	if (maxdist <= 0.0f) {
-		s1->need_bbox();
-		s2->need_bbox();
+	s1->need_bbox();
+	s2->need_bbox();
+	if (maxdist <= 0.0f)
 		maxdist = 0.5f * min(len(s1->bbox.size()), len(s2->bbox.size()));
-	}
+	point center2 = s2->bbox.center();
+	float size2 = max(0.5f * len(s2->bbox.size()), 1.0e-20f);
+
 	// Compute initial CDFs
 	vector<float> sampcdf1(nv1), sampcdf2(nv2);
 	for (size_t i = 0; i < nv1-1; i++)
@@ -754,26 +1054,43 @@ float ICP(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 		sampcdf2[i] = (float) (i+1) / nv2;
 	sampcdf2[nv2-1] = 1.0f;
 
+	// Matches of s1 in s2 and vice versa, for warm-starting searches
+	MatchCache match_caches[2];
+	MatchCache *caches = params.warm_start ? match_caches : NULL;
+
 	// Do a few p2pt iterations
 	float incr = 4.0f / DESIRED_PAIRS_EARLY;
-	for (int i = 0; i < 2; i++) {
-		if (ICP_p2pt(s1, s2, xf1, xf2, kd1, kd2, maxdist, verbose,
-			     sampcdf1, sampcdf2, incr, true) < 0.0f)
-			return -1.0f;
-	}
-	for (int i = 0; i < 5; i++) {
-		if (ICP_p2pt(s1, s2, xf1, xf2, kd1, kd2, maxdist, verbose,
-			     sampcdf1, sampcdf2, incr, false) < 0.0f)
+	for (int i = 0; i < 7; i++) {
+		ICP_iter_stats st;
+		st.iter = i - 7;
+		xform oldxf2 = xf2;
+		float err = ICP_p2pt(s1, s2, xf1, xf2, kd1, kd2, maxdist,
+				     verbose, sampcdf1, sampcdf2, incr,
+				     i < 2, caches, params, st);
+		st.err = err;
+		xform_step(oldxf2, xf2, center2, st.step_trans, st.step_rot);
+		report_iter(params, stats, st);
+		if (err < 0.0f)
 			return -1.0f;
 	}
 
 	// Do a point-to-plane iteration and update CDFs
-	if (weights1.size() != nv1 || weights2.size() != nv2)
+	ICP_iter_stats st;
+	st.iter = 0;
+	if (weights1.size() != nv1 || weights2.size() != nv2) {
+		timestamp to = now();
 		compute_overlaps(s1, s2, xf1, xf2, kd1, kd2,
 				 weights1, weights2, maxdist, verbose);
+		st.t_overlap = (now() - to) * 1000.0f;
+	}
+	xform oldxf2 = xf2;
 	float err = ICP_iter(s1, s2, xf1, xf2, kd1, kd2, weights1, weights2,
 			     maxdist, verbose, sampcdf1, sampcdf2,
-			     incr, true, false, false);
+			     incr, DESIRED_PAIRS, true, false, false,
+			     ICP_STAGE_INITIAL, caches, params, st);
+	st.err = err;
+	xform_step(oldxf2, xf2, center2, st.step_trans, st.step_rot);
+	report_iter(params, stats, st);
 	if (verbose > 1) {
 		timestamp tnow = now();
 		dprintf("Time for initial iterations: %.2f msec.\n\n",
@@ -784,28 +1101,97 @@ float ICP(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 		return err;
 
 	bool rigid_only = true;
-	int iters = 0;
+	int iters = 0, last_iter = 0;
 	vector<int> err_delta_history(TERM_HIST);
+	int small_steps = 0;
+	int desired_pairs = DESIRED_PAIRS;
+
+	// Recent states and errors, for extrapolation
+	Vec<6,double> q_hist[4];
+	float e_hist[3];
+	int nhist = 0;
+
 	do {
 		float lasterr = err;
 		if (verbose > 1)
 			dprintf("Using incr = %f\n", incr);
+		ICP_iter_stats st;
+		st.iter = last_iter = iters + 1;
 		bool recompute = (iters % 10 == 9);
-		if (recompute)
+		if (recompute) {
+			timestamp to = now();
 			compute_overlaps(s1, s2, xf1, xf2, kd1, kd2,
 					 weights1, weights2, maxdist, verbose);
+			st.t_overlap = (now() - to) * 1000.0f;
+		}
+		bool rigid = rigid_only || (!do_scale && !do_affine);
+		Vec<6,double> q;
+		bool have_q = params.extrapolate && rigid &&
+			      xf_to_state(xf2, size2, q);
+		xform oldxf2 = xf2;
 		err = ICP_iter(s1, s2, xf1, xf2, kd1, kd2, weights1, weights2,
 			       maxdist, verbose, sampcdf1, sampcdf2, incr,
-			       recompute, do_scale && !rigid_only,
-			       do_affine && !rigid_only);
+			       desired_pairs, recompute,
+			       do_scale && !rigid_only,
+			       do_affine && !rigid_only, ICP_STAGE_MAIN,
+			       caches, params, st);
+		st.err = err;
+		xform_step(oldxf2, xf2, center2, st.step_trans, st.step_rot);
 		if (verbose > 1) {
 			timestamp tnow = now();
 			dprintf("Time for this iteration: %.2f msec.\n\n",
 			       (tnow-t) * 1000.0);
 			t = tnow;
 		}
-		if (err < 0.0f)
+		if (err < 0.0f) {
+			report_iter(params, stats, st);
 			return err;
+		}
+
+		// Extrapolate along a consistent direction of motion
+		if (have_q) {
+			if (nhist == 3) {
+				for (int i = 0; i < 2; i++) {
+					q_hist[i] = q_hist[i+1];
+					e_hist[i] = e_hist[i+1];
+				}
+				nhist = 2;
+			}
+			q_hist[nhist] = q;
+			e_hist[nhist] = err;
+			nhist++;
+			Vec<6,double> qnew;
+			if (nhist == 3 &&
+			    xf_to_state(xf2, size2, q_hist[3]) &&
+			    extrapolate_state(q_hist, e_hist, qnew)) {
+				xf2 = state_to_xf(qnew, size2);
+				st.extrapolated = true;
+				nhist = 0;
+				if (verbose > 1)
+					dprintf("Extrapolated transform\n");
+			}
+		} else {
+			nhist = 0;
+		}
+		report_iter(params, stats, st);
+
+		// Fewer pairs suffice while we are still taking large steps
+		// compared to the residual; ramp back up as we converge.
+		if (params.adaptive_pairs) {
+			float ratio = st.step_trans / max(err, 1.0e-20f);
+			ratio = clamp(ratio, 1.0f, 4.0f);
+			desired_pairs = int(DESIRED_PAIRS / ratio);
+		}
+
+		// Stop if the transform has essentially stopped changing
+		float step = st.step_rot + st.step_trans / size2;
+		float motion = st.step_rot * size2 + st.step_trans;
+		if ((step < params.term_step ||
+		     motion < params.term_step_err * err) && !st.extrapolated)
+			small_steps++;
+		else
+			small_steps = 0;
+		bool converged = (small_steps >= TERM_STEP_HIST);
 
 		// Check whether the error's been going up or down lately.
 		// Specifically, we break out if error has gone up in
@@ -816,14 +1202,18 @@ float ICP(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 		int nincreases = 0;
 		for (int i = 0; i < TERM_HIST; i++)
 			nincreases += err_delta_history[i];
-		if (nincreases >= TERM_THRESH) {
+		if (params.term_err_hist && nincreases >= TERM_THRESH)
+			converged = true;
+		if (converged) {
 			if (!rigid_only || (!do_scale && !do_affine))
 				break;
 			err_delta_history.clear();
 			err_delta_history.resize(TERM_HIST);
+			small_steps = 0;
+			nhist = 0;
 			rigid_only = false;
 		}
-	} while (++iters < MAX_ITERS);
+	} while (++iters < params.max_iters);
 
 	if (verbose > 1)
 		dprintf("Did %d iterations\n\n", iters);
@@ -831,12 +1221,19 @@ float ICP(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 	// One final iteration at a higher sampling rate...
 	if (verbose > 1)
 		dprintf("Last iteration...\n");
-	incr *= (float) DESIRED_PAIRS / DESIRED_PAIRS_FINAL;
+	incr *= (float) desired_pairs / DESIRED_PAIRS_FINAL;
 	if (verbose > 1)
 		dprintf("Using incr = %f\n", incr);
+	st = ICP_iter_stats();
+	st.iter = last_iter + 1;
+	oldxf2 = xf2;
 	err = ICP_iter(s1, s2, xf1, xf2, kd1, kd2, weights1, weights2,
 		       maxdist, verbose, sampcdf1, sampcdf2, incr,
-		       false, do_scale, do_affine);
+		       DESIRED_PAIRS_FINAL, false, do_scale, do_affine,
+		       ICP_STAGE_FINAL, caches, params, st);
+	st.err = err;
+	xform_step(oldxf2, xf2, center2, st.step_trans, st.step_rot);
+	report_iter(params, stats, st);
 	if (verbose > 1) {
 		timestamp tnow = now();
 		dprintf("Time for this iteration: %.2f msec.\n\n",
@@ -847,6 +1244,25 @@ float ICP(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 }
 
 
+// Do ICP with the parameters given as arguments
+float ICP(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
+	  const KDtree *kd1, const KDtree *kd2,
+	  vector<float> &weights1, vector<float> &weights2,
+	  float maxdist /* = 0.0f */, int verbose /* = 0 */,
+	  bool do_scale /* = false */, bool do_affine /* = false */)
+{
+	ICP_params params;
+	params.maxdist = maxdist;
+	params.verbose = verbose;
+	params.do_scale = do_scale;
+	params.do_affine = do_affine;
+	params.extrapolate = false;
+	params.adaptive_pairs = false;
+	params.term_step = params.term_step_err = 0.0f;
+	return ICP(s1, s2, xf1, xf2, kd1, kd2, weights1, weights2, params);
+}
+
+
 // Easier-to-use interface to ICP
 float ICP(TriMesh *s1, TriMesh *s2, const xform &xf1, xform &xf2,
 	  int verbose /* = 0 */,
@@ -4,7 +4,7 @@ Princeton University
 
 KDtree.cc
 A K-D tree for points, with limited capabilities (find nearest point to
-a given point, or to a ray).
+a given point, or to a ray, or all points within some radius).
 */
 
 #include <cstring>
@@ -58,6 +58,7 @@ public:
 		const KDtree::CompatFunc *iscompat;
 		size_t k;
 		vector<pt_with_d> knn;
+		vector<const float *> *inrad;
 	};
 
 	enum { MAX_PTS_PER_NODE = 8 };
@@ -66,6 +67,7 @@ public:
 	// The node itself
 
 	int npts; // If this is 0, intermediate node.  If nonzero, leaf.
+	Node *parent;
 
 	union {
 		struct {
@@ -73,18 +75,22 @@ public:
 			float r;
 			int splitaxis;
 			Node *child1, *child2;
+			float bbmin[3], bbmax[3];
 		} node;
 		struct {
 			const float *p[MAX_PTS_PER_NODE];
 		} leaf;
 	};
 
-	Node(const float **pts, size_t n);
+	Node(const float **pts, size_t n, Node *parent_);
 	~Node();
 
 	void find_closest_to_pt(Traversal_Info &ti) const;
 	void find_k_closest_to_pt(Traversal_Info &ti) const;
 	void find_closest_to_ray(Traversal_Info &ti) const;
+	void find_in_radius(Traversal_Info &ti) const;
+	bool contains_ball(const Traversal_Info &ti) const;
+	void set_leaf_of(const float *ptlist, const Node **leaf_of) const;
 
 	void *operator new(size_t n) { return memPool.alloc(n); }
 	void operator delete(void *p, size_t n) { memPool.free(p,n); }
@@ -96,7 +102,8 @@ PoolAlloc KDtree::Node::memPool(sizeof(KDtree::Node));
 
 
 // Create a KD tree from the points pointed to by the array pts
-KDtree::Node::Node(const float **pts, size_t n)
+KDtree::Node::Node(const float **pts, size_t n, Node *parent_) :
+	parent(parent_)
 {
 	// Leaf nodes
 	if (n <= MAX_PTS_PER_NODE) {
@@ -130,6 +137,8 @@ KDtree::Node::Node(const float **pts, size_t n)
 	float dy = ymax-ymin;
 	float dz = zmax-zmin;
 	node.r = 0.5f * sqrt(sqr(dx) + sqr(dy) + sqr(dz));
+	node.bbmin[0] = xmin; node.bbmin[1] = ymin; node.bbmin[2] = zmin;
+	node.bbmax[0] = xmax; node.bbmax[1] = ymax; node.bbmax[2] = zmax;
 
 	// Find longest axis
 	node.splitaxis = 2;
@@ -156,8 +165,8 @@ KDtree::Node::Node(const float **pts, size_t n)
 	}
 
 	// Build subtrees
-	node.child1 = new Node(pts, left-pts);
-	node.child2 = new Node(left, n-(left-pts));
+	node.child1 = new Node(pts, left-pts, this);
+	node.child2 = new Node(left, n-(left-pts), this);
 }
 
 
@@ -285,6 +294,71 @@ void KDtree::Node::find_closest_to_ray(KDtree::Node::Traversal_Info &ti) const
 }
 
 
+// Crawl the KD tree, collecting all points within ti.closest_d of ti.p
+void KDtree::Node::find_in_radius(KDtree::Node::Traversal_Info &ti) const
+{
+	// Leaf nodes
+	if (npts) {
+		for (int i = 0; i < npts; i++) {
+			if (dist2(leaf.p[i], ti.p) <= ti.closest_d2 &&
+			    (!ti.iscompat || (*ti.iscompat)(leaf.p[i])))
+				ti.inrad->push_back(leaf.p[i]);
+		}
+		return;
+	}
+
+
+	// Check whether to abort
+	if (dist2(node.center, ti.p) > sqr(node.r + ti.closest_d))
+		return;
+
+	// Recursive case
+	node.child1->find_in_radius(ti);
+	node.child2->find_in_radius(ti);
+}
+
+
+// Does the ball of radius ti.closest_d around ti.p lie within the bounding
+// box of the points in this node?  If so, no point outside the node can be
+// closer than ti.closest_d.
+bool KDtree::Node::contains_ball(const KDtree::Node::Traversal_Info &ti) const
+{
+	float bbmin[3], bbmax[3];
+	if (npts) {
+		for (int j = 0; j < 3; j++)
+			bbmin[j] = bbmax[j] = leaf.p[0][j];
+		for (int i = 1; i < npts; i++) {
+			for (int j = 0; j < 3; j++) {
+				bbmin[j] = min(bbmin[j], leaf.p[i][j]);
+				bbmax[j] = max(bbmax[j], leaf.p[i][j]);
+			}
+		}
+	} else {
+		memcpy(bbmin, node.bbmin, sizeof(bbmin));
+		memcpy(bbmax, node.bbmax, sizeof(bbmax));
+	}
+	for (int j = 0; j < 3; j++) {
+		if (ti.p[j] - ti.closest_d < bbmin[j] ||
+		    ti.p[j] + ti.closest_d > bbmax[j])
+			return false;
+	}
+	return true;
+}
+
+
+// Record, for each point, the leaf that holds it
+void KDtree::Node::set_leaf_of(const float *ptlist, const Node **leaf_of) const
+{
+	if (npts) {
+		for (int i = 0; i < npts; i++)
+			leaf_of[(leaf.p[i] - ptlist) / 3] = this;
+		return;
+	}
+	node.child1->set_leaf_of(ptlist, leaf_of);
+	node.child2->set_leaf_of(ptlist, leaf_of);
+}
+
+
 // Create a KDtree from a list of points (i.e., ptlist is a list of 3*n floats)
 void KDtree::build(const float *ptlist, size_t n)
 {
@@ -292,7 +366,11 @@ void KDtree::build(const float *ptlist, size_t n)
 	for (size_t i = 0; i < n; i++)
 		pts[i] = ptlist + i * 3;
 
-	root = new Node(&(pts[0]), n);
+	root = new Node(&(pts[0]), n, NULL);
+
+	base = ptlist;
+	leaf_of.resize(n);
+	root->set_leaf_of(ptlist, (const Node **) &leaf_of[0]);
 }
 
 
@@ -323,6 +401,52 @@ const float *KDtree::closest_to_pt(const float *p, float maxdist2 /* = 0.0f */,
 }
 
 
+// Return the closest point in the KD tree to p, starting the search at the
+// leaf holding hint (a point in the tree, usually the previous answer for a
+// nearby query) and working upwards.  The search stops at the first
+// ancestor whose bounding box contains the ball around p reaching to the
+// closest point found so far, so when p has moved only a little since the
+// last query, this touches just a few nodes near the hint.  Returns the
+// same point as closest_to_pt.
+const float *KDtree::closest_to_pt(const float *p, const float *hint,
+				   float maxdist2,
+				   const CompatFunc *iscompat /* = NULL */) const
+{
+	if (!hint)
+		return closest_to_pt(p, maxdist2, iscompat);
+
+	Node::Traversal_Info ti;
+
+	ti.p = p;
+	ti.iscompat = iscompat;
+	ti.closest = NULL;
+	if (maxdist2 <= 0.0f)
+		maxdist2 = sqr(root->node.r);
+	ti.closest_d2 = maxdist2;
+	ti.closest_d = sqrt(ti.closest_d2);
+
+	const Node *node = (const Node *) leaf_of[(hint - base) / 3];
+	node->find_closest_to_pt(ti);
+	while (node->parent && !node->contains_ball(ti)) {
+		// Search the other side of the parent's splitting plane,
+		// unless it is farther than the closest point so far
+		const Node *parent = node->parent;
+		float myd = parent->node.center[parent->node.splitaxis] -
+			    ti.p[parent->node.splitaxis];
+		if (parent->node.child1 == node) {
+			if (myd < ti.closest_d)
+				parent->node.child2->find_closest_to_pt(ti);
+		} else {
+			if (-myd < ti.closest_d)
+				parent->node.child1->find_closest_to_pt(ti);
+		}
+		node = parent;
+	}
+
+	return ti.closest;
+}
+
+
 // Return the closest point in the KD tree to the line
 // going through p in the direction dir
 const float *KDtree::closest_to_ray(const float *p, const float *dir,
@@ -383,4 +507,24 @@ void KDtree::find_k_closest_to_pt(std::vector<const float *> &knn,
 		knn[i] = ti.knn[i].second;
 }
 
+
+// Find all points within sqrt(maxdist2) of p
+void KDtree::find_in_radius(std::vector<const float *> &pts,
+			    const float *p,
+			    float maxdist2,
+			    const CompatFunc *iscompat /* = NULL */) const
+{
+	Node::Traversal_Info ti;
+
+	ti.p = p;
+	ti.iscompat = iscompat;
+	ti.closest = NULL;
+	ti.closest_d2 = maxdist2;
+	ti.closest_d = sqrt(ti.closest_d2);
+	ti.inrad = &pts;
+
+	pts.clear();
+	root->find_in_radius(ti);
+}
+
 }; // namespace trimesh
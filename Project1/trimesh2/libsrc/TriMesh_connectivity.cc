@@ -8,49 +8,60 @@ Manipulate data structures that describe connectivity between faces and verts.
 
 
 #include "TriMesh.h"
+#include "TriMesh_algo.h"
 #include <algorithm>
+#ifdef _OPENMP
+# include <omp.h>
+#endif
 using namespace std;
 
 
 namespace trimesh {
 
-// Find the direct neighbors of each vertex
-void TriMesh::need_neighbors()
+// Number of blocks for the parallel prefix sum
+#define SCAN_BLOCKS 64
+
+
+// Number of threads available to parallel loops
+static inline int nthreads()
 {
-	if (!neighbors.empty())
-		return;
+#ifdef _OPENMP
+	return omp_get_max_threads();
+#else
+	return 1;
+#endif
+}
 
-	need_faces();
-	if (faces.empty())
-		return;
 
-	dprintf("Finding vertex neighbors... ");
-	int nv = vertices.size(), nf = faces.size();
+// Exclusive prefix sum of count[0..n-1] into off[0..n], in parallel
+void prefix_sum(const vector<index_t> &count, vector<index_t> &off)
+{
+	index_t n = count.size();
+	off.resize(n + 1);
+	index_t blocksize = (n + SCAN_BLOCKS - 1) / SCAN_BLOCKS;
+	vector<index_t> blocksum(SCAN_BLOCKS + 1);
 
-	vector<int> numneighbors(nv);
-	for (int i = 0; i < nf; i++) {
-		numneighbors[faces[i][0]]++;
-		numneighbors[faces[i][1]]++;
-		numneighbors[faces[i][2]]++;
+#pragma omp parallel for
+	for (int b = 0; b < SCAN_BLOCKS; b++) {
+		index_t start = b * blocksize, end = min(start + blocksize, n);
+		index_t sum = 0;
+		for (index_t i = start; i < end; i++)
+			sum += count[i];
+		blocksum[b+1] = sum;
 	}
+	for (int b = 0; b < SCAN_BLOCKS; b++)
+		blocksum[b+1] += blocksum[b];
 
-	neighbors.resize(nv);
-	for (int i = 0; i < nv; i++)
-		neighbors[i].reserve(numneighbors[i]+2); // Slop for boundaries
-
-	for (int i = 0; i < nf; i++) {
-		for (int j = 0; j < 3; j++) {
-			vector<int> &me = neighbors[faces[i][j]];
-			int n1 = faces[i][(j+1)%3];
-			int n2 = faces[i][(j+2)%3];
-			if (find(me.begin(), me.end(), n1) == me.end())
-				me.push_back(n1);
-			if (find(me.begin(), me.end(), n2) == me.end())
-				me.push_back(n2);
+#pragma omp parallel for
+	for (int b = 0; b < SCAN_BLOCKS; b++) {
+		index_t start = b * blocksize, end = min(start + blocksize, n);
+		index_t sum = blocksum[b];
+		for (index_t i = start; i < end; i++) {
+			off[i] = sum;
+			sum += count[i];
 		}
 	}
-
-	dprintf("Done.\n");
+	off[n] = blocksum[SCAN_BLOCKS];
 }
 
 
@@ -65,23 +76,143 @@ void TriMesh::need_adjacentfaces()
 		return;
 
 	dprintf("Finding vertex to triangle maps... ");
-	int nv = vertices.size(), nf = faces.size();
+	index_t nv = vertices.size(), nf = faces.size();
+	const index_t *fv = &faces[0][0];
 
-	vector<int> numadjacentfaces(nv);
-	for (int i = 0; i < nf; i++) {
-		numadjacentfaces[faces[i][0]]++;
-		numadjacentfaces[faces[i][1]]++;
-		numadjacentfaces[faces[i][2]]++;
+	// Count faces at each vertex
+	vector<index_t> count(nv);
+	if (nthreads() == 1) {
+		for (index_t i = 0; i < 3 * nf; i++)
+			count[fv[i]]++;
+	} else {
+#pragma omp parallel for
+		for (index_t i = 0; i < 3 * nf; i++) {
+#pragma omp atomic
+			count[fv[i]]++;
+		}
 	}
+	prefix_sum(count, adjacentfaces.off);
+
+	// Scatter faces into place.  In parallel, faces arrive in no
+	// particular order, so each list is sorted afterwards.
+	adjacentfaces.ind.resize(3 * nf);
+	index_t *ind = &adjacentfaces.ind[0];
+	vector<index_t> pos(adjacentfaces.off.begin(), adjacentfaces.off.end() - 1);
+	if (nthreads() == 1) {
+		for (index_t i = 0; i < 3 * nf; i++)
+			ind[pos[fv[i]]++] = i / 3;
+	} else {
+#pragma omp parallel for
+		for (index_t i = 0; i < 3 * nf; i++) {
+			index_t where;
+#pragma omp atomic capture
+			where = pos[fv[i]]++;
+			ind[where] = i / 3;
+		}
+		const index_t *off = &adjacentfaces.off[0];
+#pragma omp parallel for schedule(dynamic,1024)
+		for (index_t i = 0; i < nv; i++)
+			sort(ind + off[i], ind + off[i+1]);
+	}
+
+	dprintf("Done.\n");
+}
 
-	adjacentfaces.resize(vertices.size());
-	for (int i = 0; i < nv; i++)
-		adjacentfaces[i].reserve(numadjacentfaces[i]);
 
-	for (int i = 0; i < nf; i++) {
-		for (int j = 0; j < 3; j++)
-			adjacentfaces[faces[i][j]].push_back(i);
+// Renumber the lists and their entries, in parallel
+void TriMesh::Adjacency::remap(const vector<index_t> &rows,
+	const vector<index_t> &elems)
+{
+	index_t n = rows.size();
+	bool map_elems = !elems.empty();
+	vector<index_t> count(n);
+#pragma omp parallel for
+	for (index_t i = 0; i < n; i++) {
+		if (rows[i] < 0)
+			continue;
+		Row a = (*this)[rows[i]];
+		if (!map_elems) {
+			count[i] = a.size();
+			continue;
+		}
+		for (size_t j = 0; j < a.size(); j++)
+			if (elems[a[j]] >= 0)
+				count[i]++;
+	}
+
+	Adjacency result;
+	prefix_sum(count, result.off);
+	result.ind.resize(result.off[n]);
+#pragma omp parallel for
+	for (index_t i = 0; i < n; i++) {
+		if (!count[i])
+			continue;
+		Row a = (*this)[rows[i]];
+		index_t *out = &result.ind[0] + result.off[i];
+		for (size_t j = 0; j < a.size(); j++) {
+			if (!map_elems)
+				*out++ = a[j];
+			else if (elems[a[j]] >= 0)
+				*out++ = elems[a[j]];
+		}
+	}
+	off.swap(result.off);
+	ind.swap(result.ind);
+}
+
+
+// Find the direct neighbors of each vertex.  These are gathered from the
+// adjacent faces of each vertex, in the order that a walk over the faces
+// would find them.
+void TriMesh::need_neighbors()
+{
+	if (!neighbors.empty())
+		return;
+
+	need_faces();
+	if (faces.empty())
+		return;
+
+	need_adjacentfaces();
+	dprintf("Finding vertex neighbors... ");
+	index_t nv = vertices.size();
+
+	// Collect into space for two neighbors per adjacent face, then compact
+	const index_t *aoff = &adjacentfaces.off[0];
+	vector<index_t> tmp(2 * adjacentfaces.ind.size()), count(nv);
+#pragma omp parallel for schedule(dynamic,1024)
+	for (index_t i = 0; i < nv; i++) {
+		Adjacency::Row a = adjacentfaces[i];
+		index_t *me = &tmp[0] + 2 * aoff[i];
+		int n = 0, j = -1;
+		for (size_t k = 0; k < a.size(); k++) {
+			const Face &f = faces[a[k]];
+			// A degenerate face has this vertex at more than one
+			// corner, and is listed once per corner
+			if (k && a[k] == a[k-1]) {
+				do {
+					j++;
+				} while (f[j] != i);
+			} else {
+				j = f.indexof(i);
+			}
+			index_t n1 = f[(j+1)%3], n2 = f[(j+2)%3];
+			if (find(me, me + n, n1) == me + n)
+				me[n++] = n1;
+			if (find(me, me + n, n2) == me + n)
+				me[n++] = n2;
+		}
+		count[i] = n;
 	}
+	prefix_sum(count, neighbors.off);
+
+	neighbors.ind.resize(neighbors.off[nv]);
+	index_t *ind = &neighbors.ind[0];
+	const index_t *off = &neighbors.off[0];
+#pragma omp parallel for
+	for (index_t i = 0; i < nv; i++)
+		copy(&tmp[0] + 2 * aoff[i], &tmp[0] + 2 * aoff[i] + count[i],
+		     ind + off[i]);
 
 	dprintf("Done.\n");
 }
@@ -100,25 +231,23 @@ void TriMesh::need_across_edge()
 
 	dprintf("Finding across-edge maps... ");
 
-	int nf = faces.size();
+	index_t nf = faces.size();
 	across_edge.resize(nf, Face(-1,-1,-1));
 
 #pragma omp parallel for
-	for (int i = 0; i < nf; i++) {
+	for (index_t i = 0; i < nf; i++) {
 		for (int j = 0; j < 3; j++) {
 			if (across_edge[i][j] != -1)
 				continue;
-			int v1 = faces[i][(j+1)%3];
-			int v2 = faces[i][(j+2)%3];
-			const vector<int> &a1 = adjacentfaces[v1];
-			const vector<int> &a2 = adjacentfaces[v2];
+			index_t v1 = faces[i][(j+1)%3];
+			index_t v2 = faces[i][(j+2)%3];
+			Adjacency::Row a1 = adjacentfaces[v1];
+			Adjacency::Row a2 = adjacentfaces[v2];
 			for (size_t k1 = 0; k1 < a1.size(); k1++) {
-				int other = a1[k1];
+				index_t other = a1[k1];
 				if (other == i)
 					continue;
-				vector<int>::const_iterator it =
-					find(a2.begin(), a2.end(), other);
-				if (it == a2.end())
+				if (!binary_search(a2.begin(), a2.end(), other))
 					continue;
 				int ind = (faces[other].indexof(v1)+1)%3;
 				if (faces[other][(ind+1)%3] != v2)
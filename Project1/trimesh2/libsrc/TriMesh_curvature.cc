@@ -15,6 +15,7 @@ Uses algorithm from
 #include "TriMesh_algo.h"
 #include "lineqn.h"
 using namespace std;
+#define dprintf TriMesh::dprintf
 
 
 // i+1 and i-1 modulo 3
@@ -134,198 +135,462 @@ void diagonalize_curv(const vec &old_u, const vec &old_v,
 }
 
 
-// Compute principal curvatures and directions.
-void TriMesh::need_curvatures()
+// Set up an initial coordinate system at vertex i, using the edge leaving
+// it in its last adjacent face
+static inline void init_coord_sys(TriMesh *mesh, index_t i)
 {
-	if (curv1.size() == vertices.size())
+	const vector<point> &vertices = mesh->vertices;
+	const vector<vec> &normals = mesh->normals;
+	vec &pdir1 = mesh->pdir1[i], &pdir2 = mesh->pdir2[i];
+	TriMesh::Adjacency::Row a = mesh->adjacentfaces[i];
+	pdir1 = vec();
+	if (!a.empty()) {
+		const TriMesh::Face &f = mesh->faces[a[a.size()-1]];
+		int j = (f[2] == i) ? 2 : (f[1] == i) ? 1 : 0;
+		pdir1 = vertices[f[NEXT(j)]] - vertices[i];
+	}
+	pdir1 = pdir1 CROSS normals[i];
+	normalize(pdir1);
+	pdir2 = normals[i] CROSS pdir1;
+}
+
+
+// Edges of face i, and the N-T-B coordinate system of the face
+static inline void face_frame(const TriMesh *mesh, index_t i,
+			      vec e[3], vec &t, vec &b)
+{
+	const vector<point> &vertices = mesh->vertices;
+	const TriMesh::Face &f = mesh->faces[i];
+
+	// Edges
+	e[0] = vertices[f[2]] - vertices[f[1]];
+	e[1] = vertices[f[0]] - vertices[f[2]];
+	e[2] = vertices[f[1]] - vertices[f[0]];
+
+	// N-T-B coordinate system per face
+	t = e[0];
+	normalize(t);
+	vec n = e[0] CROSS e[1];
+	b = n CROSS t;
+	normalize(b);
+}
+
+
+// Set up the least-squares system for the curvature tensor of face i, in
+// the face's own coordinate system (t,b).  The system has the form
+//   [ a   c   0 ] [ ku  ]   [ m0 ]
+//   [ c  a+d  c ] [ kuv ] = [ m1 ]
+//   [ 0   c   d ] [ kv  ]   [ m2 ]
+static inline void face_curv_system(const TriMesh *mesh, index_t i,
+				    vec &t, vec &b,
+				    float &a, float &c, float &d, float m[3])
+{
+	const vector<vec> &normals = mesh->normals;
+	const TriMesh::Face &f = mesh->faces[i];
+	vec e[3];
+	face_frame(mesh, i, e, t, b);
+
+	// Estimate curvature based on variation of normals
+	// along edges
+	m[0] = m[1] = m[2] = 0;
+	a = c = d = 0;
+	for (int j = 0; j < 3; j++) {
+		float u = e[j] DOT t;
+		float v = e[j] DOT b;
+		a += u*u;
+		c += u*v;
+		d += v*v;
+		vec dn = normals[f[PREV(j)]] - normals[f[NEXT(j)]];
+		float dnu = dn DOT t;
+		float dnv = dn DOT b;
+		m[0] += dnu*u;
+		m[1] += dnu*v + dnv*u;
+		m[2] += dnv*v;
+	}
+}
+
+
+// Solve the above system by LDL^T decomposition.  This does the same
+// arithmetic as ldltdc/ldltsl on the full matrix, minus the terms that are
+// always zero, so the results are identical.  Written without branches so
+// that a loop over many systems can be vectorized.  Returns false if the
+// system is not positive definite.
+static inline bool solve_curv_system(float a, float c, float d,
+				     float m0, float m1, float m2,
+				     float &ku, float &kuv, float &kv)
+{
+	float r0 = 1.0f / a;
+	float s1 = (a + d) - (c * r0) * c;
+	float r1 = 1.0f / s1;
+	float s2 = d - (c * r1) * c;
+	float r2 = 1.0f / s2;
+
+	float x0 = m0 * r0;
+	float x1 = (m1 - c * x0) * r1;
+	float x2 = (m2 - c * x1) * r2;
+	x1 -= (c * x2) * r1;
+	x0 -= (c * x1) * r0;
+	ku = x0; kuv = x1; kv = x2;
+	return (a > 0.0f) & (s1 > 0.0f) & (s2 > 0.0f);
+}
+
+
+// Compute the curvature tensor of face i, in the face's own coordinate
+// system (t,b).  Returns false if this fails.
+static inline bool face_curv(const TriMesh *mesh, index_t i,
+			     vec &t, vec &b, vec &fcurv)
+{
+	float a, c, d, m[3];
+	face_curv_system(mesh, i, t, b, a, c, d, m);
+	return solve_curv_system(a, c, d, m[0], m[1], m[2],
+				 fcurv[0], fcurv[1], fcurv[2]);
+}
+
+
+// Set up the least-squares system for the derivative of curvature of face
+// i, in the coordinate system (t,b) from face_frame().  The system is
+//   [ a   c    0    0 ]
+//   [ c  2a+d  2c   0 ]
+//   [ 0   2c  a+2d  c ] x = m
+//   [ 0   0    c    d ]
+static inline void face_dcurv_system(const TriMesh *mesh, index_t i,
+				     const vec &t, const vec &b,
+				     float &a, float &c, float &d, float m[4])
+{
+	const TriMesh::Face &f = mesh->faces[i];
+	const vector<point> &vertices = mesh->vertices;
+	vec e[3] = { vertices[f[2]] - vertices[f[1]],
+		     vertices[f[0]] - vertices[f[2]],
+		     vertices[f[1]] - vertices[f[0]] };
+
+	// Project curvature tensor from each vertex into this
+	// face's coordinate system
+	vec fcurv[3];
+	for (int j = 0; j < 3; j++) {
+		index_t vj = f[j];
+		proj_curv(mesh->pdir1[vj], mesh->pdir2[vj],
+			  mesh->curv1[vj], 0, mesh->curv2[vj],
+			  t, b, fcurv[j][0], fcurv[j][1], fcurv[j][2]);
+	}
+
+	// Estimate dcurv based on variation of curvature along edges
+	m[0] = m[1] = m[2] = m[3] = 0;
+	a = c = d = 0;
+	for (int j = 0; j < 3; j++) {
+		// Variation of curvature along each edge
+		vec dfcurv = fcurv[PREV(j)] - fcurv[NEXT(j)];
+		float u = e[j] DOT t;
+		float v = e[j] DOT b;
+		a += u*u;
+		c += u*v;
+		d += v*v;
+		m[0] += u*dfcurv[0];
+		m[1] += v*dfcurv[0] + 2.0f*u*dfcurv[1];
+		m[2] += 2.0f*v*dfcurv[1] + u*dfcurv[2];
+		m[3] += v*dfcurv[2];
+	}
+}
+
+
+// Solve the above system, as for solve_curv_system()
+static inline bool solve_dcurv_system(float a, float c, float d,
+				      float m0, float m1, float m2, float m3,
+				      float &x0, float &x1, float &x2, float &x3)
+{
+	float p1 = 2.0f * a + d, p2 = a + 2.0f * d, c2 = 2.0f * c;
+	float r0 = 1.0f / a;
+	float s1 = p1 - (c * r0) * c;
+	float r1 = 1.0f / s1;
+	float s2 = p2 - (c2 * r1) * c2;
+	float r2 = 1.0f / s2;
+	float s3 = d - (c * r2) * c;
+	float r3 = 1.0f / s3;
+
+	x0 = m0 * r0;
+	x1 = (m1 - c * x0) * r1;
+	x2 = (m2 - c2 * x1) * r2;
+	x3 = (m3 - c * x2) * r3;
+	x2 -= (c * x3) * r2;
+	x1 -= (c2 * x2) * r1;
+	x0 -= (c * x1) * r0;
+	return (a > 0.0f) & (s1 > 0.0f) & (s2 > 0.0f) & (s3 > 0.0f);
+}
+
+
+// Faces per batch in need_curvatures() and need_dcurv().  The systems for
+// a batch are set up one face at a time, then solved together in a loop
+// over structure-of-arrays data that the compiler can vectorize.
+#define FACE_BATCH 16
+
+
+// Per-face curvatures, computed ahead of time for the whole mesh...
+struct StoredFaceCurv {
+	const vector<vec> &ft, &fb, &fcurv;
+	const vector<char> &fok;
+	StoredFaceCurv(const vector<vec> &ft_, const vector<vec> &fb_,
+		       const vector<vec> &fcurv_, const vector<char> &fok_) :
+		ft(ft_), fb(fb_), fcurv(fcurv_), fok(fok_)
+		{}
+	bool operator () (index_t f, vec &t, vec &b, vec &c) const
+	{
+		if (!fok[f])
+			return false;
+		t = ft[f]; b = fb[f]; c = fcurv[f];
+		return true;
+	}
+};
+
+// ... or on the fly, when updating just a few vertices
+struct FreshFaceCurv {
+	const TriMesh *mesh;
+	FreshFaceCurv(const TriMesh *mesh_) : mesh(mesh_)
+		{}
+	bool operator () (index_t f, vec &t, vec &b, vec &c) const
+		{ return face_curv(mesh, f, t, b, c); }
+};
+
+
+// Average the curvatures of the faces around vertex i, weighted by corner
+// area, then find principal curvatures and directions
+template <class FACECURV>
+static inline void vertex_curv(TriMesh *mesh, index_t i,
+			       const FACECURV &facecurv)
+{
+	const vector<TriMesh::Face> &faces = mesh->faces;
+	TriMesh::Adjacency::Row a = mesh->adjacentfaces[i];
+	float curv1 = 0, curv12 = 0, curv2 = 0;
+	int j = -1;
+	for (size_t k = 0; k < a.size(); k++) {
+		index_t f = a[k];
+		// A degenerate face has this vertex at more than one
+		// corner, and is listed once per corner
+		if (k && f == a[k-1]) {
+			do {
+				j++;
+			} while (faces[f][j] != i);
+		} else {
+			j = faces[f].indexof(i);
+		}
+		vec t, b, fcurv;
+		if (!facecurv(f, t, b, fcurv))
+			continue;
+		float c1, c12, c2;
+		proj_curv(t, b, fcurv[0], fcurv[1], fcurv[2],
+			  mesh->pdir1[i], mesh->pdir2[i], c1, c12, c2);
+		float wt = mesh->cornerareas[f][j] / mesh->pointareas[i];
+		curv1  += wt * c1;
+		curv12 += wt * c12;
+		curv2  += wt * c2;
+	}
+
+	diagonalize_curv(mesh->pdir1[i], mesh->pdir2[i],
+			 curv1, curv12, curv2,
+			 mesh->normals[i], mesh->pdir1[i], mesh->pdir2[i],
+			 mesh->curv1[i], mesh->curv2[i]);
+}
+
+
+// Compute dcurv, given the per-face coordinate systems
+static void compute_dcurv(TriMesh *mesh,
+			  const vector<vec> &ft, const vector<vec> &fb);
+
+
+// Compute principal curvatures and directions.  If with_dcurv is set, also
+// compute their derivatives, reusing the per-face coordinate systems.
+void TriMesh::need_curvatures(bool with_dcurv /* = false */)
+{
+	index_t nv = vertices.size();
+	if (index_t(curv1.size()) == nv && curv_version == version &&
+	    curv_normals_full == normals_full) {
+		if (with_dcurv)
+			need_dcurv();
 		return;
+	}
 	need_faces();
 	need_normals();
 	need_pointareas();
+	need_adjacentfaces();
+
+	// If only a few vertices have moved, update their 2-ring, unless
+	// need_normals() (or anything else) has replaced all the normals
+	if (index_t(curv1.size()) == nv && curv_normals_full == normals_full) {
+		vector<index_t> verts;
+		if (dirty_verts(curv_version, 2, verts)) {
+			update_curvatures(verts);
+			curv_version = version;
+			if (with_dcurv)
+				need_dcurv();
+			return;
+		}
+	}
+	curv_version = version;
+	curv_normals_full = normals_full;
 
 	dprintf("Computing curvatures... ");
 
 	// Resize the arrays we'll be using
-	int nv = vertices.size(), nf = faces.size();
+	index_t nf = faces.size();
 	curv1.clear(); curv1.resize(nv); curv2.clear(); curv2.resize(nv);
 	pdir1.clear(); pdir1.resize(nv); pdir2.clear(); pdir2.resize(nv);
-	vector<float> curv12(nv);
 
 	// Set up an initial coordinate system per vertex
-	for (int i = 0; i < nf; i++) {
-		pdir1[faces[i][0]] = vertices[faces[i][1]] -
-				     vertices[faces[i][0]];
-		pdir1[faces[i][1]] = vertices[faces[i][2]] -
-				     vertices[faces[i][1]];
-		pdir1[faces[i][2]] = vertices[faces[i][0]] -
-				     vertices[faces[i][2]];
-	}
 #pragma omp parallel for
-	for (int i = 0; i < nv; i++) {
-		pdir1[i] = pdir1[i] CROSS normals[i];
-		normalize(pdir1[i]);
-		pdir2[i] = normals[i] CROSS pdir1[i];
-	}
+	for (index_t i = 0; i < nv; i++)
+		init_coord_sys(this, i);
 
-	// Compute curvature per-face
+	// Compute curvature per-face, in the face's coordinate system
+	vector<vec> ft(nf), fb(nf), fcurv(nf);
+	vector<char> fok(nf);
 #pragma omp parallel for
-	for (int i = 0; i < nf; i++) {
-		// Edges
-		vec e[3] = { vertices[faces[i][2]] - vertices[faces[i][1]],
-			     vertices[faces[i][0]] - vertices[faces[i][2]],
-			     vertices[faces[i][1]] - vertices[faces[i][0]] };
-
-		// N-T-B coordinate system per face
-		vec t = e[0];
-		normalize(t);
-		vec n = e[0] CROSS e[1];
-		vec b = n CROSS t;
-		normalize(b);
-
-		// Estimate curvature based on variation of normals
-		// along edges
-		float m[3] = { 0, 0, 0 };
-		float w[3][3] = { {0,0,0}, {0,0,0}, {0,0,0} };
-		for (int j = 0; j < 3; j++) {
-			float u = e[j] DOT t;
-			float v = e[j] DOT b;
-			w[0][0] += u*u;
-			w[0][1] += u*v;
-			//w[1][1] += v*v + u*u; 
-			//w[1][2] += u*v; 
-			w[2][2] += v*v;
-			vec dn = normals[faces[i][PREV(j)]] -
-				 normals[faces[i][NEXT(j)]];
-			float dnu = dn DOT t;
-			float dnv = dn DOT b;
-			m[0] += dnu*u;
-			m[1] += dnu*v + dnv*u;
-			m[2] += dnv*v;
-		}
-		w[1][1] = w[0][0] + w[2][2];
-		w[1][2] = w[0][1];
-
-		// Least squares solution
-		float diag[3];
-		if (!ldltdc<float,3>(w, diag)) {
-			//dprintf("ldltdc failed!\n");
-			continue;
+	for (index_t i0 = 0; i0 < nf; i0 += FACE_BATCH) {
+		int n = int(min(index_t(FACE_BATCH), nf - i0));
+		float a[FACE_BATCH], c[FACE_BATCH], d[FACE_BATCH];
+		float m0[FACE_BATCH], m1[FACE_BATCH], m2[FACE_BATCH];
+		float ku[FACE_BATCH], kuv[FACE_BATCH], kv[FACE_BATCH];
+		bool ok[FACE_BATCH];
+		for (int k = 0; k < n; k++) {
+			float m[3];
+			face_curv_system(this, i0 + k, ft[i0+k], fb[i0+k],
+					 a[k], c[k], d[k], m);
+			m0[k] = m[0]; m1[k] = m[1]; m2[k] = m[2];
 		}
-		ldltsl<float,3>(w, diag, m, m);
-
-		// Push it back out to the vertices
-		for (int j = 0; j < 3; j++) {
-			int vj = faces[i][j];
-			float c1, c12, c2;
-			proj_curv(t, b, m[0], m[1], m[2],
-				  pdir1[vj], pdir2[vj], c1, c12, c2);
-			float wt = cornerareas[i][j] / pointareas[vj];
-#pragma omp atomic
-			curv1[vj]  += wt * c1;
-#pragma omp atomic
-			curv12[vj] += wt * c12;
-#pragma omp atomic
-			curv2[vj]  += wt * c2;
+		for (int k = 0; k < n; k++)
+			ok[k] = solve_curv_system(a[k], c[k], d[k],
+						  m0[k], m1[k], m2[k],
+						  ku[k], kuv[k], kv[k]);
+		for (int k = 0; k < n; k++) {
+			fok[i0+k] = ok[k];
+			fcurv[i0+k] = vec(ku[k], kuv[k], kv[k]);
 		}
 	}
 
-	// Compute principal directions and curvatures at each vertex
+	// Gather the curvatures of adjacent faces at each vertex
+	StoredFaceCurv stored(ft, fb, fcurv, fok);
 #pragma omp parallel for
-	for (int i = 0; i < nv; i++) {
-		diagonalize_curv(pdir1[i], pdir2[i],
-				 curv1[i], curv12[i], curv2[i],
-				 normals[i], pdir1[i], pdir2[i],
-				 curv1[i], curv2[i]);
-	}
+	for (index_t i = 0; i < nv; i++)
+		vertex_curv(this, i, stored);
+
 	dprintf("Done.\n");
+
+	if (with_dcurv)
+		compute_dcurv(this, ft, fb);
 }
 
 
-// Compute derivatives of curvature.
-void TriMesh::need_dcurv()
+// Recompute the curvatures of just the given vertices, with the same result
+// as recomputing everything
+void TriMesh::update_curvatures(const vector<index_t> &verts)
 {
-	if (dcurv.size() == vertices.size())
-		return;
-	need_curvatures();
-
-	dprintf("Computing dcurv... ");
-
-	// Resize the arrays we'll be using
-	int nv = vertices.size(), nf = faces.size();
-	dcurv.clear(); dcurv.resize(nv);
-
-	// Compute dcurv per-face
+	dprintf("Updating %lld curvatures... ", (long long) verts.size());
+	index_t n = verts.size();
+	FreshFaceCurv fresh(this);
 #pragma omp parallel for
-	for (int i = 0; i < nf; i++) {
-		// Edges
-		vec e[3] = { vertices[faces[i][2]] - vertices[faces[i][1]],
-			     vertices[faces[i][0]] - vertices[faces[i][2]],
-			     vertices[faces[i][1]] - vertices[faces[i][0]] };
-
-		// N-T-B coordinate system per face
-		vec t = e[0];
-		normalize(t);
-		vec n = e[0] CROSS e[1];
-		vec b = n CROSS t;
-		normalize(b);
-
-		// Project curvature tensor from each vertex into this
-		// face's coordinate system
-		vec fcurv[3];
-		for (int j = 0; j < 3; j++) {
-			int vj = faces[i][j];
-			proj_curv(pdir1[vj], pdir2[vj], curv1[vj], 0, curv2[vj],
-				  t, b, fcurv[j][0], fcurv[j][1], fcurv[j][2]);
+	for (index_t k = 0; k < n; k++) {
+		init_coord_sys(this, verts[k]);
+		vertex_curv(this, verts[k], fresh);
+	}
+	dprintf("Done.\n");
+}
 
-		}
 
-		// Estimate dcurv based on variation of curvature along edges
-		float m[4] = { 0, 0, 0, 0 };
-		float w[4][4] = { {0,0,0,0}, {0,0,0,0}, {0,0,0,0}, {0,0,0,0} };
-		for (int j = 0; j < 3; j++) {
-			// Variation of curvature along each edge
-			vec dfcurv = fcurv[PREV(j)] - fcurv[NEXT(j)];
-			float u = e[j] DOT t;
-			float v = e[j] DOT b;
-			float u2 = u*u, v2 = v*v, uv = u*v;
-			w[0][0] += u2;
-			w[0][1] += uv;
-			//w[1][1] += 2.0f*u2 + v2;
-			//w[1][2] += 2.0f*uv;
-			//w[2][2] += u2 + 2.0f*v2;
-			//w[2][3] += uv;
-			w[3][3] += v2;
-			m[0] += u*dfcurv[0];
-			m[1] += v*dfcurv[0] + 2.0f*u*dfcurv[1];
-			m[2] += 2.0f*v*dfcurv[1] + u*dfcurv[2];
-			m[3] += v*dfcurv[2];
+// Average the dcurv of the faces around vertex i, weighted by corner area
+static inline void vertex_dcurv(TriMesh *mesh, index_t i,
+				const vector<vec> &ft, const vector<vec> &fb,
+				const vector< Vec<4> > &fdcurv,
+				const vector<char> &fok)
+{
+	const vector<TriMesh::Face> &faces = mesh->faces;
+	TriMesh::Adjacency::Row a = mesh->adjacentfaces[i];
+	Vec<4> dcurv;
+	int j = -1;
+	for (size_t k = 0; k < a.size(); k++) {
+		index_t f = a[k];
+		if (k && f == a[k-1]) {
+			do {
+				j++;
+			} while (faces[f][j] != i);
+		} else {
+			j = faces[f].indexof(i);
 		}
-		w[1][1] = 2.0f * w[0][0] + w[3][3];
-		w[1][2] = 2.0f * w[0][1];
-		w[2][2] = w[0][0] + 2.0f * w[3][3];
-		w[2][3] = w[0][1];
-
-		// Least squares solution
-		float d[4];
-		if (!ldltdc<float,4>(w, d)) {
-			//dprintf("ldltdc failed!\n");
+		if (!fok[f])
 			continue;
+		Vec<4> this_vert_dcurv;
+		proj_dcurv(ft[f], fb[f], fdcurv[f],
+			   mesh->pdir1[i], mesh->pdir2[i], this_vert_dcurv);
+		float wt = mesh->cornerareas[f][j] / mesh->pointareas[i];
+		dcurv += wt * this_vert_dcurv;
+	}
+	mesh->dcurv[i] = dcurv;
+}
+
+
+// Compute dcurv per-face, in batches as for curvature, then gather it at
+// each vertex.  Each vertex sums its faces in increasing order, so the
+// result doesn't depend on the number of threads.
+static void compute_dcurv(TriMesh *mesh,
+			  const vector<vec> &ft, const vector<vec> &fb)
+{
+	dprintf("Computing dcurv... ");
+
+	index_t nv = mesh->vertices.size(), nf = mesh->faces.size();
+	vector< Vec<4> > fdcurv(nf);
+	vector<char> fok(nf);
+#pragma omp parallel for
+	for (index_t i0 = 0; i0 < nf; i0 += FACE_BATCH) {
+		int n = int(min(index_t(FACE_BATCH), nf - i0));
+		float a[FACE_BATCH], c[FACE_BATCH], d[FACE_BATCH];
+		float m0[FACE_BATCH], m1[FACE_BATCH];
+		float m2[FACE_BATCH], m3[FACE_BATCH];
+		float x0[FACE_BATCH], x1[FACE_BATCH];
+		float x2[FACE_BATCH], x3[FACE_BATCH];
+		bool ok[FACE_BATCH];
+		for (int k = 0; k < n; k++) {
+			float m[4];
+			face_dcurv_system(mesh, i0 + k, ft[i0+k], fb[i0+k],
+					  a[k], c[k], d[k], m);
+			m0[k] = m[0]; m1[k] = m[1]; m2[k] = m[2]; m3[k] = m[3];
 		}
-		ldltsl<float,4>(w, d, m, m);
-		Vec<4> face_dcurv(m);
-
-		// Push it back out to each vertex
-		for (int j = 0; j < 3; j++) {
-			int vj = faces[i][j];
-			Vec<4> this_vert_dcurv;
-			proj_dcurv(t, b, face_dcurv,
-				   pdir1[vj], pdir2[vj], this_vert_dcurv);
-			float wt = cornerareas[i][j] / pointareas[vj];
-			dcurv[vj] += wt * this_vert_dcurv;
+		for (int k = 0; k < n; k++)
+			ok[k] = solve_dcurv_system(a[k], c[k], d[k],
+						   m0[k], m1[k], m2[k], m3[k],
+						   x0[k], x1[k], x2[k], x3[k]);
+		for (int k = 0; k < n; k++) {
+			fok[i0+k] = ok[k];
+			fdcurv[i0+k] = Vec<4>(x0[k], x1[k], x2[k], x3[k]);
 		}
 	}
 
+	mesh->dcurv.clear();
+	mesh->dcurv.resize(nv);
+#pragma omp parallel for
+	for (index_t i = 0; i < nv; i++)
+		vertex_dcurv(mesh, i, ft, fb, fdcurv, fok);
+
 	dprintf("Done.\n");
 }
 
+
+// Compute derivatives of curvature.  To compute curvatures and their
+// derivatives together, sharing the per-face coordinate systems, use
+// need_curvatures(true).
+void TriMesh::need_dcurv()
+{
+	if (dcurv.size() == vertices.size())
+		return;
+	if (!(curv1.size() == vertices.size() && curv_version == version &&
+	      curv_normals_full == normals_full)) {
+		need_curvatures(true);
+		return;
+	}
+
+	index_t nf = faces.size();
+	vector<vec> ft(nf), fb(nf);
+#pragma omp parallel for
+	for (index_t i = 0; i < nf; i++) {
+		vec e[3];
+		face_frame(this, i, e, ft[i], fb[i]);
+	}
+	compute_dcurv(this, ft, fb);
+}
+
 }; // namespace trimesh
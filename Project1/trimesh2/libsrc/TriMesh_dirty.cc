@@ -0,0 +1,147 @@
+/*
+Szymon Rusinkiewicz
+Princeton University
+
+TriMesh_dirty.cc
+Keep track of what has changed in a mesh, so that derived data (normals,
+point areas, curvatures) can be recomputed only where needed.
+*/
+
+#include "TriMesh.h"
+#include <algorithm>
+using namespace std;
+
+
+namespace trimesh {
+
+// Past this fraction of the vertices, it's faster to redo everything
+#define DIRTY_MAX_FRACTION 0.25f
+
+
+// The given vertices have moved.  Negative indices are ignored.
+void TriMesh::changed_vertices(const vector<index_t> &which)
+{
+	if (which.empty())
+		return;
+
+	version++;
+	index_t nv = vertices.size();
+	if ((index_t) vert_changed.size() != nv)
+		vert_changed.resize(nv);
+	for (size_t i = 0; i < which.size(); i++) {
+		if (which[i] >= 0)
+			vert_changed[which[i]] = version;
+	}
+
+	dcurv.clear();
+	bbox.valid = bsphere.valid = false;
+}
+
+
+// All the vertices have moved
+void TriMesh::changed_vertices()
+{
+	version++;
+	all_changed = version;
+	vert_changed.clear();
+
+	dcurv.clear();
+	bbox.valid = bsphere.valid = false;
+}
+
+
+// The faces have changed
+void TriMesh::changed_faces()
+{
+	neighbors.clear();
+	adjacentfaces.clear();
+	across_edge.clear();
+	cornerareas.clear();
+	topology_version++;
+	changed_vertices();
+}
+
+
+// The vertices or faces have been renumbered.  Derived data was renumbered
+// along with them, so whatever was up to date still is, but anything that
+// holds on to vertex or face numbers sees a new version.
+void TriMesh::changed_numbering()
+{
+	bool normals_ok = (normals_version == version);
+	bool pointareas_ok = (pointareas_version == version);
+	bool curv_ok = (curv_version == version);
+	version++;
+	topology_version++;
+	if (normals_ok)
+		normals_version = version;
+	if (pointareas_ok)
+		pointareas_version = version;
+	if (curv_ok)
+		curv_version = version;
+}
+
+
+// Find the vertices whose data, computed at version "since", is out of date:
+// the ones that have changed, grown by the given number of rings.  Returns
+// false if everything should be recomputed.
+bool TriMesh::dirty_verts(unsigned since, int rings, vector<index_t> &verts)
+{
+	verts.clear();
+	index_t nv = vertices.size();
+	if (all_changed > since || (index_t) vert_changed.size() != nv)
+		return false;
+
+	for (index_t i = 0; i < nv; i++) {
+		if (vert_changed[i] > since)
+			verts.push_back(i);
+	}
+	index_t maxverts = index_t(DIRTY_MAX_FRACTION * nv);
+	if ((index_t) verts.size() > maxverts)
+		return false;
+	if (verts.empty() || !rings)
+		return true;
+
+	need_adjacentfaces();
+	vector<char> mark(nv);
+	for (size_t i = 0; i < verts.size(); i++)
+		mark[verts[i]] = true;
+
+	size_t ring_begin = 0;
+	for (int r = 0; r < rings; r++) {
+		size_t ring_end = verts.size();
+		for (size_t i = ring_begin; i < ring_end; i++) {
+			Adjacency::Row a = adjacentfaces[verts[i]];
+			for (size_t j = 0; j < a.size(); j++) {
+				for (int k = 0; k < 3; k++) {
+					index_t v = faces[a[j]][k];
+					if (mark[v])
+						continue;
+					mark[v] = true;
+					verts.push_back(v);
+				}
+			}
+		}
+		if ((index_t) verts.size() > maxverts)
+			return false;
+		ring_begin = ring_end;
+	}
+
+	sort(verts.begin(), verts.end());
+	return true;
+}
+
+
+// All the faces touching any of the given vertices, in increasing order
+void TriMesh::faces_of(const vector<index_t> &verts, vector<index_t> &f)
+{
+	need_adjacentfaces();
+	f.clear();
+	for (size_t i = 0; i < verts.size(); i++) {
+		Adjacency::Row a = adjacentfaces[verts[i]];
+		f.insert(f.end(), a.begin(), a.end());
+	}
+	sort(f.begin(), f.end());
+	f.erase(unique(f.begin(), f.end()), f.end());
+}
+
+}; // namespace trimesh
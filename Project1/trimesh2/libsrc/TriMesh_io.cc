@@ -18,6 +18,7 @@ read texture coordinates.
 #include <cerrno>
 #include <cctype>
 #include <cstdarg>
+#include <climits>
 #include "TriMesh.h"
 #include "strutil.h"
 using namespace std;
@@ -47,17 +48,29 @@ static bool read_off(FILE *f, TriMesh *mesh);
 static bool read_sm( FILE *f, TriMesh *mesh);
 static bool read_stl( FILE *f, TriMesh *mesh);
 
+// One component of a custom attribute in a ply vertex record
+struct PlyAttrib {
+	AttribBase *attr;
+	int comp, offset;
+	PlyAttrib(AttribBase *attr_, int comp_, int offset_) :
+		attr(attr_), comp(comp_), offset(offset_)
+		{}
+};
+
 static bool read_verts_bin(FILE *f, TriMesh *mesh, bool &need_swap,
-	int nverts, int vert_len, int vert_pos, int vert_norm,
-	int vert_color, bool float_color, int vert_conf);
+	index_t nverts, int vert_len, int vert_pos, int vert_norm,
+	int vert_color, bool float_color, int vert_conf,
+	const vector<PlyAttrib> &extra = vector<PlyAttrib>());
 static bool slurp_verts_bin(FILE *f, TriMesh *mesh, bool need_swap,
-	int nverts);
+	index_t nverts);
 static bool read_verts_asc(FILE *f, TriMesh *mesh,
-	int nverts, int vert_len, int vert_pos, int vert_norm,
-	int vert_color, bool float_color, int vert_conf);
+	index_t nverts, int vert_len, int vert_pos, int vert_norm,
+	int vert_color, bool float_color, int vert_conf,
+	const vector<PlyAttrib> &extra = vector<PlyAttrib>());
 static bool read_faces_bin(FILE *f, TriMesh *mesh, bool need_swap,
-	int nfaces, int face_len, int face_count, int face_idx);
-static bool read_faces_asc(FILE *f, TriMesh *mesh, int nfaces,
+	index_t nfaces, int face_len, int face_count, int face_idx,
+	bool unsigned_ind = false);
+static bool read_faces_asc(FILE *f, TriMesh *mesh, index_t nfaces,
 	int face_len, int face_count, int face_idx, bool read_to_eol = false);
 static bool read_strips_bin(FILE *f, TriMesh *mesh, bool need_swap);
 static bool read_strips_asc(FILE *f, TriMesh *mesh);
@@ -66,10 +79,14 @@ static bool read_grid_asc(FILE *f, TriMesh *mesh);
 
 static int ply_type_len(const char *buf, bool binary);
 static bool ply_property(const char *buf, int &len, bool binary);
+static void ply_attribs(TriMesh *mesh, index_t nverts,
+	const vector<string> &names, const vector<string> &types,
+	const vector<int> &offsets, vector<PlyAttrib> &extra);
+static void vert_attribs(TriMesh *mesh, vector<AttribBase *> &attrs);
 static void check_need_swap(const point &p, bool &need_swap);
 static void check_ind_range(TriMesh *mesh);
 static void skip_comments(FILE *f);
-static void tess(const vector<point> &verts, const vector<int> &thisface,
+static void tess(const vector<point> &verts, const vector<index_t> &thisface,
 		 vector<TriMesh::Face> &tris);
 
 static bool write_ply_ascii(TriMesh *mesh, FILE *f,
@@ -90,6 +107,7 @@ static bool write_verts_asc(TriMesh *mesh, FILE *f,
 			    const char *before_color,
 			    bool float_color,
 			    const char *before_conf,
+			    const char *before_attrib,
 			    const char *after_line);
 static bool write_verts_bin(TriMesh *mesh, FILE *f, bool need_swap,
 			    bool write_norm, bool write_color,
@@ -348,10 +366,14 @@ static bool read_ply(FILE *f, TriMesh *mesh)
 {
 	char buf[1024];	
 	bool binary = false, need_swap = false, float_color = false;
-	int result, nverts = 0, nfaces = 0, nstrips = 0, ngrid = 0;
+	int result, nstrips = 0, ngrid = 0;
+	long long nverts = 0, nfaces = 0;
 	int vert_len = 0, vert_pos = -1, vert_norm = -1;
 	int vert_color = -1, vert_conf = -1;
 	int face_len = 0, face_count = -1, face_idx = -1;
+	bool face_uint = false;
+	vector<string> extra_names, extra_types;
+	vector<int> extra_offsets;
 
 	// Read file format
 	GET_LINE();
@@ -396,7 +418,7 @@ static bool read_ply(FILE *f, TriMesh *mesh)
 	}
 
 	// Find number of vertices
-	result = sscanf(buf, "element vertex %d\n", &nverts);
+	result = sscanf(buf, "element vertex %lld\n", &nverts);
 	if (result != 1) {
 		eprintf("Expected \"element vertex\".\n");
 		return false;
@@ -425,6 +447,24 @@ static bool read_ply(FILE *f, TriMesh *mesh)
 		    LINE_IS("property float32 confidence"))
 			vert_conf = vert_len;
 
+		// Anything else may become a custom attribute
+		char type[256], name[256];
+		if (sscanf(buf, "property %255s %255s", type, name) == 2) {
+			static const char *known[] = { "x", "y", "z",
+				"nx", "ny", "nz", "red", "green", "blue",
+				"diffuse_red", "diffuse_green", "diffuse_blue",
+				"confidence", 0 };
+			bool is_known = false;
+			for (int i = 0; known[i]; i++)
+				if (!strcmp(name, known[i]))
+					is_known = true;
+			if (!is_known) {
+				extra_names.push_back(name);
+				extra_types.push_back(type);
+				extra_offsets.push_back(vert_len);
+			}
+		}
+
 		if (!ply_property(buf, vert_len, binary))
 			return false;
 
@@ -450,7 +490,7 @@ static bool read_ply(FILE *f, TriMesh *mesh)
 
 	// Look for faces, tristrips, or range grid
 	if (LINE_IS("element face")) {
-		if (sscanf(buf, "element face %d\n", &nfaces) != 1)
+		if (sscanf(buf, "element face %lld\n", &nfaces) != 1)
 			return false;
 		GET_LINE();
 		while (LINE_IS("property")) {
@@ -460,6 +500,7 @@ static bool read_ply(FILE *f, TriMesh *mesh)
 				int count_len = ply_type_len(count_type, binary);
 				int ind_len = ply_type_len(ind_type, binary);
 				if (count_len && ind_len) {
+					face_uint = begins_with(ind_type, "uint");
 					face_count = face_len;
 					face_idx = face_len + count_len;
 					face_len += count_len;
@@ -513,15 +554,18 @@ static bool read_ply(FILE *f, TriMesh *mesh)
 			for (int i = 0; i < skip1; i++)
 				fscanf(f, "%s", buf);
 	}
+	vector<PlyAttrib> extra;
+	ply_attribs(mesh, nverts, extra_names, extra_types, extra_offsets,
+		    extra);
 	if (binary) {
 		if (!read_verts_bin(f, mesh, need_swap, nverts, vert_len,
 				    vert_pos, vert_norm, vert_color,
-				    float_color, vert_conf))
+				    float_color, vert_conf, extra))
 			return false;
 	} else {
 		if (!read_verts_asc(f, mesh, nverts, vert_len,
 				    vert_pos, vert_norm, vert_color,
-				    float_color, vert_conf))
+				    float_color, vert_conf, extra))
 			return false;
 	}
 
@@ -553,7 +597,8 @@ static bool read_ply(FILE *f, TriMesh *mesh)
 	} else if (nfaces) {
 		if (binary) {
 			if (!read_faces_bin(f, mesh, need_swap, nfaces,
-					    face_len, face_count, face_idx))
+					    face_len, face_count, face_idx,
+					    face_uint))
 				return false;
 		} else {
 			if (!read_faces_asc(f, mesh, nfaces,
@@ -623,10 +668,10 @@ static bool read_3ds(FILE *f, TriMesh *mesh)
 				if (need_swap)
 					swap_ushort(nfaces);
 				dprintf("\n  Reading %d faces... ", nfaces);
-				int old_nfaces = mesh->faces.size();
-				int new_nfaces = old_nfaces + nfaces;
+				index_t old_nfaces = mesh->faces.size();
+				index_t new_nfaces = old_nfaces + nfaces;
 				mesh->faces.resize(new_nfaces);
-				for (int i = old_nfaces; i < new_nfaces; i++) {
+				for (index_t i = old_nfaces; i < new_nfaces; i++) {
 					unsigned short buf[4];
 					COND_READ(true, buf[0], 8);
 					if (need_swap) {
@@ -668,7 +713,7 @@ static bool read_vvd(FILE *f, TriMesh *mesh)
 	mesh->vertices.resize(nverts);
 	dprintf("\n  Reading %d vertices... ", nverts);
 
-	for (int i = 0; i < nverts; i++) {
+	for (index_t i = 0; i < nverts; i++) {
 		double v[3];
 		if (fread(&v[0], 24, 1, f) != 1) {
 			eprintf("Couldn't read vertex.\n");
@@ -698,7 +743,7 @@ static bool read_vvd(FILE *f, TriMesh *mesh)
 // Read a ray file
 static bool read_ray(FILE *f, TriMesh *mesh)
 {
-	vector<int> thisface;
+	vector<index_t> thisface;
 	while (!feof(f)) {
 		char buf[1024];
 		buf[0] = '\0';
@@ -740,8 +785,8 @@ static bool read_ray(FILE *f, TriMesh *mesh)
 // Read an obj file
 static bool read_obj(FILE *f, TriMesh *mesh)
 {
-	vector<int> thisface;
-        vector<int> thistexface;
+	vector<index_t> thisface;
+        vector<index_t> thistexface;
 
 	while (1) {
         skip_comments(f);
@@ -828,8 +873,9 @@ static bool read_off(FILE *f, TriMesh *mesh)
     skip_comments(f);
 	char buf[1024];
 	GET_LINE();
-	int nverts, nfaces, unused;
-	if (sscanf(buf, "%d %d %d", &nverts, &nfaces, &unused) < 2)
+	long long nverts, nfaces;
+	int unused;
+	if (sscanf(buf, "%lld %lld %d", &nverts, &nfaces, &unused) < 2)
 		return false;
 	if (!read_verts_asc(f, mesh, nverts, 3, 0, -1, -1, false, -1))
 		return false;
@@ -843,16 +889,16 @@ static bool read_off(FILE *f, TriMesh *mesh)
 // Read an sm file
 static bool read_sm(FILE *f, TriMesh *mesh)
 {
-	int nverts, nfaces;
+	long long nverts, nfaces;
 
-	if (fscanf(f, "%d", &nverts) != 1)
+	if (fscanf(f, "%lld", &nverts) != 1)
 		return false;
 
 	if (!read_verts_asc(f, mesh, nverts, 3, 0, -1, -1, false, -1))
 		return false;
 
 	skip_comments(f);
-	if (fscanf(f, "%d", &nfaces) != 1)
+	if (fscanf(f, "%lld", &nfaces) != 1)
 		return true;
 	if (!read_faces_asc(f, mesh, nfaces, 0, -1, 0))
 		return false;
@@ -895,15 +941,29 @@ static bool read_stl(FILE *f, TriMesh *mesh)
 }
 
 
+// Read one component of a custom attribute from a binary vertex record
+static inline void read_attrib_bin(const unsigned char *p,
+	const PlyAttrib &pa, int i, bool need_swap)
+{
+	unsigned char *q = (unsigned char *) pa.attr->ptr(i, pa.comp);
+	size_t len = pa.attr->elem_size();
+	memcpy(q, p, len);
+	if (need_swap && len == 4)
+		swap_32(q);
+}
+
+
 // Read nverts vertices from a binary file.
 // vert_len = total length of a vertex record in bytes
 // vert_pos, vert_norm, vert_color, vert_conf =
 //   position of vertex coordinates / normals / color / confidence in record
 // need_swap = swap for opposite endianness
 // float_color = colors are 4-byte float * 3, vs 1-byte uchar * 3
+// extra = components of custom attributes, and their positions in record
 static bool read_verts_bin(FILE *f, TriMesh *mesh, bool &need_swap,
-	int nverts, int vert_len, int vert_pos, int vert_norm,
-	int vert_color, bool float_color, int vert_conf)
+	index_t nverts, int vert_len, int vert_pos, int vert_norm,
+	int vert_color, bool float_color, int vert_conf,
+	const vector<PlyAttrib> &extra /* = vector<PlyAttrib>() */)
 {
 	const int vert_size = 12;
 	const int norm_size = 12;
@@ -913,8 +973,8 @@ static bool read_verts_bin(FILE *f, TriMesh *mesh, bool &need_swap,
 	if (nverts <= 0 || vert_len < 12 || vert_pos < 0)
 		return false;
 
-	int old_nverts = mesh->vertices.size();
-	int new_nverts = old_nverts + nverts;
+	index_t old_nverts = mesh->vertices.size();
+	index_t new_nverts = old_nverts + nverts;
 	mesh->vertices.resize(new_nverts);
 
 	bool have_norm = (vert_norm >= 0);
@@ -930,7 +990,7 @@ static bool read_verts_bin(FILE *f, TriMesh *mesh, bool &need_swap,
 	unsigned char *buf = new unsigned char[vert_len];
 	COND_READ(true, buf[0], vert_len);
 
-	int i = old_nverts;
+	index_t i = old_nverts;
 	memcpy(&mesh->vertices[i][0], &buf[vert_pos], vert_size);
 	if (have_norm)
 		memcpy(&mesh->normals[i][0], &buf[vert_norm], norm_size);
@@ -959,8 +1019,10 @@ static bool read_verts_bin(FILE *f, TriMesh *mesh, bool &need_swap,
 		if (have_conf)
 			swap_float(mesh->confidences[i]);
 	}
+	for (size_t j = 0; j < extra.size(); j++)
+		read_attrib_bin(&buf[extra[j].offset], extra[j], i, need_swap);
 
-	dprintf("\n  Reading %d vertices... ", nverts);
+	dprintf("\n  Reading %lld vertices... ", (long long) nverts);
 	if (vert_len == 12 && sizeof(point) == 12 && nverts > 1)
 		return slurp_verts_bin(f, mesh, need_swap, nverts);
 	while (++i < new_nverts) {
@@ -992,6 +1054,9 @@ static bool read_verts_bin(FILE *f, TriMesh *mesh, bool &need_swap,
 			if (have_conf)
 				swap_float(mesh->confidences[i]);
 		}
+		for (size_t j = 0; j < extra.size(); j++)
+			read_attrib_bin(&buf[extra[j].offset], extra[j], i,
+					need_swap);
 	}
 
 	return true;
@@ -999,9 +1064,10 @@ static bool read_verts_bin(FILE *f, TriMesh *mesh, bool &need_swap,
 
 
 // Optimized reader for the simple case of just vertices w/o other properties
-static bool slurp_verts_bin(FILE *f, TriMesh *mesh, bool need_swap, int nverts)
+static bool slurp_verts_bin(FILE *f, TriMesh *mesh, bool need_swap,
+	index_t nverts)
 {
-	int first = mesh->vertices.size() - nverts + 1;
+	index_t first = mesh->vertices.size() - nverts + 1;
 	COND_READ(true, mesh->vertices[first][0], (nverts-1)*12);
 	if (need_swap) {
 	    for (size_t i = first; i < mesh->vertices.size(); i++) {
@@ -1018,14 +1084,20 @@ static bool slurp_verts_bin(FILE *f, TriMesh *mesh, bool need_swap, int nverts)
 // Parameters are as in read_verts_bin, but offsets are in
 // (white-space-separated) words, rather than in bytes
 static bool read_verts_asc(FILE *f, TriMesh *mesh,
-	int nverts, int vert_len, int vert_pos, int vert_norm,
-	int vert_color, bool float_color, int vert_conf)
+	index_t nverts, int vert_len, int vert_pos, int vert_norm,
+	int vert_color, bool float_color, int vert_conf,
+	const vector<PlyAttrib> &extra /* = vector<PlyAttrib>() */)
 {
 	if (nverts <= 0 || vert_len < 3 || vert_pos < 0)
 		return false;
 
-	int old_nverts = mesh->vertices.size();
-	int new_nverts = old_nverts + nverts;
+	// Which custom attribute component, if any, is at each position
+	vector<int> extra_at(vert_len, -1);
+	for (size_t j = 0; j < extra.size(); j++)
+		extra_at[extra[j].offset] = j;
+
+	index_t old_nverts = mesh->vertices.size();
+	index_t new_nverts = old_nverts + nverts;
 	mesh->vertices.resize(new_nverts);
 	if (vert_norm > 0)
 		mesh->normals.resize(new_nverts);
@@ -1036,8 +1108,8 @@ static bool read_verts_asc(FILE *f, TriMesh *mesh,
 
 	char buf[1024];
 	skip_comments(f);
-	dprintf("\n  Reading %d vertices... ", nverts);
-	for (int i = old_nverts; i < new_nverts; i++) {
+	dprintf("\n  Reading %lld vertices... ", (long long) nverts);
+	for (index_t i = old_nverts; i < new_nverts; i++) {
 		for (int j = 0; j < vert_len; j++) {
 			if (j == vert_pos) {
 				if (fscanf(f, "%f %f %f",
@@ -1068,6 +1140,12 @@ static bool read_verts_asc(FILE *f, TriMesh *mesh,
 			} else if (j == vert_conf) {
 				if (fscanf(f, "%f", &mesh->confidences[i]) != 1)
 					return false;
+			} else if (extra_at[j] >= 0) {
+				const PlyAttrib &pa = extra[extra_at[j]];
+				double val;
+				if (fscanf(f, "%lf", &val) != 1)
+					return false;
+				pa.attr->set(i, pa.comp, val);
 			} else {
 				fscanf(f, " %1024s", buf);
 			}
@@ -1084,8 +1162,10 @@ static bool read_verts_asc(FILE *f, TriMesh *mesh,
 // face_count = offset within record of the count of indices in this face
 //  (If this is -1, does not read a count and assumes triangles)
 // face_idx = offset within record of the indices themselves
+// unsigned_ind = indices are unsigned ints, vs signed
 static bool read_faces_bin(FILE *f, TriMesh *mesh, bool need_swap,
-	int nfaces, int face_len, int face_count, int face_idx)
+	index_t nfaces, int face_len, int face_count, int face_idx,
+	bool unsigned_ind /* = false */)
 {
 	if (nfaces < 0 || face_idx < 0)
 		return false;
@@ -1093,10 +1173,10 @@ static bool read_faces_bin(FILE *f, TriMesh *mesh, bool need_swap,
 	if (nfaces == 0)
 		return true;
 
-	dprintf("\n  Reading %d faces... ", nfaces);
+	dprintf("\n  Reading %lld faces... ", (long long) nfaces);
 
-	int old_nfaces = mesh->faces.size();
-	int new_nfaces = old_nfaces + nfaces;
+	index_t old_nfaces = mesh->faces.size();
+	index_t new_nfaces = old_nfaces + nfaces;
 	mesh->faces.reserve(new_nfaces);
 
 	// face_len doesn't include the indices themeselves, since that's
@@ -1104,8 +1184,9 @@ static bool read_faces_bin(FILE *f, TriMesh *mesh, bool need_swap,
 	int face_skip = face_len - face_idx;
 
 	vector<unsigned char> buf(max(face_idx, face_skip));
-	vector<int> thisface;
-	for (int i = 0; i < nfaces; i++) {
+	vector<unsigned> rawface;
+	vector<index_t> thisface;
+	for (index_t i = 0; i < nfaces; i++) {
 		COND_READ(face_idx > 0, buf[0], face_idx);
 
 		unsigned this_ninds = 3;
@@ -1119,11 +1200,14 @@ static bool read_faces_bin(FILE *f, TriMesh *mesh, bool need_swap,
 				this_ninds = buf[face_count];
 			}
 		}
+		rawface.resize(this_ninds);
 		thisface.resize(this_ninds);
-		COND_READ(true, thisface[0], 4*this_ninds);
-		if (need_swap) {
-			for (size_t j = 0; j < thisface.size(); j++)
-				swap_int(thisface[j]);
+		COND_READ(true, rawface[0], 4*this_ninds);
+		for (size_t j = 0; j < this_ninds; j++) {
+			if (need_swap)
+				swap_unsigned(rawface[j]);
+			thisface[j] = unsigned_ind ? index_t(rawface[j]) :
+				index_t(int(rawface[j]));
 		}
 		tess(mesh->vertices, thisface, mesh->faces);
 		COND_READ(face_skip > 0, buf[0], face_skip);
@@ -1134,7 +1218,7 @@ static bool read_faces_bin(FILE *f, TriMesh *mesh, bool need_swap,
 
 
 // Read a bunch of faces from an ASCII file
-static bool read_faces_asc(FILE *f, TriMesh *mesh, int nfaces,
+static bool read_faces_asc(FILE *f, TriMesh *mesh, index_t nfaces,
 	int face_len, int face_count, int face_idx, bool read_to_eol /* = false */)
 {
 	if (nfaces < 0 || face_idx < 0)
@@ -1143,21 +1227,23 @@ static bool read_faces_asc(FILE *f, TriMesh *mesh, int nfaces,
 	if (nfaces == 0)
 		return true;
 
-	int old_nfaces = mesh->faces.size();
-	int new_nfaces = old_nfaces + nfaces;
+	index_t old_nfaces = mesh->faces.size();
+	index_t new_nfaces = old_nfaces + nfaces;
 	mesh->faces.reserve(new_nfaces);
 
 	char buf[1024];
 	skip_comments(f);
-	dprintf("\n  Reading %d faces... ", nfaces);
-	vector<int> thisface;
-	for (int i = 0; i < nfaces; i++) {
+	dprintf("\n  Reading %lld faces... ", (long long) nfaces);
+	vector<index_t> thisface;
+	for (index_t i = 0; i < nfaces; i++) {
 		thisface.clear();
 		int this_face_count = 3;
 		for (int j = 0; j < face_len + this_face_count; j++) {
 			if (j >= face_idx && j < face_idx + this_face_count) {
-				thisface.push_back(0);
-				if (!fscanf(f, " %d", &(thisface.back()))) {
+				long long ind = 0;
+				bool ok = fscanf(f, " %lld", &ind);
+				thisface.push_back(ind);
+				if (!ok) {
 					dprintf("Couldn't read vertex index %d for face %d\n",
 						j - face_idx, i);
 					return false;
@@ -1198,10 +1284,12 @@ static bool read_strips_bin(FILE *f, TriMesh *mesh, bool need_swap)
 	mesh->tstrips.resize(new_striplen);
 
 	dprintf("\n  Reading triangle strips... ");
-	COND_READ(true, mesh->tstrips[old_striplen], 4*striplen);
-	if (need_swap) {
-		for (int i = old_striplen; i < new_striplen; i++)
-			swap_int(mesh->tstrips[i]);
+	vector<int> raw(striplen);
+	COND_READ(striplen > 0, raw[0], 4*striplen);
+	for (int i = 0; i < striplen; i++) {
+		if (need_swap)
+			swap_int(raw[i]);
+		mesh->tstrips[old_striplen + i] = raw[i];
 	}
 
 	return true;
@@ -1221,9 +1309,12 @@ static bool read_strips_asc(FILE *f, TriMesh *mesh)
 
 	dprintf("\n  Reading triangle strips... ");
 	skip_comments(f);
-	for (int i = old_striplen; i < new_striplen; i++)
-		if (fscanf(f, "%d", &mesh->tstrips[i]) != 1)
+	for (int i = old_striplen; i < new_striplen; i++) {
+		long long ind;
+		if (fscanf(f, "%lld", &ind) != 1)
 			return false;
+		mesh->tstrips[i] = ind;
+	}
 
 	return true;
 }
@@ -1240,10 +1331,12 @@ static bool read_grid_bin(FILE *f, TriMesh *mesh, bool need_swap)
 		if (n == EOF)
 			return false;
 		while (n--) {
-			if (!fread((void *)&(mesh->grid[i]), 4, 1, f))
+			unsigned g;
+			if (!fread((void *)&g, 4, 1, f))
 				return false;
 			if (need_swap)
-				swap_int(mesh->grid[i]);
+				swap_unsigned(g);
+			mesh->grid[i] = g;
 		}
 	}
 
@@ -1263,8 +1356,10 @@ static bool read_grid_asc(FILE *f, TriMesh *mesh)
 		if (fscanf(f, "%d", &n) != 1)
 			return false;
 		while (n--) {
-			if (fscanf(f, "%d", &(mesh->grid[i])) != 1)
+			long long g;
+			if (fscanf(f, "%lld", &g) != 1)
 				return false;
+			mesh->grid[i] = g;
 		}
 	}
 
@@ -1316,6 +1411,64 @@ static bool ply_property(const char *buf, int &len, bool binary)
 }
 
 
+// Turn the unrecognized properties of ply vertices into custom attributes.
+// A run of properties named foo_0, foo_1, ... of the same type becomes one
+// attribute "foo" with several components.  Types that attributes can't
+// hold (e.g., double) are skipped.
+static void ply_attribs(TriMesh *mesh, index_t nverts,
+	const vector<string> &names, const vector<string> &types,
+	const vector<int> &offsets, vector<PlyAttrib> &extra)
+{
+	size_t n = names.size();
+	size_t i = 0;
+	while (i < n) {
+		string name = names[i];
+		int ncomp = 1;
+		if (ends_with(name, "_0")) {
+			string base = name.substr(0, name.length() - 2);
+			while (i + ncomp < n && types[i + ncomp] == types[i]) {
+				char comp[32];
+				sprintf(comp, "_%d", ncomp);
+				if (names[i + ncomp] != base + comp)
+					break;
+				ncomp++;
+			}
+			if (ncomp > 1)
+				name = base;
+		}
+
+		const string &type = types[i];
+		AttribBase *a = NULL;
+		if (type == "float" || type == "float32")
+			a = new Attrib<float>(name, AttribBase::VERTEX, ncomp);
+		else if (type == "int" || type == "int32")
+			a = new Attrib<int>(name, AttribBase::VERTEX, ncomp);
+		else if (type == "uchar" || type == "uint8")
+			a = new Attrib<unsigned char>(name, AttribBase::VERTEX,
+						      ncomp);
+		if (a) {
+			a->resize(mesh->vertices.size() + nverts);
+			mesh->attribs.add(a);
+			for (int c = 0; c < ncomp; c++)
+				extra.push_back(PlyAttrib(a, c, offsets[i + c]));
+		}
+		i += ncomp;
+	}
+}
+
+
+// The custom per-vertex attributes that can be written out
+static void vert_attribs(TriMesh *mesh, vector<AttribBase *> &attrs)
+{
+	for (size_t i = 0; i < mesh->attribs.size(); i++) {
+		AttribBase *a = mesh->attribs[i];
+		if (a->where() == AttribBase::VERTEX &&
+		    a->size() == mesh->vertices.size())
+			attrs.push_back(a);
+	}
+}
+
+
 // Figure out whether the need_swap setting makes sense, or whether this
 // file incorrectly declares its endianness
 static void check_need_swap(const point &p, bool &need_swap)
@@ -1352,8 +1505,8 @@ static void check_ind_range(TriMesh *mesh)
 {
 	if (mesh->faces.empty())
 		return;
-	int min_ind = mesh->faces[0][0];
-	int max_ind = mesh->faces[0][0];
+	index_t min_ind = mesh->faces[0][0];
+	index_t max_ind = mesh->faces[0][0];
 	for (size_t i = 0; i < mesh->faces.size(); i++) {
 		for (int j = 0; j < 3; j++) {
 			min_ind = min(min_ind, mesh->faces[i][j]);
@@ -1361,7 +1514,7 @@ static void check_ind_range(TriMesh *mesh)
 		}
 	}
 
-	int nv = mesh->vertices.size();
+	index_t nv = mesh->vertices.size();
 
 	// All good
 	if (min_ind == 0 && max_ind == nv-1)
@@ -1369,9 +1522,10 @@ static void check_ind_range(TriMesh *mesh)
 
 	// Simple fix: offset everything
 	if (max_ind - min_ind == nv-1) {
-		dprintf("Found indices ranging from %d through %d\n",
-				 min_ind, max_ind);
-		dprintf("Remapping to %d through %d\n", 0, nv-1);
+		dprintf("Found indices ranging from %lld through %lld\n",
+				 (long long) min_ind, (long long) max_ind);
+		dprintf("Remapping to %d through %lld\n", 0,
+				 (long long) nv-1);
 		for (size_t i = 0; i < mesh->faces.size(); i++)
 			for (int j = 0; j < 3; j++)
 				mesh->faces[i][j] -= min_ind;
@@ -1405,7 +1559,7 @@ static void skip_comments(FILE *f)
 
 
 // Tesselate an arbitrary n-gon.  Appends triangles to "tris".
-static void tess(const vector<point> &verts, const vector<int> &thisface,
+static void tess(const vector<point> &verts, const vector<index_t> &thisface,
 		 vector<TriMesh::Face> &tris)
 {
 	if (thisface.size() < 3)
@@ -1656,10 +1810,26 @@ static bool write_ply_header(TriMesh *mesh, FILE *f, const char *format,
 	if (!mesh->confidences.empty()) {
 		FPRINTF(f, "property float confidence\n");
 	}
+	vector<AttribBase *> attrs;
+	vert_attribs(mesh, attrs);
+	for (size_t i = 0; i < attrs.size(); i++) {
+		const char *type = attrs[i]->ply_type();
+		const char *name = attrs[i]->name().c_str();
+		int ncomp = attrs[i]->ncomp();
+		if (ncomp == 1) {
+			FPRINTF(f, "property %s %s\n", type, name);
+			continue;
+		}
+		for (int c = 0; c < ncomp; c++)
+			FPRINTF(f, "property %s %s_%d\n", type, name, c);
+	}
+	// Indices are written as 4-byte ints, or unsigned ints if needed
+	const char *ind_type = (mesh->vertices.size() > (size_t) INT_MAX) ?
+		"uint" : "int";
 	if (write_grid) {
 		int ngrid = mesh->grid_width * mesh->grid_height;
 		FPRINTF(f, "element range_grid %d\n", ngrid);
-		FPRINTF(f, "property list uchar int vertex_indices\n");
+		FPRINTF(f, "property list uchar %s vertex_indices\n", ind_type);
 	} else if (write_tstrips) {
 		FPRINTF(f, "element tristrips 1\n");
 		FPRINTF(f, "property list int int vertex_indices\n");
@@ -1668,7 +1838,8 @@ static bool write_ply_header(TriMesh *mesh, FILE *f, const char *format,
 		if (!mesh->faces.empty()) {
 			FPRINTF(f, "element face %lu\n",
 				(unsigned long) mesh->faces.size());
-			FPRINTF(f, "property list uchar int vertex_indices\n");
+			FPRINTF(f, "property list uchar %s vertex_indices\n",
+				ind_type);
 		}
 	}
 	FPRINTF(f, "end_header\n");
@@ -1689,7 +1860,7 @@ static bool write_ply_ascii(TriMesh *mesh, FILE *f, bool write_norm,
 			      write_norm, float_color))
 		return false;
 	if (!write_verts_asc(mesh, f, "", write_norm ? " " : 0, " ",
-			     float_color, " ", ""))
+			     float_color, " ", " ", ""))
 		return false;
 	if (write_grid) {
 		return write_grid_asc(mesh, f);
@@ -1750,7 +1921,7 @@ static bool write_ray(TriMesh *mesh, FILE *f)
 	FPRINTF(f, "#material 0 0 0  1 1 1  0 0 0  0 0 0  0 0 1  -1  !!\n");
 	FPRINTF(f, "#vertex_num %lu\n", (unsigned long) mesh->vertices.size());
 	mesh->need_normals();
-	if (!write_verts_asc(mesh, f, "#vertex ", "  ", 0, false, 0, "  0 0"))
+	if (!write_verts_asc(mesh, f, "#vertex ", "  ", 0, false, 0, 0, "  0 0"))
 		return false;
 	mesh->need_faces();
 	return write_faces_asc(mesh, f, "#shape_triangle 0  ", "");
@@ -1763,7 +1934,7 @@ static bool write_obj(TriMesh *mesh, FILE *f, bool write_norm)
 	FPRINTF(f, "# OBJ\n");
 	if (write_norm)
 		mesh->need_normals();
-	if (!write_verts_asc(mesh, f, "v ", write_norm ? "\nvn " : 0, 0, false, 0, ""))
+	if (!write_verts_asc(mesh, f, "v ", write_norm ? "\nvn " : 0, 0, false, 0, 0, ""))
 		return false;
 
 	mesh->need_faces();
@@ -1780,10 +1951,11 @@ static bool write_obj(TriMesh *mesh, FILE *f, bool write_norm)
 		ok = write_faces_asc(mesh, f, "f ", "");
 	} else {
 		for (size_t i = 0; i < mesh->faces.size(); i++) {
-			int n = fprintf(f, "f %d//%d %d//%d %d//%d\n",
-					mesh->faces[i][0], mesh->faces[i][0],
-					mesh->faces[i][1], mesh->faces[i][1],
-					mesh->faces[i][2], mesh->faces[i][2]);
+			long long v0 = mesh->faces[i][0];
+			long long v1 = mesh->faces[i][1];
+			long long v2 = mesh->faces[i][2];
+			int n = fprintf(f, "f %lld//%lld %lld//%lld %lld//%lld\n",
+					v0, v0, v1, v1, v2, v2);
 			if (n < 6) {
 				ok = false;
 				break;
@@ -1808,7 +1980,7 @@ static bool write_off(TriMesh *mesh, FILE *f)
 	mesh->need_faces();
 	FPRINTF(f, "%lu %lu 0\n", (unsigned long) mesh->vertices.size(),
 		(unsigned long) mesh->faces.size());
-	return write_verts_asc(mesh, f, "", 0, 0, false, 0, "") &&
+	return write_verts_asc(mesh, f, "", 0, 0, false, 0, 0, "") &&
 	       write_faces_asc(mesh, f, "3 ", "");
 }
 
@@ -1817,7 +1989,7 @@ static bool write_off(TriMesh *mesh, FILE *f)
 static bool write_sm(TriMesh *mesh, FILE *f)
 {
 	FPRINTF(f, "%lu\n", (unsigned long) mesh->vertices.size());
-	if (!write_verts_asc(mesh, f, "", 0, 0, false, 0, ""))
+	if (!write_verts_asc(mesh, f, "", 0, 0, false, 0, 0, ""))
 		return false;
 	mesh->need_faces();
 	FPRINTF(f, "%lu\n", (unsigned long) mesh->faces.size());
@@ -1934,10 +2106,10 @@ static bool write_cc(TriMesh *mesh, FILE *f, const char *filename,
 	}
 	FPRINTF(f, "\tstatic const int facedata[][3] = {\n");
 	for (int i = 0; i < nf; i++) {
-		FPRINTF(f, "\t\t{ %d, %d, %d },\n",
-				mesh->faces[i][0],
-				mesh->faces[i][1],
-				mesh->faces[i][2]);
+		FPRINTF(f, "\t\t{ %lld, %lld, %lld },\n",
+				(long long) mesh->faces[i][0],
+				(long long) mesh->faces[i][1],
+				(long long) mesh->faces[i][2]);
 	}
 	FPRINTF(f, "\t};\n");
 	FPRINTF(f, "\n\t::trimesh::TriMesh *m = new ::trimesh::TriMesh;\n");
@@ -1999,10 +2171,10 @@ static bool write_dae(TriMesh *mesh, FILE *f)
 	FPRINTF(f, "    <input offset=\"0\" semantic=\"VERTEX\" source=\"#vv\"/>\n");
 	FPRINTF(f, "    <p>\n");
 	for (int i = 0; i < nf; i++) {
-		FPRINTF(f, "\t%d %d %d\n",
-			mesh->faces[i][0],
-			mesh->faces[i][1],
-			mesh->faces[i][2]);
+		FPRINTF(f, "\t%lld %lld %lld\n",
+			(long long) mesh->faces[i][0],
+			(long long) mesh->faces[i][1],
+			(long long) mesh->faces[i][2]);
 	}
 	FPRINTF(f, "    </p>\n");
 	FPRINTF(f, "   </triangles>\n");
@@ -2031,8 +2203,12 @@ static bool write_verts_asc(TriMesh *mesh, FILE *f,
 			    const char *before_color,
 			    bool float_color,
 			    const char *before_conf,
+			    const char *before_attrib,
 			    const char *after_line)
 {
+	vector<AttribBase *> attrs;
+	if (before_attrib)
+		vert_attribs(mesh, attrs);
     for (size_t i = 0; i < mesh->vertices.size(); i++) {
 		FPRINTF(f, "%s%.7g %.7g %.7g", before_vert,
 				mesh->vertices[i][0],
@@ -2055,6 +2231,16 @@ static bool write_verts_asc(TriMesh *mesh, FILE *f,
 				color2uchar(mesh->colors[i][2]));
 		if (!mesh->confidences.empty() && before_conf)
 			FPRINTF(f, "%s%.7g", before_conf, mesh->confidences[i]);
+		for (size_t j = 0; j < attrs.size(); j++) {
+			for (int c = 0; c < attrs[j]->ncomp(); c++) {
+				if (attrs[j]->integral())
+					FPRINTF(f, "%s%d", before_attrib,
+						(int) attrs[j]->get(i, c));
+				else
+					FPRINTF(f, "%s%.7g", before_attrib,
+						attrs[j]->get(i, c));
+			}
+		}
 		FPRINTF(f, "%s\n", after_line);
 	}
 	return true;
@@ -2087,6 +2273,15 @@ static void swap_vert_props(TriMesh *mesh, bool swap_color)
 		for (size_t i = 0; i < mesh->confidences.size(); i++)
 			swap_float(mesh->confidences[i]);
 	}
+	vector<AttribBase *> attrs;
+	vert_attribs(mesh, attrs);
+	for (size_t j = 0; j < attrs.size(); j++) {
+		if (attrs[j]->elem_size() != 4)
+			continue;
+		for (size_t i = 0; i < attrs[j]->size(); i++)
+			for (int c = 0; c < attrs[j]->ncomp(); c++)
+				swap_32((unsigned char *) attrs[j]->ptr(i, c));
+	}
 }
 
 
@@ -2095,9 +2290,12 @@ static bool write_verts_bin_helper(TriMesh *mesh, FILE *f,
 				   bool write_norm, bool write_color,
 				   bool float_color, bool write_conf)
 {
+	vector<AttribBase *> attrs;
+	vert_attribs(mesh, attrs);
 	if ((mesh->normals.empty() || !write_norm) &&
 	    (mesh->colors.empty() || !write_color) &&
-	    (mesh->confidences.empty() || !write_conf)) {
+	    (mesh->confidences.empty() || !write_conf) &&
+	    attrs.empty()) {
 		// Optimized vertex-only code
 		FWRITE(&(mesh->vertices[0][0]), 12*mesh->vertices.size(), 1, f);
 	} else {
@@ -2117,6 +2315,10 @@ static bool write_verts_bin_helper(TriMesh *mesh, FILE *f,
 			}
 			if (!mesh->confidences.empty() && write_conf)
 				FWRITE(&(mesh->confidences[i]), 4, 1, f);
+			for (size_t j = 0; j < attrs.size(); j++)
+				for (int c = 0; c < attrs[j]->ncomp(); c++)
+					FWRITE(attrs[j]->ptr(i, c),
+					       attrs[j]->elem_size(), 1, f);
 		}
 	}
 	return true;
@@ -2144,8 +2346,10 @@ static bool write_faces_asc(TriMesh *mesh, FILE *f,
 {
 	mesh->need_faces();
 	for (size_t i = 0; i < mesh->faces.size(); i++) {
-		FPRINTF(f, "%s%d %d %d%s\n", before_face, mesh->faces[i][0],
-			mesh->faces[i][1], mesh->faces[i][2], after_line);
+		FPRINTF(f, "%s%lld %lld %lld%s\n", before_face,
+			(long long) mesh->faces[i][0],
+			(long long) mesh->faces[i][1],
+			(long long) mesh->faces[i][2], after_line);
 	}
 	return true;
 }
@@ -2157,41 +2361,23 @@ static bool write_faces_bin(TriMesh *mesh, FILE *f, bool need_swap,
 			    int after_face_len, const char *after_face)
 {
 	mesh->need_faces();
-	if (need_swap) {
-		for (size_t i = 0; i < mesh->faces.size(); i++) {
-			swap_int(mesh->faces[i][0]);
-			swap_int(mesh->faces[i][1]);
-			swap_int(mesh->faces[i][2]);
-		}
-	}
-	bool ok = true;
 	for (size_t i = 0; i < mesh->faces.size(); i++) {
-		if (before_face_len) {
-			if (fwrite(before_face, before_face_len, 1, f) != 1) {
-				ok = false;
-				goto out;
-			}
-		}
-		if (fwrite(&(mesh->faces[i][0]), 12, 1, f) != 1) {
-			ok = false;
-			goto out;
-		}
-		if (after_face_len) {
-			if (fwrite(after_face, after_face_len, 1, f) != 1) {
-				ok = false;
-				goto out;
-			}
-		}
-	}
-out:
-	if (need_swap) {
-		for (size_t i = 0; i < mesh->faces.size(); i++) {
-			swap_int(mesh->faces[i][0]);
-			swap_int(mesh->faces[i][1]);
-			swap_int(mesh->faces[i][2]);
+		if (before_face_len)
+			FWRITE(before_face, before_face_len, 1, f);
+		// Indices in the file are always 4 bytes
+		unsigned v[3] = { unsigned(mesh->faces[i][0]),
+				  unsigned(mesh->faces[i][1]),
+				  unsigned(mesh->faces[i][2]) };
+		if (need_swap) {
+			swap_unsigned(v[0]);
+			swap_unsigned(v[1]);
+			swap_unsigned(v[2]);
 		}
+		FWRITE(v, 12, 1, f);
+		if (after_face_len)
+			FWRITE(after_face, after_face_len, 1, f);
 	}
-	return ok;
+	return true;
 }
 
 
@@ -2199,7 +2385,7 @@ out:
 static bool write_strips_asc(TriMesh *mesh, FILE *f)
 {
 	for (size_t i = 0; i < mesh->tstrips.size(); i++) {
-		FPRINTF(f, "%d ", mesh->tstrips[i]);
+		FPRINTF(f, "%lld ", (long long) mesh->tstrips[i]);
 	}
 	FPRINTF(f, "\n");
 	return true;
@@ -2209,16 +2395,13 @@ static bool write_strips_asc(TriMesh *mesh, FILE *f)
 // Write tstrips to a binary file
 static bool write_strips_bin(TriMesh *mesh, FILE *f, bool need_swap)
 {
+	// Indices in the file are always 4 bytes
+	vector<int> raw(mesh->tstrips.begin(), mesh->tstrips.end());
 	if (need_swap) {
-		for (size_t i = 0; i < mesh->tstrips.size(); i++)
-			swap_int(mesh->tstrips[i]);
+		for (size_t i = 0; i < raw.size(); i++)
+			swap_int(raw[i]);
 	}
-	bool ok = (fwrite(&(mesh->tstrips[0]), 4*mesh->tstrips.size(), 1, f) == 1);
-	if (need_swap) {
-		for (size_t i = 0; i < mesh->tstrips.size(); i++)
-			swap_int(mesh->tstrips[i]);
-	}
-	return ok;
+	return (fwrite(&raw[0], 4*raw.size(), 1, f) == 1);
 }
 
 
@@ -2229,7 +2412,7 @@ static bool write_grid_asc(TriMesh *mesh, FILE *f)
 		if (mesh->grid[i] < 0) {
 			FPRINTF(f, "0\n");
 		} else {
-			FPRINTF(f, "1 %d\n", mesh->grid[i]);
+			FPRINTF(f, "1 %lld\n", (long long) mesh->grid[i]);
 		}
 	}
 	return true;
@@ -2246,9 +2429,9 @@ static bool write_grid_bin(TriMesh *mesh, FILE *f, bool need_swap)
 			FWRITE(&zero, 1, 1, f);
 		} else {
 			FWRITE(&one, 1, 1, f);
-			int g = mesh->grid[i];
+			unsigned g = mesh->grid[i];
 			if (need_swap)
-				swap_int(g);
+				swap_unsigned(g);
 			FWRITE(&g, 4, 1, f);
 		}
 	}
@@ -9,6 +9,9 @@ For meshes, uses average of per-face normals, weighted according to:
   Max, N.
   "Weights for Computing Vertex Normals from Facet Normals,"
   Journal of Graphics Tools, Vol. 4, No. 2, 1999.
+or optionally by face area or by the angle at each corner.  Each vertex
+sums its faces' contributions in face order, so the result does not depend
+on the number of threads.
 
 For raw point clouds, fits plane to k nearest neighbors.
 
@@ -20,18 +23,70 @@ of per-vertex texture coordinates.
 #include "TriMesh.h"
 #include "KDtree.h"
 #include "lineqn.h"
+#ifdef _OPENMP
+# include <omp.h>
+#endif
 using namespace std;
 
 
 namespace trimesh {
 
+// Contributions of the triangle (p0,p1,p2) to the normals at its corners.
+// Returns false for degenerate triangles.
+static inline bool corner_normals(const point &p0, const point &p1,
+				  const point &p2, TriMesh::NormWeight weight,
+				  vec *n)
+{
+	vec a = p0-p1, b = p1-p2, c = p2-p0;
+	float l2a = len2(a), l2b = len2(b), l2c = len2(c);
+	if (!l2a || !l2b || !l2c)
+		return false;
+	vec facenormal = a CROSS b;
+
+	if (weight == TriMesh::NORM_AREA) {
+		// Length of facenormal is twice the area
+		n[0] = n[1] = n[2] = facenormal;
+	} else if (weight == TriMesh::NORM_ANGLE) {
+		float l = len(facenormal);
+		if (!l)
+			return false;
+		vec fn = facenormal / l;
+		n[0] = fn * atan2(l, -(a DOT c));
+		n[1] = fn * atan2(l, -(b DOT a));
+		n[2] = fn * atan2(l, -(c DOT b));
+	} else {
+		n[0] = facenormal * (1.0f / (l2a * l2c));
+		n[1] = facenormal * (1.0f / (l2b * l2a));
+		n[2] = facenormal * (1.0f / (l2c * l2b));
+	}
+	return true;
+}
+
+
 // Compute per-vertex normals
-void TriMesh::need_normals()
+void TriMesh::need_normals(NormWeight weight /* = NORM_MAX */)
 {
-	// Nothing to do if we already have normals
-	int nv = vertices.size();
-	if (int(normals.size()) == nv)
-		return;
+	// Nothing to do if we already have normals, and only a little to do
+	// if just a few vertices have moved since they were computed.  Normals
+	// computed with a different weighting are redone from scratch, but
+	// ones that came from elsewhere are kept until something moves.
+	index_t nv = vertices.size();
+	if (index_t(normals.size()) == nv) {
+		bool same_weight = (normals_weight == weight);
+		if (normals_version == version &&
+		    (same_weight || normals_weight < 0))
+			return;
+		vector<index_t> verts;
+		if (same_weight && tstrips.empty() && !faces.empty() &&
+		    dirty_verts(normals_version, 1, verts)) {
+			update_normals(verts, weight);
+			normals_version = version;
+			return;
+		}
+	}
+	normals_version = version;
+	normals_weight = weight;
+	normals_full++;
 
 	dprintf("Computing normals... ");
 	normals.clear();
@@ -40,54 +95,82 @@ void TriMesh::need_normals()
 	// TODO: direct handling of grids
 	if (!tstrips.empty()) {
 		// Compute from tstrips
-		const int *t = &tstrips[0], *end = t + tstrips.size();
+		const index_t *t = &tstrips[0], *end = t + tstrips.size();
 		while (likely(t < end)) {
-			int striplen = *t - 2;
+			index_t striplen = *t - 2;
 			t += 3;
 			bool flip = false;
-			for (int i = 0; i < striplen; i++, t++, flip = !flip) {
-				const point &p0 = vertices[*(t-2)];
-				const point &p1 = vertices[*(t-1)];
-				const point &p2 = vertices[* t   ];
-				vec a = p0-p1, b = p1-p2, c = p2-p0;
-				float l2a = len2(a), l2b = len2(b), l2c = len2(c);
-				if (!l2a || !l2b || !l2c)
+			for (index_t i = 0; i < striplen; i++, t++, flip = !flip) {
+				// Odd triangles are reversed
+				index_t v0 = flip ? *(t-1) : *(t-2);
+				index_t v1 = flip ? *(t-2) : *(t-1);
+				index_t v2 = *t;
+				vec n[3];
+				if (!corner_normals(vertices[v0], vertices[v1],
+						    vertices[v2], weight, n))
 					continue;
-				vec facenormal = flip ? (b CROSS a) : (a CROSS b);
-				normals[*(t-2)] += facenormal * (1.0f / (l2a * l2c));
-				normals[*(t-1)] += facenormal * (1.0f / (l2b * l2a));
-				normals[* t   ] += facenormal * (1.0f / (l2c * l2b));
+				normals[v0] += n[0];
+				normals[v1] += n[1];
+				normals[v2] += n[2];
 			}
 		}
 	} else if (need_faces(), !faces.empty()) {
-		// Compute from faces
-		int nf = faces.size();
+		// Compute from faces: the contribution of each corner, then
+		// a sum over the faces at each vertex.  With only one thread,
+		// scattering from each face in turn adds things up in the same
+		// order, and is faster.
+		index_t nf = faces.size();
+#ifdef _OPENMP
+		if (omp_get_max_threads() == 1) {
+#endif
+			for (index_t i = 0; i < nf; i++) {
+				vec n[3];
+				if (!corner_normals(vertices[faces[i][0]],
+						    vertices[faces[i][1]],
+						    vertices[faces[i][2]],
+						    weight, n))
+					continue;
+				normals[faces[i][0]] += n[0];
+				normals[faces[i][1]] += n[1];
+				normals[faces[i][2]] += n[2];
+			}
+#ifdef _OPENMP
+		} else {
+			need_adjacentfaces();
+			vector<vec> cornernormals(3 * nf);
 #pragma omp parallel for
-		for (int i = 0; i < nf; i++) {
-			const point &p0 = vertices[faces[i][0]];
-			const point &p1 = vertices[faces[i][1]];
-			const point &p2 = vertices[faces[i][2]];
-			vec a = p0-p1, b = p1-p2, c = p2-p0;
-			float l2a = len2(a), l2b = len2(b), l2c = len2(c);
-			if (!l2a || !l2b || !l2c)
-				continue;
-			vec facenormal = a CROSS b;
-			normals[faces[i][0]] += facenormal * (1.0f / (l2a * l2c));
-			normals[faces[i][1]] += facenormal * (1.0f / (l2b * l2a));
-			normals[faces[i][2]] += facenormal * (1.0f / (l2c * l2b));
+			for (index_t i = 0; i < nf; i++) {
+				corner_normals(vertices[faces[i][0]],
+					       vertices[faces[i][1]],
+					       vertices[faces[i][2]],
+					       weight, &cornernormals[3*i]);
+			}
+#pragma omp parallel for
+			for (index_t i = 0; i < nv; i++) {
+				// Faces that touch a vertex more than once
+				// are degenerate, and contribute nothing
+				Adjacency::Row a = adjacentfaces[i];
+				for (size_t k = 0; k < a.size(); k++) {
+					index_t f = a[k];
+					int j = faces[f].indexof(i);
+					normals[i] += cornernormals[3*f + j];
+				}
+			}
 		}
+#endif
 	} else {
 		// Find normals of a point cloud
 		const int k = 6;
 		const vec ref(0, 0, 1);
 		KDtree kd(vertices);
 #pragma omp parallel for
-		for (int i = 0; i < nv; i++) {
+		for (index_t i = 0; i < nv; i++) {
 			vector<const float *> knn;
 			kd.find_k_closest_to_pt(knn, k, vertices[i]);
 			int actual_k = knn.size();
 			if (actual_k < 3) {
-				dprintf("Warning: not enough points for vertex %d\n", i);
+				dprintf("Warning: not enough points for vertex %lld\n",
+					(long long) i);
 				normals[i] = ref;
 				continue;
 			}
@@ -111,12 +194,37 @@ void TriMesh::need_normals()
 
 	// Make them all unit-length
 #pragma omp parallel for
-	for (int i = 0; i < nv; i++)
+	for (index_t i = 0; i < nv; i++)
 		normalize(normals[i]);
 
 	dprintf("Done.\n");
 }
 
+// Recompute the normals of just the given vertices, with the same result
+// as recomputing everything
+void TriMesh::update_normals(const vector<index_t> &verts, NormWeight weight)
+{
+	dprintf("Updating %lld normals... ", (long long) verts.size());
+	index_t n = verts.size();
+#pragma omp parallel for
+	for (index_t k = 0; k < n; k++) {
+		index_t i = verts[k];
+		vec sum;
+		Adjacency::Row a = adjacentfaces[i];
+		for (size_t j = 0; j < a.size(); j++) {
+			const Face &f = faces[a[j]];
+			vec cn[3];
+			if (corner_normals(vertices[f[0]], vertices[f[1]],
+					   vertices[f[2]], weight, cn))
+				sum += cn[f.indexof(i)];
+		}
+		normals[i] = sum;
+		normalize(normals[i]);
+	}
+	dprintf("Done.\n");
+}
+
+
 void TriMesh::need_uv_dirs()
  {
      if (texcoords.empty() || 
@@ -124,16 +232,20 @@ void TriMesh::need_uv_dirs()
          (need_normals(), normals.empty()))
          return;
  
-     int nv = vertices.size();
+     index_t nv = vertices.size();
  	udirs.clear();
  	vdirs.clear();
  	udirs.resize(nv);
  	vdirs.resize(nv);
  	
-     // Compute from faces
-     int nf = faces.size();
+     // Compute gradients per face, then sum them over the faces at
+     // each vertex
+     need_adjacentfaces();
+     index_t nf = faces.size();
+     vector<vec> fgu(nf), fgv(nf);
+     vector<float> cornerw(3 * nf);
  #pragma omp parallel for
-     for (int i = 0; i < nf; i++) {
+     for (index_t i = 0; i < nf; i++) {
          const point &p0 = vertices[faces[i][0]];
          const point &p1 = vertices[faces[i][1]];
          const point &p2 = vertices[faces[i][2]];
@@ -163,19 +275,28 @@ void TriMesh::need_uv_dirs()
          float fgt_v = ((uv2[1] - uv0[1]) - fgs_v * c_s) / c_t;
          vec fg_v = s * fgs_v + t * fgt_v;
  
-         udirs[faces[i][0]] += fg_u * (1.0f / (l2a * l2c));
-         udirs[faces[i][1]] += fg_u * (1.0f / (l2b * l2a));
-         udirs[faces[i][2]] += fg_u * (1.0f / (l2c * l2b));
-         vdirs[faces[i][0]] += fg_v * (1.0f / (l2a * l2c));
-         vdirs[faces[i][1]] += fg_v * (1.0f / (l2b * l2a));
-         vdirs[faces[i][2]] += fg_v * (1.0f / (l2c * l2b));
+         fgu[i] = fg_u;
+         fgv[i] = fg_v;
+         cornerw[3*i  ] = 1.0f / (l2a * l2c);
+         cornerw[3*i+1] = 1.0f / (l2b * l2a);
+         cornerw[3*i+2] = 1.0f / (l2c * l2b);
+     }
+ #pragma omp parallel for
+     for (index_t i = 0; i < nv; i++) {
+         Adjacency::Row a = adjacentfaces[i];
+         for (size_t k = 0; k < a.size(); k++) {
+             index_t f = a[k];
+             float w = cornerw[3*f + faces[f].indexof(i)];
+             udirs[i] += fgu[f] * w;
+             vdirs[i] += fgv[f] * w;
+         }
      }
  
      // Project and renormalize so normal, u, and v dirs are
      // all orthogonal.
  
  #pragma omp parallel for
- 	for (int i = 0; i < nv; i++) {
+ 	for (index_t i = 0; i < nv; i++) {
          udirs[i] -= normals[i] * (udirs[i] DOT normals[i]);
          normalize(udirs[i]);
  		/*vdirs[i] -= normals[i] * (vdirs[i] DOT normals[i]);
@@ -9,72 +9,154 @@ a vertex, or to the triangle).
 */
 
 #include "TriMesh.h"
+#include <algorithm>
+#ifdef _OPENMP
+# include <omp.h>
+#endif
+using namespace std;
 
 
 namespace trimesh {
 
+// Compute the corner areas of face i
+static inline void corner_areas(const TriMesh *mesh, index_t i, vec &ca)
+{
+	const vector<point> &vertices = mesh->vertices;
+	const TriMesh::Face &f = mesh->faces[i];
+
+	// Edges
+	vec e[3] = { vertices[f[2]] - vertices[f[1]],
+		     vertices[f[0]] - vertices[f[2]],
+		     vertices[f[1]] - vertices[f[0]] };
+
+	// Compute corner weights
+	float area = 0.5f * len(e[0] CROSS e[1]);
+	float l2[3] = { len2(e[0]), len2(e[1]), len2(e[2]) };
+	float ew[3] = { l2[0] * (l2[1] + l2[2] - l2[0]),
+			l2[1] * (l2[2] + l2[0] - l2[1]),
+			l2[2] * (l2[0] + l2[1] - l2[2]) };
+	if (ew[0] <= 0.0f) {
+		ca[1] = -0.25f * l2[2] * area / (e[0] DOT e[2]);
+		ca[2] = -0.25f * l2[1] * area / (e[0] DOT e[1]);
+		ca[0] = area - ca[1] - ca[2];
+	} else if (ew[1] <= 0.0f) {
+		ca[2] = -0.25f * l2[0] * area / (e[1] DOT e[0]);
+		ca[0] = -0.25f * l2[2] * area / (e[1] DOT e[2]);
+		ca[1] = area - ca[2] - ca[0];
+	} else if (ew[2] <= 0.0f) {
+		ca[0] = -0.25f * l2[1] * area / (e[2] DOT e[1]);
+		ca[1] = -0.25f * l2[0] * area / (e[2] DOT e[0]);
+		ca[2] = area - ca[0] - ca[1];
+	} else {
+		float ewscale = 0.5f * area / (ew[0] + ew[1] + ew[2]);
+		for (int j = 0; j < 3; j++)
+			ca[j] = ewscale * (ew[(j+1)%3] + ew[(j+2)%3]);
+	}
+}
+
+
+// Sum the corner areas of the faces around vertex i, in face order
+static inline float gather_pointarea(const TriMesh *mesh, index_t i)
+{
+	float sum = 0;
+	TriMesh::Adjacency::Row a = mesh->adjacentfaces[i];
+	int j = -1;
+	for (size_t k = 0; k < a.size(); k++) {
+		index_t f = a[k];
+		// A degenerate face has this vertex at more than one corner,
+		// and is listed once per corner
+		if (k && f == a[k-1]) {
+			do {
+				j++;
+			} while (mesh->faces[f][j] != i);
+		} else {
+			j = mesh->faces[f].indexof(i);
+		}
+		sum += mesh->cornerareas[f][j];
+	}
+	return sum;
+}
+
+
 // Compute per-vertex point areas
 void TriMesh::need_pointareas()
 {
-	if (pointareas.size() == vertices.size())
-		return;
+	index_t nf = faces.size(), nv = vertices.size();
+	if (index_t(pointareas.size()) == nv) {
+		if (pointareas_version == version)
+			return;
+		vector<index_t> verts;
+		if (index_t(cornerareas.size()) == nf &&
+		    dirty_verts(pointareas_version, 0, verts)) {
+			update_pointareas(verts);
+			pointareas_version = version;
+			return;
+		}
+	}
+	pointareas_version = version;
 	need_faces();
 
 	dprintf("Computing point areas... ");
 
-	int nf = faces.size(), nv = vertices.size();
+	nf = faces.size();
 	pointareas.clear();
 	pointareas.resize(nv);
 	cornerareas.clear();
 	cornerareas.resize(nf);
 
-#pragma omp parallel for
-	for (int i = 0; i < nf; i++) {
-		// Edges
-		vec e[3] = { vertices[faces[i][2]] - vertices[faces[i][1]],
-			     vertices[faces[i][0]] - vertices[faces[i][2]],
-			     vertices[faces[i][1]] - vertices[faces[i][0]] };
-
-		// Compute corner weights
-		float area = 0.5f * len(e[0] CROSS e[1]);
-		float l2[3] = { len2(e[0]), len2(e[1]), len2(e[2]) };
-		float ew[3] = { l2[0] * (l2[1] + l2[2] - l2[0]),
-				l2[1] * (l2[2] + l2[0] - l2[1]),
-				l2[2] * (l2[0] + l2[1] - l2[2]) };
-		if (ew[0] <= 0.0f) {
-			cornerareas[i][1] = -0.25f * l2[2] * area /
-					    (e[0] DOT e[2]);
-			cornerareas[i][2] = -0.25f * l2[1] * area /
-					    (e[0] DOT e[1]);
-			cornerareas[i][0] = area - cornerareas[i][1] -
-					    cornerareas[i][2];
-		} else if (ew[1] <= 0.0f) {
-			cornerareas[i][2] = -0.25f * l2[0] * area /
-					    (e[1] DOT e[0]);
-			cornerareas[i][0] = -0.25f * l2[2] * area /
-					    (e[1] DOT e[2]);
-			cornerareas[i][1] = area - cornerareas[i][2] -
-					    cornerareas[i][0];
-		} else if (ew[2] <= 0.0f) {
-			cornerareas[i][0] = -0.25f * l2[1] * area /
-					    (e[2] DOT e[1]);
-			cornerareas[i][1] = -0.25f * l2[0] * area /
-					    (e[2] DOT e[0]);
-			cornerareas[i][2] = area - cornerareas[i][0] -
-					    cornerareas[i][1];
-		} else {
-			float ewscale = 0.5f * area / (ew[0] + ew[1] + ew[2]);
-			for (int j = 0; j < 3; j++)
-				cornerareas[i][j] = ewscale * (ew[(j+1)%3] +
-							       ew[(j+2)%3]);
+	// With only one thread, scattering from each face in turn adds
+	// things up in the same order as a gather at each vertex
+#ifdef _OPENMP
+	if (omp_get_max_threads() == 1) {
+#endif
+		for (index_t i = 0; i < nf; i++) {
+			corner_areas(this, i, cornerareas[i]);
+			pointareas[faces[i][0]] += cornerareas[i][0];
+			pointareas[faces[i][1]] += cornerareas[i][1];
+			pointareas[faces[i][2]] += cornerareas[i][2];
 		}
-#pragma omp atomic
-		pointareas[faces[i][0]] += cornerareas[i][0];
-#pragma omp atomic
-		pointareas[faces[i][1]] += cornerareas[i][1];
-#pragma omp atomic
-		pointareas[faces[i][2]] += cornerareas[i][2];
+#ifdef _OPENMP
+	} else {
+#pragma omp parallel for
+		for (index_t i = 0; i < nf; i++)
+			corner_areas(this, i, cornerareas[i]);
+		need_adjacentfaces();
+#pragma omp parallel for
+		for (index_t i = 0; i < nv; i++)
+			pointareas[i] = gather_pointarea(this, i);
+	}
+#endif
+
+	dprintf("Done.\n");
+}
+
+
+// Recompute the corner areas of faces touching the given (moved) vertices,
+// and the point areas of all the vertices of those faces
+void TriMesh::update_pointareas(const vector<index_t> &verts)
+{
+	vector<index_t> f;
+	faces_of(verts, f);
+	dprintf("Updating %lld corner areas... ", (long long) f.size());
+
+	index_t n = f.size();
+#pragma omp parallel for
+	for (index_t k = 0; k < n; k++)
+		corner_areas(this, f[k], cornerareas[f[k]]);
+
+	vector<index_t> fverts(verts);
+	for (index_t k = 0; k < n; k++) {
+		fverts.push_back(faces[f[k]][0]);
+		fverts.push_back(faces[f[k]][1]);
+		fverts.push_back(faces[f[k]][2]);
 	}
+	sort(fverts.begin(), fverts.end());
+	fverts.erase(unique(fverts.begin(), fverts.end()), fverts.end());
+
+	n = fverts.size();
+#pragma omp parallel for
+	for (index_t k = 0; k < n; k++)
+		pointareas[fverts[k]] = gather_pointarea(this, fverts[k]);
 
 	dprintf("Done.\n");
 }
@@ -10,16 +10,13 @@ manipulations on them.  utilsrc/mesh_cc is a front-end for this code.
 #include "TriMesh.h"
 #include "TriMesh_algo.h"
 #include <vector>
-#include <stack>
+#if defined(_MSC_VER)
+# include <intrin.h>
+#endif
 using namespace std;
 
 
 #define NO_COMP -1
-#define FOR_EACH_ADJACENT_FACE(mesh,v,f) \
-	for (size_t f_ind = 0, f = mesh->adjacentfaces[v][0]; \
-	     (f_ind < mesh->adjacentfaces[v].size()) && \
-	     ((f = mesh->adjacentfaces[v][f_ind]) || 1); \
-	     f_ind++)
 
 
 namespace trimesh {
@@ -33,7 +30,7 @@ private:
 public:
 	CompareArrayElements(const Array &_a) : a(_a)
 		{}
-	bool operator () (int i1, int i2) const
+	bool operator () (index_t i1, index_t i2) const
 	{
 		return (a[i1] > a[i2]);
 	}
@@ -41,10 +38,12 @@ public:
 
 
 // Are two faces connected along an edge (or vertex)?
-static bool connected(const TriMesh *mesh, int f1, int f2, bool conn_vert)
+static bool connected(const TriMesh *mesh, index_t f1, index_t f2,
+		      bool conn_vert)
 {
-	int f10=mesh->faces[f1][0], f11=mesh->faces[f1][1], f12=mesh->faces[f1][2];
-	int f20=mesh->faces[f2][0], f21=mesh->faces[f2][1], f22=mesh->faces[f2][2];
+	const TriMesh::Face &F1 = mesh->faces[f1], &F2 = mesh->faces[f2];
+	index_t f10 = F1[0], f11 = F1[1], f12 = F1[2];
+	index_t f20 = F2[0], f21 = F2[1], f22 = F2[2];
 
 	if (conn_vert)
 		return f10 == f20 || f10 == f21 || f10 == f22 ||
@@ -60,26 +59,112 @@ static bool connected(const TriMesh *mesh, int f1, int f2, bool conn_vert)
 }
 
 
-// Helper function for find_comps, below.  Finds and marks all the faces
-// connected to f.
-static void find_connected(const TriMesh *mesh,
-			   vector<int> &comps, vector<int> &compsizes,
-			   int f, int whichcomponent, bool conn_vert)
+// Union-find over faces, safe to call from many threads at once.  Each
+// element's parent is never greater than the element itself, so no cycles
+// can form.  Roots are hooked with a compare-and-swap, so a link is never
+// lost to another thread hooking the same root, and one pass finds every
+// component.
+static inline index_t find_root(index_t *parent, index_t x)
 {
-	stack<int> s;
-	s.push(f);
-	while (!s.empty()) {
-		int currface = s.top();
-		s.pop();
-		for (int i = 0; i < 3; i++) {
-			int vert = mesh->faces[currface][i];
-			FOR_EACH_ADJACENT_FACE(mesh, vert, adjface) {
-				if (comps[adjface] != NO_COMP ||
-				    !connected(mesh, adjface, currface, conn_vert))
-					continue;
-				comps[adjface] = whichcomponent;
-				compsizes[whichcomponent]++;
-				s.push(adjface);
+	for (;;) {
+		index_t p, gp;
+#pragma omp atomic read
+		p = parent[x];
+		if (p == x)
+			return x;
+#pragma omp atomic read
+		gp = parent[p];
+		if (gp != p) {
+			// Path halving
+#pragma omp atomic write
+			parent[x] = gp;
+		}
+		x = gp;
+	}
+}
+
+// Make root a point to b, unless a has stopped being a root.  Returns
+// whether it did.
+#if defined(__GNUC__)
+static inline bool hook(index_t *parent, index_t a, index_t b)
+{
+	return __sync_bool_compare_and_swap(&parent[a], a, b);
+}
+#elif defined(_MSC_VER)
+static inline bool hook(index_t *parent, index_t a, index_t b)
+{
+# ifdef TRIMESH_INDEX64
+	return _InterlockedCompareExchange64((volatile __int64 *) &parent[a],
+		b, a) == a;
+# else
+	return _InterlockedCompareExchange((volatile long *) &parent[a],
+		b, a) == a;
+# endif
+}
+#else
+static inline bool hook(index_t *parent, index_t a, index_t b)
+{
+	bool hooked = false;
+#pragma omp critical (conn_comps_hook)
+	{
+		// Path halving never writes to a root, so this can't race
+		// with it
+		index_t p;
+#pragma omp atomic read
+		p = parent[a];
+		if (p == a) {
+#pragma omp atomic write
+			parent[a] = b;
+			hooked = true;
+		}
+	}
+	return hooked;
+}
+#endif
+
+static inline void unite(index_t *parent, index_t a, index_t b)
+{
+	for (;;) {
+		a = find_root(parent, a);
+		b = find_root(parent, b);
+		if (a == b)
+			return;
+		if (a < b)
+			swap(a, b);
+		// If another thread hooked a first, start over from its
+		// new root
+		if (hook(parent, a, b))
+			return;
+	}
+}
+
+
+// Helper function for find_comps, below.  Joins each face to the faces it
+// touches.
+static void join_faces(const TriMesh *mesh, index_t *parent, bool conn_vert)
+{
+	if (conn_vert) {
+		index_t nv = mesh->vertices.size();
+#pragma omp parallel for
+		for (index_t i = 0; i < nv; i++) {
+			TriMesh::Adjacency::Row a = mesh->adjacentfaces[i];
+			for (size_t j = 1; j < a.size(); j++)
+				unite(parent, a[0], a[j]);
+		}
+	} else {
+		index_t nf = mesh->faces.size();
+#pragma omp parallel for
+		for (index_t i = 0; i < nf; i++) {
+			for (int k = 0; k < 3; k++) {
+				index_t vert = mesh->faces[i][k];
+				TriMesh::Adjacency::Row a = mesh->adjacentfaces[vert];
+				for (size_t j = 0; j < a.size(); j++) {
+					index_t adjface = a[j];
+					if (adjface <= i ||
+					    !connected(mesh, adjface, i, false))
+						continue;
+					unite(parent, i, adjface);
+				}
 			}
 		}
 	}
@@ -89,22 +174,22 @@ static void find_connected(const TriMesh *mesh,
 // Helper function for find_comps, below.  Sorts the connected components
 // from largest to smallest.  Renumbers the elements of compsizes to
 // reflect this new numbering.
-static void sort_comps(vector<int> &comps, vector<int> &compsizes)
+static void sort_comps(vector<index_t> &comps, vector<index_t> &compsizes)
 {
-	vector<int> comp_pointers(compsizes.size());
+	vector<index_t> comp_pointers(compsizes.size());
 	for (size_t i = 0; i < comp_pointers.size(); i++)
 		comp_pointers[i] = i;
 
 	sort(comp_pointers.begin(), comp_pointers.end(),
-	     CompareArrayElements< vector<int> >(compsizes));
+	     CompareArrayElements< vector<index_t> >(compsizes));
 
-	vector<int> remap_table(comp_pointers.size());
+	vector<index_t> remap_table(comp_pointers.size());
 	for (size_t i = 0; i < comp_pointers.size(); i++)
 		remap_table[comp_pointers[i]] = i;
 	for (size_t i = 0; i < comps.size(); i++)
 		comps[i] = remap_table[comps[i]];
 
-	vector<int> newcompsizes(compsizes.size());
+	vector<index_t> newcompsizes(compsizes.size());
 	for (size_t i = 0; i < compsizes.size(); i++)
 		newcompsizes[i] = compsizes[comp_pointers[i]];
 	compsizes = newcompsizes;
@@ -119,8 +204,8 @@ static void sort_comps(vector<int> &comps, vector<int> &compsizes)
 //   associated connected component.
 //  compsizes holds the size of each connected component.
 // Connected components are sorted from largest to smallest.
-void find_comps(TriMesh *mesh, vector<int> &comps, vector<int> &compsizes,
-		bool conn_vert /* = false */)
+void find_comps(TriMesh *mesh, vector<index_t> &comps,
+		vector<index_t> &compsizes, bool conn_vert /* = false */)
 {
 	if (mesh->vertices.empty())
 		return;
@@ -129,19 +214,34 @@ void find_comps(TriMesh *mesh, vector<int> &comps, vector<int> &compsizes,
 		return;
 	mesh->need_adjacentfaces();
 
-	int nf = mesh->faces.size();
+	index_t nf = mesh->faces.size();
+	vector<index_t> parent(nf);
+	for (index_t i = 0; i < nf; i++)
+		parent[i] = i;
+	join_faces(mesh, &parent[0], conn_vert);
+
+	// Each component's root is its lowest-numbered face.  Number the
+	// components in order of their roots, then label the faces.
 	comps.clear();
-	comps.reserve(nf);
-	comps.resize(nf, NO_COMP);
-	compsizes.clear();
+	comps.resize(nf);
+#pragma omp parallel for
+	for (index_t i = 0; i < nf; i++)
+		comps[i] = find_root(&parent[0], i);
+
+	vector<index_t> label(nf, NO_COMP);
+	index_t ncomps = 0;
+	for (index_t i = 0; i < nf; i++)
+		if (comps[i] == i)
+			label[i] = ncomps++;
 
-	for (int i = 0; i < nf; i++) {
-		if (comps[i] != NO_COMP)
-			continue;
-		int comp = compsizes.size();
+	compsizes.clear();
+	compsizes.resize(ncomps);
+#pragma omp parallel for
+	for (index_t i = 0; i < nf; i++) {
+		index_t comp = label[comps[i]];
 		comps[i] = comp;
-		compsizes.push_back(1);
-		find_connected(mesh, comps, compsizes, i, comp, conn_vert);
+#pragma omp atomic
+		compsizes[comp]++;
 	}
 
 	if (compsizes.size() > 1)
@@ -151,11 +251,11 @@ void find_comps(TriMesh *mesh, vector<int> &comps, vector<int> &compsizes,
 
 // Select a particular connected component, and delete all other vertices from
 // the mesh.
-void select_comp(TriMesh *mesh, const vector<int> &comps, int whichcc)
+void select_comp(TriMesh *mesh, const vector<index_t> &comps, index_t whichcc)
 {
-	int numfaces = mesh->faces.size();
+	index_t numfaces = mesh->faces.size();
 	vector<bool> toremove(numfaces, false);
-	for (int i = 0; i < numfaces; i++) {
+	for (index_t i = 0; i < numfaces; i++) {
 		if (comps[i] != whichcc)
 			toremove[i] = true;
 	}
@@ -169,18 +269,19 @@ void select_comp(TriMesh *mesh, const vector<int> &comps, int whichcc)
 // total_largest components), and delete all other vertices from the mesh.
 // Updates comps and compsizes.
 void select_big_comps(TriMesh *mesh,
-		      const vector<int> &comps, const vector<int> &compsizes,
-		      int min_size,
-		      int total_largest /* = std::numeric_limits<int>::max() */)
+		      const vector<index_t> &comps,
+		      const vector<index_t> &compsizes,
+		      index_t min_size,
+		      index_t total_largest /* = numeric_limits<index_t>::max() */)
 {
-	int ncomp = compsizes.size();
-	int keep_last = min(ncomp - 1, total_largest - 1);
+	index_t ncomp = compsizes.size();
+	index_t keep_last = min(ncomp - 1, total_largest - 1);
 	while (keep_last > -1 && compsizes[keep_last] < min_size)
 		keep_last--;
 
-	int numfaces = mesh->faces.size();
+	index_t numfaces = mesh->faces.size();
 	vector<bool> toremove(numfaces, false);
-	for (int i = 0; i < numfaces; i++) {
+	for (index_t i = 0; i < numfaces; i++) {
 		if (comps[i] > keep_last)
 			toremove[i] = true;
 	}
@@ -193,18 +294,19 @@ void select_big_comps(TriMesh *mesh,
 // Select the connected components no bigger than max_size (but no more than
 // total_smallest components), and delete all other vertices from the mesh.
 void select_small_comps(TriMesh *mesh,
-			const vector<int> &comps, const vector<int> &compsizes,
-			int max_size,
-			int total_smallest /* = std::numeric_limits<int>::max() */)
+			const vector<index_t> &comps,
+			const vector<index_t> &compsizes,
+			index_t max_size,
+			index_t total_smallest /* = numeric_limits<index_t>::max() */)
 {
-	int ncomp = compsizes.size();
-	int keep_first = max(0, ncomp - total_smallest);
+	index_t ncomp = compsizes.size();
+	index_t keep_first = max(index_t(0), ncomp - total_smallest);
 	while (keep_first < ncomp && compsizes[keep_first] > max_size)
 		keep_first++;
 
-	int numfaces = mesh->faces.size();
+	index_t numfaces = mesh->faces.size();
 	vector<bool> toremove(numfaces, false);
-	for (int i = 0; i < numfaces; i++) {
+	for (index_t i = 0; i < numfaces; i++) {
 		if (comps[i] < keep_first)
 			toremove[i] = true;
 	}
@@ -0,0 +1,489 @@
+/*
+Szymon Rusinkiewicz
+Princeton University
+
+decimate.cc
+Mesh simplification by edge collapses, ordered by quadric error, as in
+  M. Garland and P. Heckbert,
+  "Surface Simplification Using Quadric Error Metrics",
+  SIGGRAPH 1997,
+with vertex colors handled as in
+  M. Garland and P. Heckbert,
+  "Simplifying Surfaces with Color and Texture using Quadric Error Metrics",
+  IEEE Visualization 1998.
+*/
+
+#include "TriMesh.h"
+#include "TriMesh_algo.h"
+#include "HalfEdge.h"
+#include <algorithm>
+using namespace std;
+#define dprintf TriMesh::dprintf
+
+
+// i+1 and i-1 modulo 3
+#define NEXT(i) ((i)<2 ? (i)+1 : (i)-2)
+#define PREV(i) ((i)>0 ? (i)-1 : (i)+2)
+
+
+// Weight of the planes through boundary edges, relative to a face with the
+// same squared edge length
+#define DECIMATE_BOUNDARY_WEIGHT 1000.0f
+
+// Each batch of collapses is chosen from the cheapest 1/DECIMATE_BATCH of
+// the candidates, so that a batch doesn't stray far from the greedy order
+#define DECIMATE_BATCH 4
+
+// Largest dimension of a quadric: position and color
+#define QMAX 6
+
+
+namespace trimesh {
+
+// Per-vertex quadrics, over position and (if the mesh has them) colors.
+// Each is stored as the upper triangle of A, then b, c, and the total area
+// of the faces that went into it: the error at x is x'Ax + 2b'x + c.
+struct Quadrics {
+	int n, size;
+	float color_scale;
+	vector<double> q;
+
+	double *operator [] (index_t i)
+		{ return &q[size * i]; }
+	const double *operator [] (index_t i) const
+		{ return &q[size * i]; }
+};
+
+
+// The point in quadric space for vertex i
+static inline void quadric_coords(const TriMesh *mesh, const Quadrics &Q,
+	index_t i, double *x)
+{
+	for (int j = 0; j < 3; j++)
+		x[j] = mesh->vertices[i][j];
+	if (Q.n > 3) {
+		for (int j = 0; j < 3; j++)
+			x[3+j] = Q.color_scale * mesh->colors[i][j];
+	}
+}
+
+
+// Add w times the quadric for the distance to the plane (in n dimensions)
+// through p spanned by unit vectors e1 and e2 (if e2 is NULL, just e1:
+// the hyperplane with normal e1).
+static void add_plane(int n, double *Q, const double *p,
+	const double *e1, const double *e2, double w)
+{
+	double pe1 = 0, pe2 = 0, pp = 0;
+	for (int j = 0; j < n; j++) {
+		pe1 += p[j] * e1[j];
+		if (e2)
+			pe2 += p[j] * e2[j];
+		pp += p[j] * p[j];
+	}
+
+	double *A = Q, *b = Q + n * (n + 1) / 2, *c = b + n;
+	if (!e2) {
+		// Hyperplane: A = e1 e1', b = -(p.e1) e1, c = (p.e1)^2
+		for (int j = 0, k = 0; j < n; j++)
+			for (int l = j; l < n; l++, k++)
+				A[k] += w * e1[j] * e1[l];
+		for (int j = 0; j < n; j++)
+			b[j] -= w * pe1 * e1[j];
+		*c += w * pe1 * pe1;
+		return;
+	}
+
+	// Plane: A = I - e1 e1' - e2 e2', b = (p.e1) e1 + (p.e2) e2 - p,
+	// c = p.p - (p.e1)^2 - (p.e2)^2
+	for (int j = 0, k = 0; j < n; j++)
+		for (int l = j; l < n; l++, k++)
+			A[k] += w * ((j == l) - e1[j] * e1[l] - e2[j] * e2[l]);
+	for (int j = 0; j < n; j++)
+		b[j] += w * (pe1 * e1[j] + pe2 * e2[j] - p[j]);
+	*c += w * (pp - pe1 * pe1 - pe2 * pe2);
+}
+
+
+// Error of quadric Q at x
+static inline double quadric_error(int n, const double *Q, const double *x)
+{
+	const double *A = Q, *b = Q + n * (n + 1) / 2, *c = b + n;
+	double err = *c;
+	for (int j = 0, k = 0; j < n; j++) {
+		double s = A[k++] * x[j];
+		for (int l = j + 1; l < n; l++)
+			s += 2.0 * A[k++] * x[l];
+		err += x[j] * (s + 2.0 * b[j]);
+	}
+	return err;
+}
+
+
+// Find the quadric at each vertex: the planes of the faces around it,
+// weighted by area, and the planes perpendicular to them along boundary
+// edges.
+static void find_quadrics(const HalfEdge &he, Quadrics &Q)
+{
+	TriMesh *mesh = he.mesh;
+	const vector<TriMesh::Face> &faces = mesh->faces;
+	index_t nv = mesh->vertices.size();
+	Q.n = mesh->colors.empty() ? 3 : 6;
+	Q.size = Q.n * (Q.n + 1) / 2 + Q.n + 2;
+	Q.color_scale = (Q.n > 3) ? mesh->feature_size() : 0.0f;
+	Q.q.clear();
+	Q.q.resize(Q.size * nv);
+	mesh->need_adjacentfaces();
+	int n = Q.n;
+
+#pragma omp parallel for
+	for (index_t i = 0; i < nv; i++) {
+		double *q = Q[i];
+		TriMesh::Adjacency::Row a = mesh->adjacentfaces[i];
+		for (size_t k = 0; k < a.size(); k++) {
+			index_t f = a[k];
+			// Degenerate faces are listed more than once, and
+			// don't have a plane anyway
+			if (k && f == a[k-1])
+				continue;
+			const TriMesh::Face &face = faces[f];
+			int j = face.indexof(i);
+			vec fn = trinorm(mesh->vertices[face[0]],
+					 mesh->vertices[face[1]],
+					 mesh->vertices[face[2]]);
+			double area = len(fn);
+			if (area == 0.0)
+				continue;
+
+			double p[QMAX], p1[QMAX], p2[QMAX], e1[QMAX], e2[QMAX];
+			quadric_coords(mesh, Q, face[j], p);
+			quadric_coords(mesh, Q, face[NEXT(j)], p1);
+			quadric_coords(mesh, Q, face[PREV(j)], p2);
+			double l1 = 0, d = 0, l2 = 0;
+			for (int c = 0; c < n; c++) {
+				e1[c] = p1[c] - p[c];
+				l1 += e1[c] * e1[c];
+			}
+			l1 = sqrt(l1);
+			for (int c = 0; c < n; c++) {
+				e1[c] /= l1;
+				d += (p2[c] - p[c]) * e1[c];
+			}
+			for (int c = 0; c < n; c++) {
+				e2[c] = p2[c] - p[c] - d * e1[c];
+				l2 += e2[c] * e2[c];
+			}
+			l2 = sqrt(l2);
+			if (l2 == 0.0)
+				continue;
+			for (int c = 0; c < n; c++)
+				e2[c] /= l2;
+			add_plane(n, q, p, e1, e2, area);
+			q[Q.size - 1] += area;
+
+			// Boundary edges starting or ending here
+			normalize(fn);
+			for (int e = 0; e < 2; e++) {
+				index_t h = 3 * f + (e ? PREV(j) : j);
+				if (!he.is_bdy_edge(h))
+					continue;
+				const point &v1 = mesh->vertices[he.from(h)];
+				const point &v2 = mesh->vertices[he.to(h)];
+				vec m = (v2 - v1) CROSS fn;
+				normalize(m);
+				double mm[QMAX] = { m[0], m[1], m[2], 0, 0, 0 };
+				add_plane(n, q, p, mm, NULL,
+					DECIMATE_BOUNDARY_WEIGHT * dist2(v1, v2));
+			}
+		}
+	}
+}
+
+
+// Error of collapsing a into b: the RMS distance to the planes in the sum of
+// their quadrics, evaluated at b
+static float collapse_error(const TriMesh *mesh, const Quadrics &Q,
+	index_t a, index_t b)
+{
+	double x[QMAX], q[QMAX * (QMAX + 1) / 2 + QMAX + 2];
+	quadric_coords(mesh, Q, b, x);
+	const double *qa = Q[a], *qb = Q[b];
+	for (int j = 0; j < Q.size; j++)
+		q[j] = qa[j] + qb[j];
+	double err = max(quadric_error(Q.n, q, x), 0.0);
+	double w = q[Q.size - 1];
+	return float(sqrt(w > 0.0 ? err / w : err));
+}
+
+
+// Would moving vertex a to b flip any of the faces around a (other than
+// the ones that are deleted)?  Faces that are already degenerate have no
+// orientation to lose, and don't count.
+static bool collapse_flips(const HalfEdge &he, index_t a, index_t b)
+{
+	const TriMesh *mesh = he.mesh;
+	const point &pa = mesh->vertices[a], &pb = mesh->vertices[b];
+	index_t h = he.out[a];
+	do {
+		index_t u = he.to(h), v = he.from(HalfEdge::prev(h));
+		if (u != b && v != b) {
+			const point &pu = mesh->vertices[u];
+			const point &pv = mesh->vertices[v];
+			vec n0 = (pu - pa) CROSS (pv - pa);
+			vec n1 = (pu - pb) CROSS (pv - pb);
+			if ((n0 DOT n1) <= 0.0f && len2(n0) > 0.0f)
+				return true;
+		}
+		h = he.ring_next(h);
+	} while (h >= 0 && h != he.out[a]);
+	return false;
+}
+
+
+// The cheapest valid collapse of vertex a: an outgoing half-edge, or -1.
+// Tries the half-edges in order of error, since checking is the slow part.
+static index_t best_collapse(const HalfEdge &he, const Quadrics &Q,
+	index_t a, float &err)
+{
+	index_t start = he.out[a];
+	if (start < 0)
+		return -1;
+	float last_err = 0.0f;
+	index_t last = -1;
+	for (;;) {
+		// The cheapest half-edge after the last one tried
+		index_t best = -1;
+		index_t h = start;
+		do {
+			float e = collapse_error(he.mesh, Q, a, he.to(h));
+			bool after = last < 0 || e > last_err ||
+				     (e == last_err && h > last);
+			if (after && (best < 0 || e < err ||
+			    (e == err && h < best))) {
+				best = h;
+				err = e;
+			}
+			h = he.ring_next(h);
+		} while (h >= 0 && h != start);
+
+		if (best < 0)
+			return -1;
+		if (he.can_collapse(best) && !collapse_flips(he, a, he.to(best)))
+			return best;
+		last = best;
+		last_err = err;
+	}
+}
+
+
+// State of a decimation in progress
+struct Decimation {
+	HalfEdge &he;
+	Quadrics Q;
+	index_t nfaces;   // Faces remaining
+	float error;      // Largest error of any collapse so far
+	vector<index_t> cand; // Best collapse of each vertex...
+	vector<float> cost; // ... and its error
+	vector<unsigned char> dirty, locked;
+
+	Decimation(HalfEdge &he_) : he(he_), nfaces(0), error(0.0f)
+	{
+		index_t nv = he.mesh->vertices.size();
+		index_t nf = he.mesh->faces.size();
+		find_quadrics(he, Q);
+		for (index_t i = 0; i < nf; i++)
+			if (!he.deleted(i))
+				nfaces++;
+		cand.resize(nv, -1);
+		cost.resize(nv);
+		dirty.resize(nv, 1);
+		locked.resize(nv);
+	}
+};
+
+
+// Helper for sorting candidates by error, then vertex number
+struct CostLess {
+	const vector<float> &cost;
+	CostLess(const vector<float> &cost_) : cost(cost_) {}
+	bool operator () (index_t a, index_t b) const
+		{ return cost[a] < cost[b] || (cost[a] == cost[b] && a < b); }
+};
+
+
+// One batch: find the best collapse of each vertex whose neighborhood has
+// changed, then greedily pick the cheapest ones whose neighborhoods don't
+// overlap, and do them all in parallel.  Returns false if there was
+// nothing left to try.
+static bool decimate_batch(Decimation &D, index_t target_faces,
+	float max_error)
+{
+	HalfEdge &he = D.he;
+	index_t nv = he.mesh->vertices.size();
+#pragma omp parallel for schedule(dynamic,256)
+	for (index_t i = 0; i < nv; i++) {
+		if (D.dirty[i]) {
+			D.cand[i] = best_collapse(he, D.Q, i, D.cost[i]);
+			D.dirty[i] = 0;
+		}
+	}
+
+	vector<index_t> order;
+	for (index_t i = 0; i < nv; i++) {
+		if (D.cand[i] >= 0 && (max_error <= 0.0f ||
+		    D.cost[i] <= max_error))
+			order.push_back(i);
+	}
+	if (order.empty())
+		return false;
+	size_t n = (order.size() + DECIMATE_BATCH - 1) / DECIMATE_BATCH;
+	CostLess less(D.cost);
+	nth_element(order.begin(), order.begin() + n - 1, order.end(), less);
+	sort(order.begin(), order.begin() + n, less);
+
+	// Pick the collapses
+	vector<index_t> hs, touched, ra, rb;
+	index_t removed = 0;
+	for (size_t k = 0; k < n && D.nfaces - removed > target_faces; k++) {
+		index_t a = order[k], h = D.cand[a];
+		if (he.deleted(HalfEdge::face(h)))
+			continue;
+		index_t b = he.to(h);
+		he.one_ring(a, ra);
+		he.one_ring(b, rb);
+		bool ok = !D.locked[a] && !D.locked[b];
+		for (size_t i = 0; ok && i < ra.size(); i++)
+			ok = !D.locked[ra[i]];
+		for (size_t i = 0; ok && i < rb.size(); i++)
+			ok = !D.locked[rb[i]];
+		if (!ok)
+			continue;
+		D.locked[a] = D.locked[b] = 1;
+		touched.push_back(a);
+		touched.push_back(b);
+		for (size_t i = 0; i < ra.size(); i++) {
+			D.locked[ra[i]] = 1;
+			touched.push_back(ra[i]);
+		}
+		for (size_t i = 0; i < rb.size(); i++) {
+			D.locked[rb[i]] = 1;
+			touched.push_back(rb[i]);
+		}
+		hs.push_back(h);
+		removed += he.is_bdy_edge(h) ? 1 : 2;
+	}
+
+	// Do them, and move the quadrics along
+	size_t nh = hs.size();
+	vector<index_t> ha(nh), hb(nh);
+	vector<unsigned char> bdy(nh);
+	for (size_t i = 0; i < nh; i++) {
+		ha[i] = he.from(hs[i]);
+		hb[i] = he.to(hs[i]);
+		bdy[i] = he.is_bdy_edge(hs[i]);
+	}
+	index_t ndone = he.collapse(hs);
+	for (size_t i = 0; i < nh; i++) {
+		if (hs[i] < 0)
+			continue;
+		double *qa = D.Q[ha[i]], *qb = D.Q[hb[i]];
+		for (int j = 0; j < D.Q.size; j++)
+			qb[j] += qa[j];
+		D.nfaces -= bdy[i] ? 1 : 2;
+		D.error = max(D.error, D.cost[ha[i]]);
+		D.cand[ha[i]] = -1;
+	}
+
+	// Only b and its neighbors have new quadrics, faces, or neighbors,
+	// so only they need new candidates.  They were all touched.  Vertices
+	// left without any faces have no collapses at all.
+	for (size_t i = 0; i < touched.size(); i++) {
+		index_t v = touched[i];
+		D.locked[v] = 0;
+		if (he.out[v] >= 0)
+			D.dirty[v] = 1;
+		else
+			D.cand[v] = -1;
+	}
+
+	// Collapses that failed had stale candidates, which have now been
+	// marked dirty, so it's worth trying again even if none succeeded
+	return ndone > 0 || nh > 0;
+}
+
+
+// Collapse edges until there are at most target_faces faces, or the next
+// collapse would have more than max_error
+static void decimate_to(Decimation &D, index_t target_faces,
+	float max_error)
+{
+	while (D.nfaces > target_faces &&
+	       decimate_batch(D, target_faces, max_error))
+		;
+}
+
+
+// Simplify a mesh by quadric-error edge collapses
+void decimate(TriMesh *mesh, index_t target_faces, float max_error /* = 0 */)
+{
+	mesh->need_faces();
+	mesh->tstrips.clear();
+	mesh->grid.clear();
+	index_t nf = mesh->faces.size();
+	if (nf <= target_faces)
+		return;
+
+	dprintf("Decimating mesh... ");
+	HalfEdge he(mesh);
+	Decimation D(he);
+	decimate_to(D, target_faces, max_error);
+
+	vector<bool> dead(nf);
+	for (index_t i = 0; i < nf; i++)
+		dead[i] = he.deleted(i);
+	remove_faces(mesh, dead);
+	remove_unused_vertices(mesh);
+	dprintf("Done.  %lld faces, error %g\n", (long long) D.nfaces,
+		D.error);
+}
+
+
+// Simplify a copy of the mesh repeatedly, keeping the faces at each level
+void build_lods(TriMesh *mesh, LODChain &lods, int max_levels /* = 8 */,
+	float ratio /* = 0.5f */, float max_error /* = 0 */)
+{
+	mesh->need_faces();
+	lods.faces = mesh->faces;
+	lods.off.assign(1, 0);
+	lods.off.push_back(lods.faces.size());
+	lods.error.assign(1, 0.0f);
+
+	dprintf("Building LODs... ");
+	TriMesh work;
+	work.vertices = mesh->vertices;
+	work.colors = mesh->colors;
+	work.faces = mesh->faces;
+	HalfEdge he(&work);
+	Decimation D(he);
+
+	float target = D.nfaces;
+	for (int level = 1; level < max_levels; level++) {
+		index_t prev = D.nfaces;
+		target *= ratio;
+		decimate_to(D, index_t(target), max_error);
+		if (D.nfaces == prev)
+			break;
+		for (size_t i = 0; i < work.faces.size(); i++)
+			if (!he.deleted(i))
+				lods.faces.push_back(work.faces[i]);
+		lods.off.push_back(lods.faces.size());
+		lods.error.push_back(D.error);
+		if (D.nfaces > index_t(target))
+			break;
+	}
+
+	dprintf("Done.  %d levels, %lu faces in all\n", lods.levels(),
+		(unsigned long) lods.faces.size());
+}
+
+}; // namespace trimesh
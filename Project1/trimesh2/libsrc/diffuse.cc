@@ -23,7 +23,8 @@ static inline float wt(const point &p1, const point &p2, float invsigma2)
 	return (d2 >= 9.0f) ? 0.0f : exp(-0.5f*d2);
 	//return (d2 >= 25.0f) ? 0.0f : exp(-0.5f*d2);
 }
-static inline float wt(const TriMesh *themesh, int v1, int v2, float invsigma2)
+static inline float wt(const TriMesh *themesh, index_t v1, index_t v2,
+			float invsigma2)
 {
 	return wt(themesh->vertices[v1], themesh->vertices[v2], invsigma2);
 }
@@ -35,16 +36,16 @@ struct AccumVec {
 	const vector<T> &field;
 	AccumVec(const vector<T> &field_) : field(field_)
 		{}
-	void operator() (const TriMesh *, int /* v0 */, T &f,
-			 float w, int v) const
+	void operator() (const TriMesh *, index_t /* v0 */, T &f,
+			 float w, index_t v) const
 	{
 		f += w * field[v];
 	}
 };
 
 struct AccumCurv {
-	void operator() (const TriMesh *themesh, int v0, vec &c,
-			 float w, int v) const
+	void operator() (const TriMesh *themesh, index_t v0, vec &c,
+			 float w, index_t v) const
 	{
 		vec ncurv;
 		proj_curv(themesh->pdir1[v], themesh->pdir2[v],
@@ -56,8 +57,8 @@ struct AccumCurv {
 };
 
 struct AccumDCurv {
-	void operator() (const TriMesh *themesh, int v0, Vec<4> &d,
-			 float w, int v) const
+	void operator() (const TriMesh *themesh, index_t v0, Vec<4> &d,
+			 float w, index_t v) const
 	{
 		Vec<4> ndcurv;
 		proj_dcurv(themesh->pdir1[v], themesh->pdir2[v],
@@ -69,30 +70,31 @@ struct AccumDCurv {
 };
 
 
-// Diffuse a vector field at 1 vertex, weighted by
-// a Gaussian of width 1/sqrt(invsigma2)
-template <class ACCUM, class T>
-static void diffuse_vert_field(TriMesh *themesh,
-                               vector<unsigned> &flags, unsigned &flag_curr,
-			       const ACCUM &accum, int v, float invsigma2,
-			       T &flt)
+// Visit the vertices that contribute to the diffused value at vertex v,
+// calling visit(n, w) for each vertex n with weight w, starting with v
+// itself.  Returns the sum of the weights.  Weights are a Gaussian of width
+// 1/sqrt(invsigma2), times the point area of n, downweighted by normals
+// pointing in different directions.
+template <class VISIT>
+static float visit_vert_nbrs(TriMesh *themesh,
+			     vector<unsigned> &flags, unsigned &flag_curr,
+			     index_t v, float invsigma2, VISIT &visit)
 {
-	if (themesh->neighbors[v].empty()) {
-		flt = T();
-		accum(themesh, v, flt, 1.0f, v);
-		return;
+	TriMesh::Adjacency::Row nbrs = themesh->neighbors[v];
+	if (nbrs.empty()) {
+		visit(v, 1.0f);
+		return 1.0f;
 	}
 
-	flt = T();
-	accum(themesh, v, flt, themesh->pointareas[v], v);
+	visit(v, themesh->pointareas[v]);
 	float sum_w = themesh->pointareas[v];
 	const vec &nv = themesh->normals[v];
 
 	flag_curr++;
 	flags[v] = flag_curr;
-	vector<int> boundary = themesh->neighbors[v];
+	vector<index_t> boundary(nbrs.begin(), nbrs.end());
 	while (!boundary.empty()) {
-		int n = boundary.back();
+		index_t n = boundary.back();
 		boundary.pop_back();
 		if (flags[n] == flag_curr)
 			continue;
@@ -108,19 +110,166 @@ static void diffuse_vert_field(TriMesh *themesh,
 		// Surface area "belonging" to each point
 		w *= themesh->pointareas[n];
 		// Accumulate weight times field at neighbor
-		accum(themesh, v, flt, w, n);
+		visit(n, w);
 		sum_w += w;
-		for (size_t i = 0; i < themesh->neighbors[n].size(); i++) {
-			int nn = themesh->neighbors[n][i];
+		TriMesh::Adjacency::Row nnbrs = themesh->neighbors[n];
+		for (size_t i = 0; i < nnbrs.size(); i++) {
+			index_t nn = nnbrs[i];
 			if (flags[nn] == flag_curr)
 				continue;
 			boundary.push_back(nn);
 		}
 	}
+	return sum_w;
+}
+
+
+// Helpers for visit_vert_nbrs: accumulate a field, or record the weights
+template <class ACCUM, class T>
+struct AccumVisit {
+	const TriMesh *themesh;
+	const ACCUM &accum;
+	index_t v0;
+	T &flt;
+	AccumVisit(const TriMesh *themesh_, const ACCUM &accum_, index_t v0_,
+		   T &flt_) : themesh(themesh_), accum(accum_), v0(v0_), flt(flt_)
+		{}
+	void operator() (index_t v, float w)
+		{ accum(themesh, v0, flt, w, v); }
+};
+
+struct RecordVisit {
+	vector<index_t> &ind;
+	vector<float> &wts;
+	RecordVisit(vector<index_t> &ind_, vector<float> &wts_) :
+		ind(ind_), wts(wts_)
+		{}
+	void operator() (index_t v, float w)
+		{ ind.push_back(v); wts.push_back(w); }
+};
+
+
+// Diffuse a vector field at 1 vertex, weighted by
+// a Gaussian of width 1/sqrt(invsigma2)
+template <class ACCUM, class T>
+static void diffuse_vert_field(TriMesh *themesh,
+                               vector<unsigned> &flags, unsigned &flag_curr,
+			       const ACCUM &accum, index_t v, float invsigma2,
+			       T &flt)
+{
+	flt = T();
+	AccumVisit<ACCUM, T> visit(themesh, accum, v, flt);
+	float sum_w = visit_vert_nbrs(themesh, flags, flag_curr,
+				      v, invsigma2, visit);
 	flt /= sum_w;
 }
 
 
+// Rows of the diffusion operator built together by one thread
+#define DIFFUSION_BLOCK 1024
+
+// Precompute the diffusion weights for the given sigma, unless the operator
+// is already up to date.  Blocks of rows are found in parallel, then
+// concatenated.
+void build_diffusion(TriMesh *themesh, float sigma, DiffusionOp &op)
+{
+	themesh->need_normals();
+	themesh->need_pointareas();
+	themesh->need_neighbors();
+	index_t nv = themesh->vertices.size();
+	if (op.mesh == themesh && op.version == themesh->version &&
+	    op.sigma == sigma && (index_t) op.sum.size() == nv)
+		return;
+
+	dprintf("\rBuilding diffusion operator... ");
+	timestamp t = now();
+
+	float invsigma2 = 1.0f / sqr(sigma);
+	index_t nblocks = (nv + DIFFUSION_BLOCK - 1) / DIFFUSION_BLOCK;
+	vector< vector<index_t> > block_ind(nblocks);
+	vector< vector<float> > block_wt(nblocks);
+	vector<index_t> count(nv);
+	op.sum.resize(nv);
+#pragma omp parallel
+	{
+		// Thread-local flags
+		vector<unsigned> flags(nv);
+		unsigned flag_curr = 0;
+
+#pragma omp for schedule(dynamic)
+		for (index_t b = 0; b < nblocks; b++) {
+			RecordVisit visit(block_ind[b], block_wt[b]);
+			index_t end = min(nv, (b + 1) * DIFFUSION_BLOCK);
+			for (index_t i = b * DIFFUSION_BLOCK; i < end; i++) {
+				size_t before = block_ind[b].size();
+				op.sum[i] = visit_vert_nbrs(themesh,
+					flags, flag_curr, i, invsigma2, visit);
+				count[i] = block_ind[b].size() - before;
+			}
+		}
+	} // #pragma omp parallel
+
+	prefix_sum(count, op.off);
+	op.ind.resize(op.off[nv]);
+	op.wt.resize(op.off[nv]);
+#pragma omp parallel for
+	for (index_t b = 0; b < nblocks; b++) {
+		index_t start = op.off[b * DIFFUSION_BLOCK];
+		copy(block_ind[b].begin(), block_ind[b].end(), &op.ind[start]);
+		copy(block_wt[b].begin(), block_wt[b].end(), &op.wt[start]);
+		vector<index_t>().swap(block_ind[b]);
+		vector<float>().swap(block_wt[b]);
+	}
+
+	op.mesh = themesh;
+	op.version = themesh->version;
+	op.sigma = sigma;
+
+	dprintf("%.1f weights per vertex, took %f sec.\n",
+		nv ? float(op.off[nv]) / nv : 0.0f, now() - t);
+}
+
+
+// Diffuse a field, using the operator if given or else finding the
+// neighborhood of each vertex on the fly
+template <class ACCUM, class T>
+static void diffuse_field(TriMesh *themesh, const ACCUM &accum,
+			  float sigma, DiffusionOp *op, vector<T> &flt)
+{
+	index_t nv = themesh->vertices.size();
+	flt.clear();
+	flt.resize(nv);
+
+	if (op) {
+		build_diffusion(themesh, sigma, *op);
+#pragma omp parallel for
+		for (index_t i = 0; i < nv; i++) {
+			T &f = flt[i];
+			for (index_t k = op->off[i]; k < op->off[i+1]; k++)
+				accum(themesh, i, f, op->wt[k], op->ind[k]);
+			f /= op->sum[i];
+		}
+		return;
+	}
+
+	themesh->need_normals();
+	themesh->need_pointareas();
+	themesh->need_neighbors();
+	float invsigma2 = 1.0f / sqr(sigma);
+#pragma omp parallel
+	{
+		// Thread-local flags
+		vector<unsigned> flags(nv);
+		unsigned flag_curr = 0;
+
+#pragma omp for
+		for (index_t i = 0; i < nv; i++)
+			diffuse_vert_field(themesh, flags, flag_curr,
+				accum, i, invsigma2, flt[i]);
+	} // #pragma omp parallel
+}
+
+
 // Smooth the mesh geometry.
 // XXX - this is perhaps not a great way to do this,
 // but it seems to work better than most other things I've tried...
@@ -128,8 +277,8 @@ void smooth_mesh(TriMesh *themesh, float sigma)
 {
 	themesh->need_faces();
 	diffuse_normals(themesh, 0.5f * sigma);
-	int nv = themesh->vertices.size();
-	int nf = themesh->faces.size();
+	themesh->need_adjacentfaces();
+	index_t nv = themesh->vertices.size();
 
 	dprintf("\rSmoothing... ");
 	timestamp t = now();
@@ -145,7 +294,7 @@ void smooth_mesh(TriMesh *themesh, float sigma)
 
 		// Main filtering step
 #pragma omp for
-		for (int i = 0; i < nv; i++) {
+		for (index_t i = 0; i < nv; i++) {
 			diffuse_vert_field(themesh, flags, flag_curr,
 				AccumVec<vec>(themesh->vertices),
 				i, invsigma2, dflt[i]);
@@ -153,25 +302,36 @@ void smooth_mesh(TriMesh *themesh, float sigma)
 			dflt[i] -= themesh->vertices[i];
 		}
 
-		// Slightly better small-neighborhood approximation
+		// Slightly better small-neighborhood approximation,
+		// gathered from the faces around each vertex
 #pragma omp for
-		for (int i = 0; i < nf; i++) {
-			point c = themesh->vertices[themesh->faces[i][0]] +
-				  themesh->vertices[themesh->faces[i][1]] +
-				  themesh->vertices[themesh->faces[i][2]];
-			c /= 3.0f;
-			for (int j = 0; j < 3; j++) {
-				int v = themesh->faces[i][j];
+		for (index_t v = 0; v < nv; v++) {
+			TriMesh::Adjacency::Row a = themesh->adjacentfaces[v];
+			int j = -1;
+			for (size_t k = 0; k < a.size(); k++) {
+				index_t i = a[k];
+				// A degenerate face is listed once per corner
+				if (k && i == a[k-1]) {
+					do {
+						j++;
+					} while (themesh->faces[i][j] != v);
+				} else {
+					j = themesh->faces[i].indexof(v);
+				}
+				point c = themesh->vertices[themesh->faces[i][0]] +
+					  themesh->vertices[themesh->faces[i][1]] +
+					  themesh->vertices[themesh->faces[i][2]];
+				c /= 3.0f;
 				vec d = 0.5f * (c - themesh->vertices[v]);
 				dflt[v] += themesh->cornerareas[i][j] /
-					   themesh->pointareas[themesh->faces[i][j]] *
+					   themesh->pointareas[v] *
 					   exp(-0.5f * invsigma2 * len2(d)) * d;
 			}
 		}
 
 		// Filter displacement field
 #pragma omp for
-		for (int i = 0; i < nv; i++) {
+		for (index_t i = 0; i < nv; i++) {
 			diffuse_vert_field(themesh, flags, flag_curr,
 				AccumVec<point>(dflt),
 				i, invsigma2, dflt2[i]);
@@ -179,9 +339,10 @@ void smooth_mesh(TriMesh *themesh, float sigma)
 
 		// Update vertex positions
 #pragma omp for
-		for (int i = 0; i < nv; i++)
+		for (index_t i = 0; i < nv; i++)
 			themesh->vertices[i] += dflt[i] - dflt2[i]; // second Laplacian
 	} // #pragma omp parallel
+	themesh->changed_vertices();
 
 	dprintf("Done.  Filtering took %f sec.\n", now() - t);
 }
@@ -192,7 +353,7 @@ void smooth_mesh(TriMesh *themesh, float sigma)
 // For pass 2, do bilateral, using mpoints, and write to themesh->vertices
 static void jones_filter(TriMesh *themesh,
                          vector<unsigned> &flags, unsigned &flag_curr,
-			 int v,
+			 index_t v,
 			 float invsigma2_1, float invsigma2_2, bool pass1,
 			 vector<point> &mpoints)
 {
@@ -203,17 +364,18 @@ static void jones_filter(TriMesh *themesh,
 	float sum_w = 0.0f;
 
 	flag_curr++;
-	vector<int> boundary = themesh->adjacentfaces[v];
+	TriMesh::Adjacency::Row a = themesh->adjacentfaces[v];
+	vector<index_t> boundary(a.begin(), a.end());
 	while (!boundary.empty()) {
-		int f = boundary.back();
+		index_t f = boundary.back();
 		boundary.pop_back();
 		if (flags[f] == flag_curr)
 			continue;
 		flags[f] = flag_curr;
 
-		int v0 = themesh->faces[f][0];
-		int v1 = themesh->faces[f][1];
-		int v2 = themesh->faces[f][2];
+		index_t v0 = themesh->faces[f][0];
+		index_t v1 = themesh->faces[f][1];
+		index_t v2 = themesh->faces[f][2];
 		const point &p0 = themesh->vertices[v0];
 		const point &p1 = themesh->vertices[v1];
 		const point &p2 = themesh->vertices[v2];
@@ -239,7 +401,7 @@ static void jones_filter(TriMesh *themesh,
 		}
 
 		for (int i = 0; i < 3; i++) {
-			int ae = themesh->across_edge[f][i];
+			index_t ae = themesh->across_edge[f][i];
 			if (ae < 0 || flags[ae] == flag_curr)
 				continue;
 			boundary.push_back(ae);
@@ -258,7 +420,7 @@ void bilateral_smooth_mesh(TriMesh *themesh, float sigma1, float sigma2)
 	themesh->need_faces();
 	themesh->need_adjacentfaces();
 	themesh->need_across_edge();
-	int nv = themesh->vertices.size(), nf = themesh->faces.size();
+	index_t nv = themesh->vertices.size(), nf = themesh->faces.size();
 
 	dprintf("\rSmoothing... ");
 	timestamp t = now();
@@ -277,16 +439,17 @@ void bilateral_smooth_mesh(TriMesh *themesh, float sigma1, float sigma2)
 
 		// Pass I: mollification
 #pragma omp for
-		for (int i = 0; i < nv; i++)
+		for (index_t i = 0; i < nv; i++)
 			jones_filter(themesh, flags, flag_curr,
 				i, invsigma2_3, 0.0f, true, mpoints);
 
 		// Pass II: bilateral
 #pragma omp for
-		for (int i = 0; i < nv; i++)
+		for (index_t i = 0; i < nv; i++)
 			jones_filter(themesh, flags, flag_curr,
 				i, invsigma2_1, invsigma2_2, false, mpoints);
 	}
+	themesh->changed_vertices();
 
 	dprintf("Done.  Filtering took %f sec.\n", now() - t);
 }
@@ -294,149 +457,93 @@ void bilateral_smooth_mesh(TriMesh *themesh, float sigma1, float sigma2)
 
 // Diffuse an arbitrary per-vertex vector field
 template <class T>
-void diffuse_vector(TriMesh *themesh, std::vector<T> &field, float sigma)
+void diffuse_vector(TriMesh *themesh, std::vector<T> &field, float sigma,
+		    DiffusionOp *op /* = NULL */)
 {
-	themesh->need_normals();
-	themesh->need_pointareas();
-	themesh->need_neighbors();
-	int nv = themesh->vertices.size();
-
 	dprintf("\rSmoothing vector field... ");
 	timestamp t = now();
 
-	float invsigma2 = 1.0f / sqr(sigma);
-
-	vector<T> flt(nv);
-	AccumVec<T> a(field);
-#pragma omp parallel
-	{
-		// Thread-local flags
-		vector<unsigned> flags(nv);
-		unsigned flag_curr = 0;
-
-#pragma omp for
-		for (int i = 0; i < nv; i++)
-			diffuse_vert_field(themesh, flags, flag_curr,
-				a, i, invsigma2, flt[i]);
-	} // #pragma omp parallel
-
-	field = flt;
+	vector<T> flt;
+	diffuse_field(themesh, AccumVec<T>(field), sigma, op, flt);
+	field.swap(flt);
 
 	dprintf("Done.  Filtering took %f sec.\n", now() - t);
 }
 
 
-// Diffuse the normals across the mesh
-void diffuse_normals(TriMesh *themesh, float sigma)
+// Diffuse the normals across the mesh.  The diffusion weights depend on the
+// normals, so op is no longer up to date afterwards.
+void diffuse_normals(TriMesh *themesh, float sigma,
+		     DiffusionOp *op /* = NULL */)
 {
 	themesh->need_normals();
-	themesh->need_pointareas();
-	themesh->need_neighbors();
-	int nv = themesh->vertices.size();
 
 	dprintf("\rSmoothing normals... ");
 	timestamp t = now();
 
-	float invsigma2 = 1.0f / sqr(sigma);
-
-	vector<vec> nflt(nv);
-	AccumVec<vec> a(themesh->normals);
-#pragma omp parallel
-	{
-		// Thread-local flags
-		vector<unsigned> flags(nv);
-		unsigned flag_curr = 0;
-
-#pragma omp for
-		for (int i = 0; i < nv; i++) {
-			diffuse_vert_field(themesh, flags, flag_curr,
-				a, i, invsigma2, nflt[i]);
-			normalize(nflt[i]);
-		}
-	} // #pragma omp parallel
-
-	themesh->normals = nflt;
+	vector<vec> nflt;
+	diffuse_field(themesh, AccumVec<vec>(themesh->normals), sigma, op, nflt);
+	index_t nv = nflt.size();
+#pragma omp parallel for
+	for (index_t i = 0; i < nv; i++)
+		normalize(nflt[i]);
+	themesh->normals.swap(nflt);
+	// Not computed by need_normals any more, so not updated piecemeal
+	themesh->normals_weight = -1;
+	themesh->normals_full++;
+	if (op)
+		op->clear();
 
 	dprintf("Done.  Filtering took %f sec.\n", now() - t);
 }
 
 
 // Diffuse the curvatures across the mesh
-void diffuse_curv(TriMesh *themesh, float sigma)
+void diffuse_curv(TriMesh *themesh, float sigma,
+		  DiffusionOp *op /* = NULL */)
 {
-	themesh->need_normals();
-	themesh->need_pointareas();
 	themesh->need_curvatures();
-	themesh->need_neighbors();
-	int nv = themesh->vertices.size();
 
 	dprintf("\rSmoothing curvatures... ");
 	timestamp t = now();
 
-	float invsigma2 = 1.0f / sqr(sigma);
-
-	vector<vec> cflt(nv);
-#pragma omp parallel
-	{
-		// Thread-local flags
-		vector<unsigned> flags(nv);
-		unsigned flag_curr = 0;
-
-#pragma omp for
-		for (int i = 0; i < nv; i++)
-			diffuse_vert_field(themesh, flags, flag_curr,
-				AccumCurv(), i, invsigma2, cflt[i]);
-
-#pragma omp for
-		for (int i = 0; i < nv; i++)
-			diagonalize_curv(themesh->pdir1[i], themesh->pdir2[i],
-					 cflt[i][0], cflt[i][1], cflt[i][2],
-					 themesh->normals[i],
-					 themesh->pdir1[i], themesh->pdir2[i],
-					 themesh->curv1[i], themesh->curv2[i]);
-	} // #pragma omp parallel
+	vector<vec> cflt;
+	diffuse_field(themesh, AccumCurv(), sigma, op, cflt);
+	index_t nv = cflt.size();
+#pragma omp parallel for
+	for (index_t i = 0; i < nv; i++)
+		diagonalize_curv(themesh->pdir1[i], themesh->pdir2[i],
+				 cflt[i][0], cflt[i][1], cflt[i][2],
+				 themesh->normals[i],
+				 themesh->pdir1[i], themesh->pdir2[i],
+				 themesh->curv1[i], themesh->curv2[i]);
 
 	dprintf("Done.  Filtering took %f sec.\n", now() - t);
 }
 
 
 // Diffuse the curvature derivatives across the mesh
-void diffuse_dcurv(TriMesh *themesh, float sigma)
+void diffuse_dcurv(TriMesh *themesh, float sigma,
+		   DiffusionOp *op /* = NULL */)
 {
-	themesh->need_normals();
-	themesh->need_pointareas();
 	themesh->need_curvatures();
 	themesh->need_dcurv();
-	themesh->need_neighbors();
-	int nv = themesh->vertices.size();
 
 	dprintf("\rSmoothing curvature derivatives... ");
 	timestamp t = now();
 
-	float invsigma2 = 1.0f / sqr(sigma);
-
-	vector< Vec<4> > dflt(nv);
-#pragma omp parallel
-	{
-		// Thread-local flags
-		vector<unsigned> flags(nv);
-		unsigned flag_curr = 0;
-
-#pragma omp for
-		for (int i = 0; i < nv; i++)
-			diffuse_vert_field(themesh, flags, flag_curr,
-				AccumDCurv(), i, invsigma2, dflt[i]);
-	} // #pragma omp parallel
+	vector< Vec<4> > dflt;
+	diffuse_field(themesh, AccumDCurv(), sigma, op, dflt);
+	themesh->dcurv.swap(dflt);
 
-	themesh->dcurv = dflt;
 	dprintf("Done.  Filtering took %f sec.\n", now() - t);
 }
 
 
 // Instantiate a bunch of diffuse_vector forms
-template void diffuse_vector< float >(TriMesh *, vector< float > &, float);
-template void diffuse_vector< Vec<2,float> >(TriMesh *, vector< Vec<2,float> > &, float);
-template void diffuse_vector< Vec<3,float> >(TriMesh *, vector< Vec<3,float> > &, float);
-template void diffuse_vector< Vec<4,float> >(TriMesh *, vector< Vec<4,float> > &, float);
+template void diffuse_vector< float >(TriMesh *, vector< float > &, float, DiffusionOp *);
+template void diffuse_vector< Vec<2,float> >(TriMesh *, vector< Vec<2,float> > &, float, DiffusionOp *);
+template void diffuse_vector< Vec<3,float> >(TriMesh *, vector< Vec<3,float> > &, float, DiffusionOp *);
+template void diffuse_vector< Vec<4,float> >(TriMesh *, vector< Vec<4,float> > &, float, DiffusionOp *);
 
 }; // namespace trimesh
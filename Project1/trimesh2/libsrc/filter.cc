@@ -10,6 +10,7 @@ Miscellaneous filtering operations on trimeshes
 #include "TriMesh.h"
 #include "TriMesh_algo.h"
 #include "lineqn.h"
+#include "rnd.h"
 #include <numeric>
 using namespace std;
 #define dprintf TriMesh::dprintf
@@ -17,15 +18,6 @@ using namespace std;
 
 namespace trimesh {
 
-// Quick 'n dirty portable random number generator 
-static inline float tinyrnd()
-{
-	static unsigned trand = 0;
-	trand = 1664525u * trand + 1013904223u;
-	return (float) trand / 4294967296.0f;
-}
-
-
 // Create an offset surface from a mesh.  Dumb - just moves along the
 // normal by the given distance, making no attempt to avoid self-intersection.
 // Eventually, this could/should be extended to use the method in
@@ -42,8 +34,7 @@ void inflate(TriMesh *mesh, float amount)
 	for (int i = 0; i < nv; i++)
 		mesh->vertices[i] += amount * mesh->normals[i];
 	dprintf("Done.\n");
-	mesh->bbox.valid = false;
-	mesh->bsphere.valid = false;
+	mesh->changed_vertices();
 }
 
 
@@ -51,11 +42,17 @@ void inflate(TriMesh *mesh, float amount)
 void apply_xform(TriMesh *mesh, const xform &xf)
 {
 	int nv = mesh->vertices.size();
+	bool had_bbox = mesh->bbox.valid, had_bsphere = mesh->bsphere.valid;
+	bool had_normals = !mesh->normals.empty() &&
+			   mesh->normals_version == mesh->version;
 
 #pragma omp parallel for
 	for (int i = 0; i < nv; i++)
 		mesh->vertices[i] = xf * mesh->vertices[i];
+	mesh->changed_vertices();
 
+	// Normals are transformed rather than recomputed, so they stay
+	// up to date if they were before
 	if (!mesh->normals.empty()) {
 		xform nxf = norm_xf(xf);
 #pragma omp parallel for
@@ -63,16 +60,14 @@ void apply_xform(TriMesh *mesh, const xform &xf)
 			mesh->normals[i] = nxf * mesh->normals[i];
 			normalize(mesh->normals[i]);
 		}
+		if (had_normals)
+			mesh->normals_version = mesh->version;
 	}
 
-	if (mesh->bbox.valid) {
-		mesh->bbox.valid = false;
+	if (had_bbox)
 		mesh->need_bbox();
-	}
-	if (mesh->bsphere.valid) {
-		mesh->bsphere.valid = false;
+	if (had_bsphere)
 		mesh->need_bsphere();
-	}
 }
 
 
@@ -411,7 +406,7 @@ void orient(TriMesh *mesh)
 			for (int j = 0; j < 3; j++) {
 				int v0 = mesh->faces[f][j];
 				int v1 = mesh->faces[f][(j+1)%3];
-				const vector<int> &a = mesh->adjacentfaces[v0];
+				TriMesh::Adjacency::Row a = mesh->adjacentfaces[v0];
 				for (size_t k = 0; k < a.size(); k++) {
 					int f1 = a[k];
 					if (mesh->flags[f1] != NONE)
@@ -447,7 +442,7 @@ void orient(TriMesh *mesh)
 		else
 			if (v2[0] > v0[0]) j = 2;
 		int v = mesh->faces[f][j];
-		const vector<int> &a = mesh->adjacentfaces[v];
+		TriMesh::Adjacency::Row a = mesh->adjacentfaces[v];
 		vec n;
 		for (size_t k = 0; k < a.size(); k++) {
 			int f1 = a[k];
@@ -479,31 +474,34 @@ void erode(TriMesh *mesh)
 }
 
 
-// Add a bit of noise to the mesh
-void noisify(TriMesh *mesh, float amount)
+// Add a bit of noise to the mesh.  The displacement of each vertex
+// depends only on the seed and the vertex index.
+void noisify(TriMesh *mesh, float amount, unsigned seed /* = 0 */)
 {
 	mesh->need_normals();
 	mesh->need_neighbors();
 	int nv = mesh->vertices.size();
 	vector<vec> disp(nv);
 
+#pragma omp parallel for
 	for (int i = 0; i < nv; i++) {
-		point &v = mesh->vertices[i];
+		const point &v = mesh->vertices[i];
 		// Tangential
 		int nn = mesh->neighbors[i].size();
 		for (int j = 0; j < nn; j++) {
 			const point &n = mesh->vertices[mesh->neighbors[i][j]];
 			float scale = amount / (amount + len(n-v));
-			disp[i] += (float) tinyrnd() * scale * (n-v);
+			disp[i] += rnd_float(seed, i, j+1) * scale * (n-v);
 		}
 		if (nn)
 			disp[i] /= (float) nn;
 		// Normal
-		disp[i] += (2.0f * (float) tinyrnd() - 1.0f) *
+		disp[i] += (2.0f * rnd_float(seed, i) - 1.0f) *
 			   amount * mesh->normals[i];
 	}
 	for (int i = 0; i < nv; i++)
 		mesh->vertices[i] += disp[i];
+	mesh->changed_vertices();
 }
 
 }; // namespace trimesh
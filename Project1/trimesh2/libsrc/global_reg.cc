@@ -0,0 +1,442 @@
+/*
+Szymon Rusinkiewicz
+Princeton University
+
+global_reg.cc
+Coarse, feature-based registration of two meshes in arbitrary poses,
+used to produce a starting transform for ICP.
+*/
+
+#include "TriMesh.h"
+#include "ICP.h"
+#include "timestamp.h"
+#include "rnd.h"
+#include <cstdio>
+#include <algorithm>
+using namespace std;
+
+#define dprintf TriMesh::dprintf
+
+
+namespace trimesh {
+
+// Descriptor layout: the three angular histograms of FPFH
+//  Rusu, R., Blodow, N., and Beetz, M.
+//  "Fast Point Feature Histograms (FPFH) for 3D Registration,"
+//  Proc. ICRA, 2009.
+// followed by a histogram of shape index over the neighborhood.
+#define FPFH_BINS 11
+#define SI_BINS 8
+#define DESC_SIZE (3 * FPFH_BINS + SI_BINS)
+#define SPFH_SIZE (3 * FPFH_BINS)
+
+// Neighborhood radius and inlier distance, in units of sample spacing
+#define RADIUS_SPACING 5.0f
+#define INLIER_SPACING 1.5f
+
+// Edge lengths of RANSAC triples must agree to within this ratio
+#define EDGE_SIMILARITY 0.9f
+
+#define REFINE_ITERS 3
+
+
+// Pick up to nsamp vertices, evenly spaced in the vertex order
+static void pick_samples(const TriMesh *mesh, int nsamp, vector<int> &samples)
+{
+	int nv = mesh->vertices.size();
+	nsamp = min(nv, nsamp);
+	samples.resize(nsamp);
+	for (int i = 0; i < nsamp; i++)
+		samples[i] = clamp(int((float) i / nsamp * nv), 0, nv - 1);
+}
+
+
+// Median distance from each sample to its nearest other sample
+static float sample_spacing(const vector<point> &pts, const KDtree *kd)
+{
+	int n = pts.size();
+	vector<float> d(n);
+#pragma omp parallel for
+	for (int i = 0; i < n; i++) {
+		vector<const float *> knn;
+		kd->find_k_closest_to_pt(knn, 2, pts[i]);
+		d[i] = (knn.size() < 2) ? 0.0f : dist(pts[i], point(knn[1]));
+	}
+	nth_element(d.begin(), d.begin() + n/2, d.end());
+	return d[n/2];
+}
+
+
+// Compute descriptors for the given samples of a mesh.  Neighborhoods are
+// taken among the samples themselves, within the given radius.
+static void compute_descriptors(TriMesh *mesh, const vector<int> &samples,
+				const vector<point> &pts, const KDtree *kd,
+				float radius, vector<float> &desc)
+{
+	int n = samples.size();
+	bool have_curv = !mesh->curv1.empty();
+
+	// Neighbors of each sample, as indices into samples
+	vector< vector<int> > nbrs(n);
+#pragma omp parallel for schedule(dynamic,64)
+	for (int i = 0; i < n; i++) {
+		vector<const float *> found;
+		kd->find_in_radius(found, pts[i], sqr(radius));
+		for (size_t j = 0; j < found.size(); j++) {
+			int ind = kd->index_of(found[j]);
+			if (ind != i)
+				nbrs[i].push_back(ind);
+		}
+		sort(nbrs[i].begin(), nbrs[i].end());
+	}
+
+	// Simplified point feature histograms
+	vector<float> spfh(n * SPFH_SIZE);
+#pragma omp parallel for schedule(dynamic,64)
+	for (int i = 0; i < n; i++) {
+		float *h = &spfh[i * SPFH_SIZE];
+		int nn = nbrs[i].size();
+		if (!nn)
+			continue;
+		const vec &ni = mesh->normals[samples[i]];
+		for (int k = 0; k < nn; k++) {
+			int j = nbrs[i][k];
+			const vec &nj = mesh->normals[samples[j]];
+			vec d = pts[j] - pts[i];
+			normalize(d);
+			vec u = ni, v = u CROSS d;
+			if (!normalize(v))
+				continue;
+			vec w = u CROSS v;
+			float alpha = v DOT nj;
+			float phi = u DOT d;
+			float theta = atan2(w DOT nj, u DOT nj);
+			int b0 = int(FPFH_BINS * 0.5f * (alpha + 1.0f));
+			int b1 = int(FPFH_BINS * 0.5f * (phi + 1.0f));
+			int b2 = int(FPFH_BINS * (theta + M_PIf) / (2.0f * M_PIf));
+			h[clamp(b0, 0, FPFH_BINS - 1)] += 1.0f;
+			h[FPFH_BINS + clamp(b1, 0, FPFH_BINS - 1)] += 1.0f;
+			h[2*FPFH_BINS + clamp(b2, 0, FPFH_BINS - 1)] += 1.0f;
+		}
+		float scale = 100.0f / nn;
+		for (int k = 0; k < SPFH_SIZE; k++)
+			h[k] *= scale;
+	}
+
+	// Combine with distance-weighted neighbor histograms, and add shape
+	// index histogram
+	desc.clear();
+	desc.resize(n * DESC_SIZE);
+#pragma omp parallel for schedule(dynamic,64)
+	for (int i = 0; i < n; i++) {
+		float *d = &desc[i * DESC_SIZE];
+		int nn = nbrs[i].size();
+		const float *hi = &spfh[i * SPFH_SIZE];
+		for (int k = 0; k < SPFH_SIZE; k++)
+			d[k] = hi[k];
+		if (!nn)
+			continue;
+		float wscale = 1.0f / nn;
+		for (int m = 0; m < nn; m++) {
+			int j = nbrs[i][m];
+			float w = wscale / max(dist(pts[i], pts[j]), 1.0e-6f * radius);
+			w *= radius;
+			const float *hj = &spfh[j * SPFH_SIZE];
+			for (int k = 0; k < SPFH_SIZE; k++)
+				d[k] += w * hj[k];
+		}
+		// Renormalize each angular histogram
+		for (int b = 0; b < 3; b++) {
+			float sum = 0.0f;
+			for (int k = 0; k < FPFH_BINS; k++)
+				sum += d[b * FPFH_BINS + k];
+			if (sum > 0.0f)
+				for (int k = 0; k < FPFH_BINS; k++)
+					d[b * FPFH_BINS + k] *= 100.0f / sum;
+		}
+
+		if (!have_curv)
+			continue;
+		float *si = d + SPFH_SIZE;
+		for (int m = -1; m < nn; m++) {
+			int v = samples[(m < 0) ? i : nbrs[i][m]];
+			float k1 = mesh->curv1[v], k2 = mesh->curv2[v];
+			float kmax = max(k1, k2), kmin = min(k1, k2);
+			float s = (2.0f / M_PIf) * atan2(kmax + kmin, kmax - kmin);
+			int b = int(SI_BINS * 0.5f * (s + 1.0f));
+			si[clamp(b, 0, SI_BINS - 1)] += 100.0f / (nn + 1);
+		}
+	}
+}
+
+
+// Squared distance between descriptors
+static inline float desc_dist2(const float *a, const float *b)
+{
+	float d2 = 0.0f;
+	for (int k = 0; k < DESC_SIZE; k++)
+		d2 += sqr(a[k] - b[k]);
+	return d2;
+}
+
+
+// For each descriptor in a, find the index of the closest one in b
+static void match_descriptors(const vector<float> &a, const vector<float> &b,
+			      vector<int> &match)
+{
+	int na = a.size() / DESC_SIZE, nb = b.size() / DESC_SIZE;
+	match.resize(na);
+#pragma omp parallel for schedule(dynamic,64)
+	for (int i = 0; i < na; i++) {
+		const float *ai = &a[i * DESC_SIZE];
+		float best = 3.0e38f;
+		int bestj = -1;
+		for (int j = 0; j < nb; j++) {
+			float d2 = desc_dist2(ai, &b[j * DESC_SIZE]);
+			if (d2 < best) {
+				best = d2;
+				bestj = j;
+			}
+		}
+		match[i] = bestj;
+	}
+}
+
+
+// Least-squares rigid transform taking p2[i] to p1[i], over the given
+// subset of indices, using the quaternion method of
+//  Horn, B.
+//  "Closed-form Solution of Absolute Orientation Using Unit Quaternions,"
+//  JOSA A, 1987.
+static xform rigid_fit(const vector<point> &p1, const vector<point> &p2,
+		       const int *inds, int n)
+{
+	Vec<3,double> c1, c2;
+	for (int i = 0; i < n; i++) {
+		c1 += Vec<3,double>(p1[inds[i]]);
+		c2 += Vec<3,double>(p2[inds[i]]);
+	}
+	c1 /= double(n);
+	c2 /= double(n);
+
+	double S[3][3] = { { 0 } };
+	for (int i = 0; i < n; i++) {
+		Vec<3,double> a = Vec<3,double>(p2[inds[i]]) - c2;
+		Vec<3,double> b = Vec<3,double>(p1[inds[i]]) - c1;
+		for (int j = 0; j < 3; j++)
+			for (int k = 0; k < 3; k++)
+				S[j][k] += a[j] * b[k];
+	}
+
+	double N[4][4] = {
+		{ S[0][0] + S[1][1] + S[2][2], S[1][2] - S[2][1],
+		  S[2][0] - S[0][2], S[0][1] - S[1][0] },
+		{ S[1][2] - S[2][1], S[0][0] - S[1][1] - S[2][2],
+		  S[0][1] + S[1][0], S[2][0] + S[0][2] },
+		{ S[2][0] - S[0][2], S[0][1] + S[1][0],
+		  -S[0][0] + S[1][1] - S[2][2], S[1][2] + S[2][1] },
+		{ S[0][1] - S[1][0], S[2][0] + S[0][2],
+		  S[1][2] + S[2][1], -S[0][0] - S[1][1] + S[2][2] }
+	};
+	double eval[4];
+	eigdc<double,4>(N, eval);
+
+	// Eigenvector of largest eigenvalue is the rotation quaternion
+	double qw = N[0][3];
+	Vec<3,double> axis(N[1][3], N[2][3], N[3][3]);
+	double ang = 2.0 * atan2(len(axis), qw);
+	xform R = (len(axis) > 0.0) ? xform::rot(ang, axis) : xform();
+	return xform::trans(c1) * R * xform::trans(-c2);
+}
+
+
+// Count correspondences within sqrt(maxdist2) under xf, optionally
+// listing them
+static int count_inliers(const vector<point> &p1, const vector<point> &p2,
+			 const xform &xf, float maxdist2,
+			 vector<int> *inliers = NULL)
+{
+	int n = p1.size(), count = 0;
+	if (inliers)
+		inliers->clear();
+	for (int i = 0; i < n; i++) {
+		if (dist2(xf * p2[i], p1[i]) < maxdist2) {
+			count++;
+			if (inliers)
+				inliers->push_back(i);
+		}
+	}
+	return count;
+}
+
+
+// Align mesh s2 to s1 without any initial guess, setting xf2.
+// Returns the fraction of feature correspondences that are inliers under
+// the final transform, or -1 on failure.
+float global_register(TriMesh *s1, TriMesh *s2,
+		      const xform &xf1, xform &xf2,
+		      const GlobalReg_params &params)
+{
+	timestamp t0 = now();
+	int verbose = params.verbose;
+	TriMesh *meshes[2] = { s1, s2 };
+	vector<int> samples[2];
+	vector<point> pts[2];
+	float spacing = 0.0f;
+
+	for (int m = 0; m < 2; m++) {
+		TriMesh *mesh = meshes[m];
+		mesh->need_normals();
+		if (params.use_curvature) {
+			mesh->need_faces();
+			if (!mesh->faces.empty())
+				mesh->need_curvatures();
+		}
+		pick_samples(mesh, params.nsamples, samples[m]);
+		int n = samples[m].size();
+		if (n < 3) {
+			if (verbose)
+				dprintf("Too few points for global registration\n");
+			return -1.0f;
+		}
+		pts[m].resize(n);
+		for (int i = 0; i < n; i++)
+			pts[m][i] = mesh->vertices[samples[m][i]];
+	}
+
+	// Neighborhood sizes are set from the sample spacing of the sparser
+	// mesh, so that descriptors on both meshes cover the same area
+	KDtree kd1(pts[0]), kd2(pts[1]);
+	const KDtree *kds[2] = { &kd1, &kd2 };
+	float radius = params.radius, inlier_dist = params.inlier_dist;
+	if (radius <= 0.0f || inlier_dist <= 0.0f) {
+		spacing = max(sample_spacing(pts[0], &kd1),
+			      sample_spacing(pts[1], &kd2));
+		if (radius <= 0.0f)
+			radius = RADIUS_SPACING * spacing;
+		if (inlier_dist <= 0.0f)
+			inlier_dist = INLIER_SPACING * spacing;
+	}
+
+	vector<float> desc[2];
+	for (int m = 0; m < 2; m++)
+		compute_descriptors(meshes[m], samples[m], pts[m], kds[m],
+				    radius, desc[m]);
+	timestamp t1 = now();
+	if (verbose > 1)
+		dprintf("Computed descriptors for %lu + %lu samples, radius %g: %.2f msec\n",
+			(unsigned long) samples[0].size(),
+			(unsigned long) samples[1].size(), radius,
+			(t1 - t0) * 1000.0f);
+
+	// Correspondences: mutual nearest neighbors in descriptor space,
+	// or all forward matches if there are too few of those
+	vector<int> match12, match21;
+	match_descriptors(desc[1], desc[0], match21);
+	match_descriptors(desc[0], desc[1], match12);
+	vector<point> c1, c2;
+	for (size_t i = 0; i < match21.size(); i++) {
+		int j = match21[i];
+		if (match12[j] == (int) i) {
+			c1.push_back(xf1 * pts[0][j]);
+			c2.push_back(pts[1][i]);
+		}
+	}
+	if ((int) c1.size() < 3 * params.min_inliers) {
+		c1.clear(); c2.clear();
+		for (size_t i = 0; i < match21.size(); i++) {
+			c1.push_back(xf1 * pts[0][match21[i]]);
+			c2.push_back(pts[1][i]);
+		}
+	}
+	int ncorr = c1.size();
+	timestamp t2 = now();
+	if (verbose > 1)
+		dprintf("%d correspondences: %.2f msec\n", ncorr,
+			(t2 - t1) * 1000.0f);
+
+	// RANSAC.  The best hypothesis is the one with the most inliers,
+	// ties broken by lowest iteration number.
+	float inlier_d2 = sqr(inlier_dist);
+	int best_count = 0, best_iter = -1;
+#pragma omp parallel
+	{
+		int my_count = 0, my_iter = -1;
+#pragma omp for schedule(dynamic,256) nowait
+		for (int iter = 0; iter < params.ransac_iters; iter++) {
+			int inds[3];
+			inds[0] = rnd_uint(params.seed, iter, 0) % ncorr;
+			inds[1] = rnd_uint(params.seed, iter, 1) % ncorr;
+			inds[2] = rnd_uint(params.seed, iter, 2) % ncorr;
+			if (inds[0] == inds[1] || inds[1] == inds[2] ||
+			    inds[0] == inds[2])
+				continue;
+
+			// Prune by edge-length consistency and degeneracy
+			bool ok = true;
+			for (int k = 0; k < 3 && ok; k++) {
+				int a = inds[k], b = inds[(k+1)%3];
+				float d1 = dist(c1[a], c1[b]);
+				float d2 = dist(c2[a], c2[b]);
+				if (d1 < inlier_dist || d2 < inlier_dist ||
+				    min(d1, d2) < EDGE_SIMILARITY * max(d1, d2))
+					ok = false;
+			}
+			if (!ok)
+				continue;
+
+			xform xf = rigid_fit(c1, c2, inds, 3);
+			int count = count_inliers(c1, c2, xf, inlier_d2);
+			if (count > my_count) {
+				my_count = count;
+				my_iter = iter;
+			}
+		}
+#pragma omp critical
+		{
+			if (my_count > best_count ||
+			    (my_count == best_count && my_count &&
+			     my_iter < best_iter)) {
+				best_count = my_count;
+				best_iter = my_iter;
+			}
+		}
+	}
+
+	if (best_count < max(params.min_inliers, 3)) {
+		if (verbose)
+			dprintf("Global registration failed: %d inliers of %d\n",
+				best_count, ncorr);
+		return -1.0f;
+	}
+
+	// Re-derive the winning hypothesis, then refine on its inliers
+	int inds[3];
+	for (int k = 0; k < 3; k++)
+		inds[k] = rnd_uint(params.seed, best_iter, k) % ncorr;
+	xform xf = rigid_fit(c1, c2, inds, 3);
+	vector<int> inliers;
+	count_inliers(c1, c2, xf, inlier_d2, &inliers);
+	for (int i = 0; i < REFINE_ITERS; i++) {
+		xform newxf = rigid_fit(c1, c2, &inliers[0], inliers.size());
+		vector<int> newinliers;
+		count_inliers(c1, c2, newxf, inlier_d2, &newinliers);
+		if (newinliers.size() < inliers.size())
+			break;
+		xf = newxf;
+		inliers.swap(newinliers);
+	}
+	xf2 = xf;
+
+	float frac = (float) inliers.size() / ncorr;
+	timestamp t3 = now();
+	if (verbose > 1)
+		dprintf("RANSAC: %d inliers of %d: %.2f msec\n",
+			(int) inliers.size(), ncorr, (t3 - t2) * 1000.0f);
+	if (verbose)
+		dprintf("Global registration: %.1f%% inliers, %.2f msec\n",
+			100.0f * frac, (t3 - t0) * 1000.0f);
+	return frac;
+}
+
+}; // namespace trimesh
@@ -0,0 +1,319 @@
+/*
+Szymon Rusinkiewicz
+Princeton University
+
+implicit_smooth.cc
+Mesh Laplacians, and implicit smoothing with them, as in
+  M. Desbrun, M. Meyer, P. Schroeder, and A. Barr,
+  "Implicit Fairing of Irregular Meshes using Diffusion and Curvature Flow",
+  SIGGRAPH 1999.
+*/
+
+#include "TriMesh.h"
+#include "TriMesh_algo.h"
+#include "timestamp.h"
+#include <vector>
+#include <cfloat>
+using namespace std;
+#define dprintf TriMesh::dprintf
+
+
+// i+1 and i-1 modulo 3
+#define NEXT(i) ((i)<2 ? (i)+1 : (i)-2)
+#define PREV(i) ((i)>0 ? (i)-1 : (i)+2)
+
+// Rows per block in the reductions of the conjugate gradient solver.  Fixed,
+// rather than one per thread, so the result doesn't depend on the number
+// of threads.
+#define CG_BLOCK 4096
+
+
+namespace trimesh {
+
+// Build the Laplacian.  The rows have the same layout as mesh->neighbors.
+// Cotangent weights are summed over the faces of each edge in increasing
+// order, the same from both ends, so the matrix is exactly symmetric.
+void build_laplacian(TriMesh *mesh, Laplacian &L,
+	int scheme /* = LAPLACIAN_UNIFORM */)
+{
+	mesh->need_faces();
+	mesh->need_neighbors();
+	mesh->need_adjacentfaces();
+	int nv = mesh->vertices.size(), nf = mesh->faces.size();
+
+	L.scheme = scheme;
+	L.off = mesh->neighbors.off;
+	L.ind = mesh->neighbors.ind;
+	L.wt.clear();
+	L.wt.resize(L.ind.size());
+	L.diag.resize(nv);
+	L.bdy.resize(nv);
+
+	// Cotangents of the angles at the corners of each face
+	vector<vec> cots;
+	if (scheme == LAPLACIAN_COTAN) {
+		cots.resize(nf);
+#pragma omp parallel for
+		for (int i = 0; i < nf; i++) {
+			const TriMesh::Face &f = mesh->faces[i];
+			for (int j = 0; j < 3; j++) {
+				vec e1 = mesh->vertices[f[NEXT(j)]] -
+					 mesh->vertices[f[j]];
+				vec e2 = mesh->vertices[f[PREV(j)]] -
+					 mesh->vertices[f[j]];
+				float s = len(e1 CROSS e2);
+				cots[i][j] = (s > 0.0f) ? (e1 DOT e2) / s : 0.0f;
+			}
+		}
+	}
+
+#pragma omp parallel for
+	for (int i = 0; i < nv; i++) {
+		TriMesh::Adjacency::Row n = mesh->neighbors[i];
+		TriMesh::Adjacency::Row a = mesh->adjacentfaces[i];
+		float *w = L.wt.empty() ? 0 : &L.wt[L.off[i]];
+		L.bdy[i] = (n.size() != a.size()) || n.empty();
+		if (scheme != LAPLACIAN_COTAN) {
+			for (size_t j = 0; j < n.size(); j++)
+				w[j] = 1.0f;
+			L.diag[i] = n.size();
+			continue;
+		}
+
+		// Each face adds half the cotangent of the angle opposite
+		// each of its two edges at i
+		for (size_t k = 0; k < a.size(); k++) {
+			const TriMesh::Face &f = mesh->faces[a[k]];
+			int c = f.indexof(i);
+			for (size_t j = 0; j < n.size(); j++) {
+				if (n[j] == f[NEXT(c)])
+					w[j] += 0.5f * cots[a[k]][PREV(c)];
+				else if (n[j] == f[PREV(c)])
+					w[j] += 0.5f * cots[a[k]][NEXT(c)];
+			}
+		}
+		float sum = 0;
+		for (size_t j = 0; j < n.size(); j++)
+			sum += w[j];
+		L.diag[i] = sum;
+	}
+}
+
+
+// Sum the per-block partial sums of each coordinate, in order
+static void sum_blocks(const vector<double> &partial, double sum[3])
+{
+	sum[0] = sum[1] = sum[2] = 0;
+	for (size_t b = 0; b < partial.size(); b += 3) {
+		sum[0] += partial[b];
+		sum[1] += partial[b+1];
+		sum[2] += partial[b+2];
+	}
+}
+
+
+// Helper for solve_system: y = A x, where A = M + lambda L, at the rows that
+// aren't fixed.  Also finds dot(x, A x) for each coordinate.
+static void apply_system(const Laplacian &L, const vector<float> &adiag,
+	float lambda, const vector<vec> &x, vector<vec> &y, double xAx[3])
+{
+	int nv = x.size();
+	int nblocks = (nv + CG_BLOCK - 1) / CG_BLOCK;
+	vector<double> partial(3 * nblocks);
+#pragma omp parallel for
+	for (int b = 0; b < nblocks; b++) {
+		int end = min(nv, (b + 1) * CG_BLOCK);
+		double sum[3] = { 0, 0, 0 };
+		for (int i = b * CG_BLOCK; i < end; i++) {
+			float yi[3] = { 0, 0, 0 };
+			if (!L.bdy[i]) {
+				for (int c = 0; c < 3; c++)
+					yi[c] = adiag[i] * x[i][c];
+				for (index_t k = L.off[i]; k < L.off[i+1]; k++) {
+					float w = lambda * L.wt[k];
+					const vec &xj = x[L.ind[k]];
+					for (int c = 0; c < 3; c++)
+						yi[c] -= w * xj[c];
+				}
+			}
+			for (int c = 0; c < 3; c++) {
+				y[i][c] = yi[c];
+				sum[c] += double(x[i][c]) * yi[c];
+			}
+		}
+		for (int c = 0; c < 3; c++)
+			partial[3*b+c] = sum[c];
+	}
+	sum_blocks(partial, xAx);
+}
+
+
+// Solve (M + lambda L) x = M x0 by conjugate gradients, preconditioned by
+// the diagonal, for all three coordinates at once.  x holds the initial
+// guess, and fixed vertices keep their values.  Stops when the residual of
+// every coordinate is down by a factor of tol.  Returns the number of
+// iterations.
+static int solve_system(const Laplacian &L, const vector<float> &mass,
+	float lambda, const vector<point> &x0, vector<point> &x,
+	int maxiters, float tol)
+{
+	int nv = x.size();
+	int nblocks = (nv + CG_BLOCK - 1) / CG_BLOCK;
+	vector<double> partial(3 * nblocks), partial2(3 * nblocks);
+	vector<float> adiag(nv);
+	vector<vec> r(nv), z(nv), p(nv), Ap(nv);
+
+#pragma omp parallel for
+	for (int i = 0; i < nv; i++)
+		adiag[i] = mass[i] + lambda * L.diag[i];
+
+	// r = b - A x, z = r / diag(A), p = z
+	double pAp[3];
+	apply_system(L, adiag, lambda, x, Ap, pAp);
+#pragma omp parallel for
+	for (int b = 0; b < nblocks; b++) {
+		int end = min(nv, (b + 1) * CG_BLOCK);
+		double rz[3] = { 0, 0, 0 }, bb[3] = { 0, 0, 0 };
+		for (int i = b * CG_BLOCK; i < end; i++) {
+			if (L.bdy[i])
+				continue;
+			for (int c = 0; c < 3; c++) {
+				float bi = mass[i] * x0[i][c];
+				r[i][c] = bi - Ap[i][c];
+				z[i][c] = r[i][c] / adiag[i];
+				p[i][c] = z[i][c];
+				rz[c] += double(r[i][c]) * z[i][c];
+				bb[c] += double(bi) * bi;
+			}
+		}
+		for (int c = 0; c < 3; c++) {
+			partial[3*b+c] = rz[c];
+			partial2[3*b+c] = bb[c];
+		}
+	}
+	double rz[3], bb[3], rr[3];
+	sum_blocks(partial, rz);
+	sum_blocks(partial2, bb);
+
+	int iter = 0;
+	while (iter < maxiters) {
+		iter++;
+		apply_system(L, adiag, lambda, p, Ap, pAp);
+		float alpha[3];
+		for (int c = 0; c < 3; c++)
+			alpha[c] = (pAp[c] > 0.0) ? float(rz[c] / pAp[c]) : 0.0f;
+
+		// Update x and r, and find the new z
+#pragma omp parallel for
+		for (int b = 0; b < nblocks; b++) {
+			int end = min(nv, (b + 1) * CG_BLOCK);
+			double rz_b[3] = { 0, 0, 0 }, rr_b[3] = { 0, 0, 0 };
+			for (int i = b * CG_BLOCK; i < end; i++) {
+				if (L.bdy[i])
+					continue;
+				for (int c = 0; c < 3; c++) {
+					x[i][c] += alpha[c] * p[i][c];
+					r[i][c] -= alpha[c] * Ap[i][c];
+					z[i][c] = r[i][c] / adiag[i];
+					rz_b[c] += double(r[i][c]) * z[i][c];
+					rr_b[c] += double(r[i][c]) * r[i][c];
+				}
+			}
+			for (int c = 0; c < 3; c++) {
+				partial[3*b+c] = rz_b[c];
+				partial2[3*b+c] = rr_b[c];
+			}
+		}
+		double rz_new[3];
+		sum_blocks(partial, rz_new);
+		sum_blocks(partial2, rr);
+
+		bool done = true;
+		float beta[3];
+		for (int c = 0; c < 3; c++) {
+			if (rr[c] > sqr(double(tol)) * bb[c])
+				done = false;
+			beta[c] = (rz[c] > 0.0) ? float(rz_new[c] / rz[c]) : 0.0f;
+			rz[c] = rz_new[c];
+		}
+		if (done)
+			break;
+
+#pragma omp parallel for
+		for (int i = 0; i < nv; i++) {
+			for (int c = 0; c < 3; c++)
+				p[i][c] = z[i][c] + beta[c] * p[i][c];
+		}
+	}
+	return iter;
+}
+
+
+// Implicit smoothing: each step solves (M + lambda L) x = M x0, where x0 is
+// the current positions and M is a diagonal mass matrix, scaled so that a
+// given lambda smooths about as much with either Laplacian.  Boundary
+// vertices stay fixed.  Each solve starts from the previous one's solution,
+// moved along by the previous step's displacement.
+void implicit_smooth(TriMesh *mesh, float lambda,
+	int scheme /* = LAPLACIAN_COTAN */, int niters /* = 1 */)
+{
+	mesh->need_faces();
+	int nv = mesh->vertices.size();
+	if (!nv)
+		return;
+
+	dprintf("Implicit smoothing... ");
+	timestamp t = now();
+	int total_iters = 0;
+
+	Laplacian L;
+	vector<float> mass(nv);
+	vector<point> x0, disp(nv);
+	for (int iter = 0; iter < niters; iter++) {
+		// The uniform Laplacian depends only on connectivity
+		if (iter == 0 || scheme == LAPLACIAN_COTAN)
+			build_laplacian(mesh, L, scheme);
+
+		if (scheme == LAPLACIAN_COTAN) {
+			// Degenerate faces can leave a vertex without a usable
+			// (positive, finite) area.  Those are held fixed, and
+			// left out of the scale.
+			mesh->need_pointareas();
+			const vector<float> &areas = mesh->pointareas;
+			double sum_diag = 0, sum_area = 0;
+			for (int i = 0; i < nv; i++) {
+				if (!(areas[i] > 0.0f && areas[i] <= FLT_MAX)) {
+					L.bdy[i] = 1;
+					continue;
+				}
+				sum_diag += L.diag[i];
+				sum_area += areas[i];
+			}
+			float scale = sum_area > 0.0 ?
+				float(sum_diag / sum_area) : 1.0f;
+#pragma omp parallel for
+			for (int i = 0; i < nv; i++)
+				mass[i] = L.bdy[i] ? 0.0f : scale * areas[i];
+		} else {
+			mass = L.diag;
+		}
+
+		x0 = mesh->vertices;
+#pragma omp parallel for
+		for (int i = 0; i < nv; i++) {
+			if (!L.bdy[i])
+				mesh->vertices[i] += disp[i];
+		}
+		total_iters += solve_system(L, mass, lambda, x0,
+			mesh->vertices, 1000, 1.0e-6f);
+#pragma omp parallel for
+		for (int i = 0; i < nv; i++)
+			disp[i] = mesh->vertices[i] - x0[i];
+		mesh->changed_vertices();
+	}
+
+	dprintf("Done.  %d CG iterations, took %f sec.\n",
+		total_iters, now() - t);
+}
+
+}; // namespace trimesh
@@ -8,7 +8,17 @@ Taubin lambda/mu mesh smoothing
 
 #include "TriMesh.h"
 #include "TriMesh_algo.h"
+#include <algorithm>
+using namespace std;
 #define dprintf TriMesh::dprintf
+#define eprintf TriMesh::eprintf
+
+
+// Rows per chunk in the fused lambda/mu pass.  Each chunk also does the
+// first step for all the rows its neighbors span, so the fused pass is only
+// used if that adds up to at most TAUBIN_MAX_SPAN times the number of rows.
+#define TAUBIN_CHUNK 2048
+#define TAUBIN_MAX_SPAN 3
 
 
 namespace trimesh {
@@ -24,18 +34,20 @@ void umbrella(TriMesh *mesh, float stepsize, bool tangent /* = false */)
 	std::vector<vec> disp(nv);
 #pragma omp parallel for
 	for (int i = 0; i < nv; i++) {
-		if (mesh->is_bdy(i)) {
+		TriMesh::Adjacency::Row n = mesh->neighbors[i];
+		int nn = n.size();
+		if (nn != (int) mesh->adjacentfaces[i].size()) {
+			// Boundary vertex.
 			// Change to #if 1 to smooth boundaries.
 			// This way, we leave boundaries alone.
 #if 0
-			int nn = mesh->neighbors[i].size();
 			int nnused = 0;
 			if (!nn)
 				continue;
 			for (int j = 0; j < nn; j++) {
-				if (!mesh->is_bdy(mesh->neighbors[i][j]))
+				if (!mesh->is_bdy(n[j]))
 					continue;
-				disp[i] += mesh->vertices[mesh->neighbors[i][j]];
+				disp[i] += mesh->vertices[n[j]];
 				nnused++;
 			}
 			disp[i] /= nnused;
@@ -44,11 +56,10 @@ void umbrella(TriMesh *mesh, float stepsize, bool tangent /* = false */)
 			disp[i].clear();
 #endif
 		} else {
-			int nn = mesh->neighbors[i].size();
 			if (!nn)
 				continue;
 			for (int j = 0; j < nn; j++)
-				disp[i] += mesh->vertices[mesh->neighbors[i][j]];
+				disp[i] += mesh->vertices[n[j]];
 			disp[i] /= (float)nn;
 			disp[i] -= mesh->vertices[i];
 		}
@@ -66,25 +77,253 @@ void umbrella(TriMesh *mesh, float stepsize, bool tangent /* = false */)
 			mesh->vertices[i] += stepsize * disp[i];
 	}
 
-	mesh->bbox.valid = false;
-	mesh->bsphere.valid = false;
+	mesh->changed_vertices();
 }
 
 
-// Several iterations of Taubin lambda/mu
-void lmsmooth(TriMesh *mesh, int niters)
+// Build the umbrella operator.  Rows are the same as in umbrella(), except
+// stored as described in TriMesh_algo.h.
+void build_umbrella(TriMesh *mesh, UmbrellaOp &op)
 {
 	mesh->need_neighbors();
 	mesh->need_adjacentfaces();
+	const index_t G = UmbrellaOp::GROUP;
+	index_t nv = mesh->vertices.size();
+	index_t ngroups = (nv + G - 1) / G;
+	op.nv = nv;
+	op.npad = ngroups * G;
+	op.topology = mesh->topology_version;
+	op.count.clear();
+	op.count.resize(op.npad, 1.0f);
+	op.keep.clear();
+	op.keep.resize(op.npad);
+
+	// Width of each group
+	vector<index_t> size(ngroups);
+#pragma omp parallel for
+	for (index_t g = 0; g < ngroups; g++) {
+		index_t w = 0;
+		for (index_t i = g * G; i < min(nv, (g + 1) * G); i++)
+			w = max(w, (index_t) mesh->neighbors[i].size());
+		size[g] = w * G;
+	}
+	prefix_sum(size, op.start);
+	op.ind.clear();
+	op.ind.resize(op.start[ngroups], op.npad);
+
+#pragma omp parallel for
+	for (index_t g = 0; g < ngroups; g++) {
+		for (index_t r = 0; r < G && g * G + r < nv; r++) {
+			index_t i = g * G + r;
+			TriMesh::Adjacency::Row n = mesh->neighbors[i];
+			index_t nn = n.size();
+			if (!nn)
+				continue;
+			op.count[i] = nn;
+			op.keep[i] = (nn == (index_t) mesh->adjacentfaces[i].size());
+			for (index_t k = 0; k < nn; k++)
+				op.ind[op.start[g] + k * G + r] = n[k];
+		}
+	}
+}
+
+
+// One umbrella step for group g.  Reads rows from x, y, and z, offset by
+// base, and the padding from index zero.  Writes the group's rows to ox,
+// oy, and oz.
+static inline void umbrella_group(const UmbrellaOp &op, index_t g,
+	const float *x, const float *y, const float *z,
+	index_t base, index_t zero, float stepsize,
+	float *ox, float *oy, float *oz)
+{
+	const int G = UmbrellaOp::GROUP;
+	float sx[G], sy[G], sz[G];
+	for (int r = 0; r < G; r++)
+		sx[r] = sy[r] = sz[r] = 0.0f;
+
+	const index_t *ind = op.ind.empty() ? 0 : &op.ind[op.start[g]];
+	index_t w = (op.start[g+1] - op.start[g]) / G;
+	for (index_t k = 0; k < w; k++, ind += G) {
+		for (int r = 0; r < G; r++) {
+			index_t j = min(ind[r] - base, zero);
+			sx[r] += x[j];
+			sy[r] += y[j];
+			sz[r] += z[j];
+		}
+	}
+
+	index_t i0 = g * G;
+	const float *count = &op.count[i0], *keep = &op.keep[i0];
+	x += i0 - base; y += i0 - base; z += i0 - base;
+	for (int r = 0; r < G; r++) {
+		ox[r] = x[r] + stepsize * (sx[r] / count[r] - x[r]) * keep[r];
+		oy[r] = y[r] + stepsize * (sy[r] / count[r] - y[r]) * keep[r];
+		oz[r] = z[r] + stepsize * (sz[r] / count[r] - z[r]) * keep[r];
+	}
+}
+
+
+// Helpers: copy vertices to and from structure-of-arrays form, with
+// padding and the zero at the end
+static void to_soa(const TriMesh *mesh, const UmbrellaOp &op,
+	vector<float> &x, vector<float> &y, vector<float> &z)
+{
+	x.clear(); x.resize(op.npad + 1);
+	y.clear(); y.resize(op.npad + 1);
+	z.clear(); z.resize(op.npad + 1);
+	index_t nv = op.nv;
+#pragma omp parallel for
+	for (index_t i = 0; i < nv; i++) {
+		x[i] = mesh->vertices[i][0];
+		y[i] = mesh->vertices[i][1];
+		z[i] = mesh->vertices[i][2];
+	}
+}
+
+static void from_soa(TriMesh *mesh, const UmbrellaOp &op,
+	const vector<float> &x, const vector<float> &y, const vector<float> &z)
+{
+	index_t nv = op.nv;
+#pragma omp parallel for
+	for (index_t i = 0; i < nv; i++)
+		mesh->vertices[i] = point(x[i], y[i], z[i]);
+	mesh->changed_vertices();
+}
+
+
+// Whole-mesh umbrella step from (x,y,z) to (ox,oy,oz)
+static void umbrella_step(const UmbrellaOp &op, float stepsize,
+	const vector<float> &x, const vector<float> &y, const vector<float> &z,
+	vector<float> &ox, vector<float> &oy, vector<float> &oz)
+{
+	const index_t G = UmbrellaOp::GROUP;
+	index_t ngroups = op.npad / G;
+#pragma omp parallel for
+	for (index_t g = 0; g < ngroups; g++)
+		umbrella_group(op, g, &x[0], &y[0], &z[0], 0, op.npad, stepsize,
+			&ox[g*G], &oy[g*G], &oz[g*G]);
+}
+
+
+// Iterations of umbrella-operator smoothing, with a precomputed operator.
+// Gives the same result as calling umbrella(mesh, stepsize) niters times.
+void umbrella(TriMesh *mesh, const UmbrellaOp &op, float stepsize,
+	int niters /* = 1 */)
+{
+	if ((index_t) mesh->vertices.size() != op.nv ||
+	    mesh->topology_version != op.topology) {
+		eprintf("Umbrella operator doesn't match the mesh!\n");
+		return;
+	}
+	if (!op.nv)
+		return;
+
+	vector<float> x, y, z, ox, oy, oz;
+	to_soa(mesh, op, x, y, z);
+	ox = x; oy = y; oz = z;
+	for (int iter = 0; iter < niters; iter++) {
+		umbrella_step(op, stepsize, x, y, z, ox, oy, oz);
+		x.swap(ox); y.swap(oy); z.swap(oz);
+	}
+	from_soa(mesh, op, x, y, z);
+}
+
+
+// Several iterations of Taubin lambda/mu, with a precomputed operator.
+// Each chunk of rows does the lambda step for itself and the rows its
+// neighbors can reach, into a buffer that stays in cache, then the mu step
+// from that buffer.  Gives the same result as alternating umbrella() calls.
+void lmsmooth(TriMesh *mesh, const UmbrellaOp &op, int niters,
+	float lambda /* = 0.330f */, float mu /* = -0.331f */)
+{
+	if ((index_t) mesh->vertices.size() != op.nv ||
+	    mesh->topology_version != op.topology) {
+		eprintf("Umbrella operator doesn't match the mesh!\n");
+		return;
+	}
+	if (!op.nv)
+		return;
+
 	dprintf("Smoothing mesh... ");
-	for (int i = 0; i < niters; i++) {
-		umbrella(mesh, 0.330f);
-		umbrella(mesh, -0.331f);
+	vector<float> x, y, z, ox, oy, oz;
+	to_soa(mesh, op, x, y, z);
+	ox = x; oy = y; oz = z;
+
+	// Range of rows spanned by each chunk and its neighbors
+	const index_t G = UmbrellaOp::GROUP;
+	index_t nchunks = (op.npad + TAUBIN_CHUNK - 1) / TAUBIN_CHUNK;
+	vector<index_t> lo(nchunks), hi(nchunks);
+#pragma omp parallel for
+	for (index_t c = 0; c < nchunks; c++) {
+		index_t s = c * TAUBIN_CHUNK;
+		index_t e = min(op.npad, s + TAUBIN_CHUNK);
+		index_t l = s, h = e;
+		for (index_t k = op.start[s/G]; k < op.start[e/G]; k++) {
+			if (op.ind[k] == op.npad)
+				continue;
+			l = min(l, op.ind[k]);
+			h = max(h, op.ind[k] + 1);
+		}
+		lo[c] = l / G * G;
+		hi[c] = (h + G - 1) / G * G;
 	}
+	index_t maxspan = 0;
+	double totalspan = 0;
+	for (index_t c = 0; c < nchunks; c++) {
+		maxspan = max(maxspan, hi[c] - lo[c]);
+		totalspan += hi[c] - lo[c];
+	}
+
+	if (totalspan > TAUBIN_MAX_SPAN * double(op.npad)) {
+		// Vertex order too scattered: two passes
+		for (int iter = 0; iter < niters; iter++) {
+			umbrella_step(op, lambda, x, y, z, ox, oy, oz);
+			umbrella_step(op, mu, ox, oy, oz, x, y, z);
+		}
+		from_soa(mesh, op, x, y, z);
+		dprintf("Done.\n");
+		return;
+	}
+
+	for (int iter = 0; iter < niters; iter++) {
+#pragma omp parallel
+		{
+			// Thread-local results of the lambda step
+			vector<float> bx(maxspan + 1), by(maxspan + 1),
+				bz(maxspan + 1);
+
+#pragma omp for
+			for (index_t c = 0; c < nchunks; c++) {
+				index_t s = c * TAUBIN_CHUNK;
+				index_t e = min(op.npad, s + TAUBIN_CHUNK);
+				index_t zero = hi[c] - lo[c];
+				bx[zero] = by[zero] = bz[zero] = 0.0f;
+				for (index_t g = lo[c] / G; g < hi[c] / G; g++) {
+					index_t b = g * G - lo[c];
+					umbrella_group(op, g, &x[0], &y[0], &z[0],
+						0, op.npad, lambda,
+						&bx[b], &by[b], &bz[b]);
+				}
+				for (index_t g = s / G; g < e / G; g++)
+					umbrella_group(op, g, &bx[0], &by[0], &bz[0],
+						lo[c], zero, mu,
+						&ox[g*G], &oy[g*G], &oz[g*G]);
+			}
+		} // #pragma omp parallel
+		x.swap(ox); y.swap(oy); z.swap(oz);
+	}
+
+	from_soa(mesh, op, x, y, z);
 	dprintf("Done.\n");
+}
 
-	mesh->bbox.valid = false;
-	mesh->bsphere.valid = false;
+
+// Several iterations of Taubin lambda/mu
+void lmsmooth(TriMesh *mesh, int niters)
+{
+	UmbrellaOp op;
+	build_umbrella(mesh, op);
+	lmsmooth(mesh, op, niters);
 }
 
 }; // namespace trimesh
@@ -0,0 +1,235 @@
+/*
+Szymon Rusinkiewicz
+Princeton University
+
+meshlets.cc
+Partition a mesh into small clusters of faces ("meshlets"), each with a
+bounding sphere and a cone containing its normals, and cull them on the CPU.
+*/
+
+#include "TriMesh.h"
+#include "TriMesh_algo.h"
+#include <vector>
+#include <algorithm>
+using namespace std;
+#define dprintf TriMesh::dprintf
+
+
+namespace trimesh {
+
+// Helper for build_meshlets: fill in the bounding sphere and normal cone of
+// a finished meshlet
+static void meshlet_bounds(const TriMesh *mesh, const Meshlets &ml,
+	Meshlet &m)
+{
+	// Bounding sphere around the center of the bounding box
+	const index_t *v = &ml.verts[m.vert_offset];
+	box b;
+	for (unsigned i = 0; i < m.vert_count; i++)
+		b += mesh->vertices[v[i]];
+	m.center = b.center();
+	float r2 = 0;
+	for (unsigned i = 0; i < m.vert_count; i++)
+		r2 = max(r2, dist2(m.center, mesh->vertices[v[i]]));
+	m.radius = sqrt(r2);
+
+	// Normal cone: average the face normals, then find the one farthest
+	// from the average.  cone_cutoff is the sine of the cone's half-angle,
+	// or 1 if the normals cover a hemisphere or more.
+	const unsigned char *t = &ml.tris[3 * m.tri_offset];
+	vector<vec> normals;
+	vec axis;
+	for (unsigned i = 0; i < m.tri_count; i++) {
+		const point &p0 = mesh->vertices[v[t[3*i]]];
+		const point &p1 = mesh->vertices[v[t[3*i+1]]];
+		const point &p2 = mesh->vertices[v[t[3*i+2]]];
+		vec n = (p1 - p0) CROSS (p2 - p0);
+		if (len2(n) == 0.0f)
+			continue;
+		normalize(n);
+		normals.push_back(n);
+		axis += n;
+	}
+	m.cone_axis = vec(0, 0, 1);
+	m.cone_cutoff = 1.0f;
+	if (len2(axis) == 0.0f)
+		return;
+	normalize(axis);
+	float mindot = 1.0f;
+	for (size_t i = 0; i < normals.size(); i++)
+		mindot = min(mindot, axis DOT normals[i]);
+	m.cone_axis = axis;
+	if (mindot > 0.0f)
+		m.cone_cutoff = sqrt(1.0f - sqr(mindot));
+}
+
+
+// Greedily grow each meshlet from a seed face, adding the neighboring face
+// that brings in the fewest new vertices (and, among those, the one closest
+// to the meshlet's center) until a limit is reached.  The next seed is a
+// leftover neighbor of the last meshlet, so meshlets follow the surface.
+void build_meshlets(TriMesh *mesh, Meshlets &ml,
+	int max_verts /* = 64 */, int max_tris /* = 124 */)
+{
+	ml.meshlets.clear();
+	ml.verts.clear();
+	ml.tris.clear();
+	mesh->need_faces();
+	index_t nv = mesh->vertices.size(), nf = mesh->faces.size();
+	if (!nf)
+		return;
+
+	// Local indices are stored in bytes
+	max_verts = max(3, min(max_verts, 256));
+	max_tris = max(1, max_tris);
+
+	dprintf("Building meshlets... ");
+	mesh->need_adjacentfaces();
+
+	vector<bool> used(nf);
+	vector<int> local(nv, -1);
+	vector<index_t> candidates, next_candidates;
+	index_t cursor = 0, nused = 0;
+	while (nused < nf) {
+		Meshlet m;
+		m.vert_offset = ml.verts.size();
+		m.tri_offset = ml.tris.size() / 3;
+		m.vert_count = m.tri_count = 0;
+		point center;
+
+		// Seed: a leftover neighbor of the last meshlet, if any
+		index_t seed = -1;
+		for (size_t i = 0; i < next_candidates.size(); i++) {
+			if (!used[next_candidates[i]]) {
+				seed = next_candidates[i];
+				break;
+			}
+		}
+		if (seed < 0) {
+			while (used[cursor])
+				cursor++;
+			seed = cursor;
+		}
+		candidates.clear();
+		candidates.push_back(seed);
+
+		for (;;) {
+			// Pick the best candidate that fits
+			index_t best = -1;
+			int best_new = 4;
+			float best_d2 = 0;
+			for (size_t i = 0; i < candidates.size(); i++) {
+				index_t f = candidates[i];
+				if (used[f])
+					continue;
+				const TriMesh::Face &face = mesh->faces[f];
+				int nnew = (local[face[0]] < 0) +
+					   (local[face[1]] < 0) +
+					   (local[face[2]] < 0);
+				if ((int) m.vert_count + nnew > max_verts)
+					continue;
+				float d2 = dist2(center, mesh->centroid(f));
+				if (nnew < best_new ||
+				    (nnew == best_new && d2 < best_d2)) {
+					best = f;
+					best_new = nnew;
+					best_d2 = d2;
+				}
+			}
+			if (best < 0)
+				break;
+
+			// Add it
+			used[best] = true;
+			nused++;
+			const TriMesh::Face &face = mesh->faces[best];
+			for (int j = 0; j < 3; j++) {
+				index_t vj = face[j];
+				if (local[vj] < 0) {
+					local[vj] = m.vert_count++;
+					ml.verts.push_back(vj);
+					TriMesh::Adjacency::Row a =
+						mesh->adjacentfaces[vj];
+					for (size_t k = 0; k < a.size(); k++)
+						if (!used[a[k]])
+							candidates.push_back(a[k]);
+				}
+				ml.tris.push_back((unsigned char) local[vj]);
+			}
+			m.tri_count++;
+			center = (center * float(m.tri_count - 1) +
+				  mesh->centroid(best)) / float(m.tri_count);
+			if ((int) m.tri_count >= max_tris)
+				break;
+
+			// Drop candidates that have been used
+			if (candidates.size() > 16 * (size_t) max_verts) {
+				size_t n = 0;
+				for (size_t i = 0; i < candidates.size(); i++)
+					if (!used[candidates[i]])
+						candidates[n++] = candidates[i];
+				candidates.resize(n);
+			}
+		}
+
+		for (unsigned i = 0; i < m.vert_count; i++)
+			local[ml.verts[m.vert_offset + i]] = -1;
+		next_candidates.swap(candidates);
+		meshlet_bounds(mesh, ml, m);
+		ml.meshlets.push_back(m);
+	}
+
+	dprintf("%lu meshlets, %.1f verts and %.1f faces per meshlet\n",
+		(unsigned long) ml.meshlets.size(),
+		float(ml.verts.size()) / ml.meshlets.size(),
+		float(nf) / ml.meshlets.size());
+}
+
+
+// Find the meshlets that might be visible.  proj_view maps mesh coordinates
+// to clip coordinates (projection * modelview), and camera is the eye point
+// in mesh coordinates.
+void cull_meshlets(const Meshlets &ml, const xform &proj_view,
+	const point &camera, vector<int> &visible)
+{
+	// Frustum planes, from the rows of the matrix (Gribb and Hartmann):
+	// a point is inside if dot(plane, (p, 1)) >= 0 for all six
+	float planes[6][4];
+	for (int i = 0; i < 6; i++) {
+		int row = i / 2;
+		float sign = (i % 2) ? -1.0f : 1.0f;
+		for (int j = 0; j < 4; j++)
+			planes[i][j] = float(proj_view(3,j) +
+					     sign * proj_view(row,j));
+		float l = len(vec(planes[i][0], planes[i][1], planes[i][2]));
+		if (l > 0.0f)
+			for (int j = 0; j < 4; j++)
+				planes[i][j] /= l;
+	}
+
+	visible.clear();
+	int n = ml.meshlets.size();
+	for (int i = 0; i < n; i++) {
+		const Meshlet &m = ml.meshlets[i];
+
+		bool outside = false;
+		for (int j = 0; j < 6 && !outside; j++) {
+			float d = planes[j][0] * m.center[0] +
+				  planes[j][1] * m.center[1] +
+				  planes[j][2] * m.center[2] + planes[j][3];
+			outside = (d < -m.radius);
+		}
+		if (outside)
+			continue;
+
+		// Backfacing if every direction from the camera to the sphere
+		// is within 90 degrees of every normal in the cone
+		vec d = m.center - camera;
+		if ((d DOT m.cone_axis) >= m.cone_cutoff * len(d) + m.radius)
+			continue;
+
+		visible.push_back(i);
+	}
+}
+
+}; // namespace trimesh
@@ -13,17 +13,10 @@ using namespace std;
 
 namespace trimesh {
 
-// Quick 'n dirty portable random number generator 
-static inline float tinyrnd()
-{
-	static unsigned trand = 0;
-	trand = 1664525u * trand + 1013904223u;
-	return (float) trand / 4294967296.0f;
-}
-
-
 // Find the overlap area and RMS distance from mesh1 to mesh2.  Used by
-// find_overlap in both directions, below
+// find_overlap in both directions, below.  Samples are evenly spaced in the
+// vertex list, and the per-sample results are summed in order so that the
+// result does not depend on the number of threads.
 static void find_overlap_onedir(TriMesh *mesh1, TriMesh *mesh2,
 				const xform &xf1, const xform &xf2,
 				const KDtree *kd2, float &area, float &rmsdist)
@@ -36,25 +29,34 @@ static void find_overlap_onedir(TriMesh *mesh1, TriMesh *mesh2,
 	xform xf12r = norm_xf(xf12);
 	int nv = mesh1->vertices.size();
 	int nsamp = min(nv, 10000);
+	vector<float> samp_area(nsamp), samp_dist2(nsamp);
+	vector<char> samp_overlaps(nsamp);
 
+#pragma omp parallel for schedule(dynamic,256)
 	for (int i = 0; i < nsamp; i++) {
 		int ind = int((float) i / nsamp * nv);
 		ind = clamp(ind, 0, nv-1);
-		float this_area = mesh1->pointareas[ind];
-		area_considered += this_area;
+		samp_area[i] = mesh1->pointareas[ind];
 		point p = xf12 * mesh1->vertices[ind];
 		const float *q = kd2->closest_to_pt(p);
 		if (!q)
 			continue;
-		int ind2 = (q - (const float *) &(mesh2->vertices[0][0])) / 3;
+		index_t ind2 = kd2->index_of(q);
 		if (mesh2->is_bdy(ind2))
 			continue;
 		if (((xf12r * mesh1->normals[ind]) DOT mesh2->normals[ind2])
 				<= 0.0f)
 			continue;
-		area += this_area;
-		rmsdist += this_area *
-			sqr((p - point(q)) DOT mesh2->normals[ind2]);
+		samp_overlaps[i] = true;
+		samp_dist2[i] = sqr((p - point(q)) DOT mesh2->normals[ind2]);
+	}
+
+	for (int i = 0; i < nsamp; i++) {
+		area_considered += samp_area[i];
+		if (!samp_overlaps[i])
+			continue;
+		area += samp_area[i];
+		rmsdist += samp_area[i] * samp_dist2[i];
 	}
 
 	if (!area)
@@ -0,0 +1,75 @@
+/*
+Szymon Rusinkiewicz
+Princeton University
+
+pack_indices.cc
+Pack the faces of a mesh into chunks of 16-bit indices.
+*/
+
+#include "TriMesh.h"
+#include "TriMesh_algo.h"
+#include <algorithm>
+using namespace std;
+#define dprintf TriMesh::dprintf
+
+
+namespace trimesh {
+
+#define MAX_SPAN 65535
+
+// Greedily grow each chunk until the next face would push the range of
+// vertex indices it uses past what fits in 16 bits
+bool pack_indices16(TriMesh *mesh, vector<unsigned short> &inds,
+	vector<IndexChunk16> &chunks)
+{
+	inds.clear();
+	chunks.clear();
+	mesh->need_faces();
+	size_t nf = mesh->faces.size();
+	if (!nf)
+		return true;
+
+	// First pass: find the chunks
+	index_t lo = 0, hi = -1;
+	for (size_t i = 0; i < nf; i++) {
+		const TriMesh::Face &f = mesh->faces[i];
+		index_t flo = min(min(f[0], f[1]), f[2]);
+		index_t fhi = max(max(f[0], f[1]), f[2]);
+		if (fhi - flo > MAX_SPAN) {
+			chunks.clear();
+			return false;
+		}
+		if (chunks.empty() ||
+		    max(hi, fhi) - min(lo, flo) > MAX_SPAN) {
+			if (!chunks.empty())
+				chunks.back().base = lo;
+			IndexChunk16 c = { 0, i, 0 };
+			chunks.push_back(c);
+			lo = flo;
+			hi = fhi;
+		} else {
+			lo = min(lo, flo);
+			hi = max(hi, fhi);
+		}
+		chunks.back().count++;
+	}
+	chunks.back().base = lo;
+
+	// Second pass: write the indices, relative to each chunk's base
+	inds.resize(3 * nf);
+	for (size_t c = 0; c < chunks.size(); c++) {
+		index_t base = chunks[c].base;
+		size_t end = chunks[c].first + chunks[c].count;
+		for (size_t i = chunks[c].first; i < end; i++) {
+			const TriMesh::Face &f = mesh->faces[i];
+			for (int j = 0; j < 3; j++)
+				inds[3*i+j] = (unsigned short) (f[j] - base);
+		}
+	}
+
+	dprintf("Packed %lu faces into %lu chunks of 16-bit indices\n",
+		(unsigned long) nf, (unsigned long) chunks.size());
+	return true;
+}
+
+}; // namespace trimesh
@@ -14,24 +14,16 @@ using namespace std;
 
 namespace trimesh {
 
-// Remove the indicated vertices from the TriMesh.
-void remove_vertices(TriMesh *mesh, const vector<bool> &toremove)
+// Helper for remove_vertices and remove_unused_vertices: keep[i] is 1 for
+// vertices that stay, 0 for ones that go.  Numbers the survivors with a
+// parallel prefix sum.
+static void compact_vertices(TriMesh *mesh, const vector<index_t> &keep)
 {
-	int nv = mesh->vertices.size();
-
-	// Build a table that tells how the vertices will be remapped
-	if (!nv)
-		return;
-
-	dprintf("Removing vertices... ");
-	vector<int> remap_table(nv);
-	int next = 0;
-	for (int i = 0; i < nv; i++) {
-		if (toremove[i])
-			remap_table[i] = -1;
-		else
-			remap_table[i] = next++;
-	}
+	index_t nv = keep.size();
+	vector<index_t> remap_table;
+	prefix_sum(keep, remap_table);
+	index_t next = remap_table[nv];
+	remap_table.resize(nv);
 
 	// Nothing to delete?
 	if (next == nv) {
@@ -39,29 +31,54 @@ void remove_vertices(TriMesh *mesh, const vector<bool> &toremove)
 		return;
 	}
 
+#pragma omp parallel for
+	for (index_t i = 0; i < nv; i++) {
+		if (!keep[i])
+			remap_table[i] = -1;
+	}
+
 	remap_verts(mesh, remap_table);
 
-	dprintf("%d vertices removed... Done.\n", nv - next);
+	dprintf("%lld vertices removed... Done.\n", (long long) (nv - next));
+}
+
+
+// Remove the indicated vertices from the TriMesh.
+void remove_vertices(TriMesh *mesh, const vector<bool> &toremove)
+{
+	index_t nv = mesh->vertices.size();
+	if (!nv)
+		return;
+
+	dprintf("Removing vertices... ");
+	vector<index_t> keep(nv);
+#pragma omp parallel for
+	for (index_t i = 0; i < nv; i++)
+		keep[i] = !toremove[i];
+	compact_vertices(mesh, keep);
 }
 
 
 // Remove vertices that aren't referenced by any face
 void remove_unused_vertices(TriMesh *mesh)
 {
-	int nv = mesh->vertices.size();
+	index_t nv = mesh->vertices.size();
 	if (!nv)
 		return;
 
 	bool had_faces = !mesh->faces.empty();
 	mesh->need_faces();
-	int nf = mesh->faces.size();
-	vector<bool> unused(nv, true);
-	for (int i = 0; i < nf; i++) {
-		unused[mesh->faces[i][0]] = false;
-		unused[mesh->faces[i][1]] = false;
-		unused[mesh->faces[i][2]] = false;
+	index_t nf = mesh->faces.size();
+	vector<index_t> used(nv);
+#pragma omp parallel for
+	for (index_t i = 0; i < nf; i++) {
+		for (int j = 0; j < 3; j++) {
+#pragma omp atomic write
+			used[mesh->faces[i][j]] = 1;
+		}
 	}
-	remove_vertices(mesh, unused);
+	dprintf("Removing vertices... ");
+	compact_vertices(mesh, used);
 	if (!had_faces)
 		mesh->faces.clear();
 }
@@ -74,31 +91,72 @@ void remove_faces(TriMesh *mesh, const vector<bool> &toremove)
 	bool had_tstrips = !mesh->tstrips.empty();
 	bool had_faces = !mesh->faces.empty();
 	mesh->need_faces();
-	int numfaces = mesh->faces.size();
+	index_t numfaces = mesh->faces.size();
 	if (!numfaces)
 		return;
 
-	mesh->tstrips.clear();
-	mesh->adjacentfaces.clear();
-	mesh->neighbors.clear();
-	mesh->across_edge.clear();
-	mesh->cornerareas.clear();
-	mesh->pointareas.clear();
-
 	dprintf("Removing faces... ");
-	int next = 0;
-	for (int i = 0; i < numfaces; i++) {
-		if (toremove[i])
-			continue;
-		mesh->faces[next++] = mesh->faces[i];
-	}
+	vector<index_t> keep(numfaces), face_table;
+#pragma omp parallel for
+	for (index_t i = 0; i < numfaces; i++)
+		keep[i] = !toremove[i];
+	prefix_sum(keep, face_table);
+	index_t next = face_table[numfaces];
 	if (next == numfaces) {
 		dprintf("None removed.\n");
 		return;
 	}
+	face_table.resize(numfaces);
+
+	// Data at vertices that lost a face is now out of date
+	vector<index_t> touched;
+	for (index_t i = 0; i < numfaces; i++) {
+		if (keep[i])
+			continue;
+		touched.push_back(mesh->faces[i][0]);
+		touched.push_back(mesh->faces[i][1]);
+		touched.push_back(mesh->faces[i][2]);
+	}
+
+	// Compact the faces and per-face attributes
+	vector<TriMesh::Face> newfaces(next);
+#pragma omp parallel for
+	for (index_t i = 0; i < numfaces; i++) {
+		if (!keep[i]) {
+			face_table[i] = -1;
+			continue;
+		}
+		newfaces[face_table[i]] = mesh->faces[i];
+	}
+	mesh->faces.swap(newfaces);
+	if ((index_t) mesh->texfaces.size() == numfaces) {
+		vector<TriMesh::Face> newtexfaces(next);
+#pragma omp parallel for
+		for (index_t i = 0; i < numfaces; i++) {
+			if (keep[i])
+				newtexfaces[face_table[i]] = mesh->texfaces[i];
+		}
+		mesh->texfaces.swap(newtexfaces);
+	}
+	mesh->attribs.remap(AttribBase::FACE, face_table, next);
+
+	// The faces that remain keep their order, so the faces around each
+	// vertex just lose the removed ones.  The rest is recomputed lazily.
+	if (!mesh->adjacentfaces.empty()) {
+		vector<index_t> rows(mesh->vertices.size());
+		for (size_t i = 0; i < rows.size(); i++)
+			rows[i] = i;
+		mesh->adjacentfaces.remap(rows, face_table);
+	}
+	mesh->tstrips.clear();
+	mesh->neighbors.clear();
+	mesh->across_edge.clear();
+	mesh->cornerareas.clear();
+	mesh->pointareas.clear();
+	mesh->changed_vertices(touched);
+	mesh->changed_numbering();
 
-	mesh->faces.erase(mesh->faces.begin() + next, mesh->faces.end());
-	dprintf("%d faces removed... Done.\n", numfaces - next);
+	dprintf("%lld faces removed... Done.\n", (long long) (numfaces - next));
 
 	if (had_tstrips)
 		mesh->need_tstrips();
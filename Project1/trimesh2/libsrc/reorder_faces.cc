@@ -0,0 +1,218 @@
+/*
+Szymon Rusinkiewicz
+Princeton University
+
+reorder_faces.cc
+Reorder faces for better post-transform vertex cache behavior, using the
+"Tipsify" algorithm of
+  P. Sander, D. Nehab, and J. Barczak,
+  "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw",
+  SIGGRAPH 2007.
+*/
+
+#include "TriMesh.h"
+#include "TriMesh_algo.h"
+#include <vector>
+using namespace std;
+#define dprintf TriMesh::dprintf
+#define eprintf TriMesh::eprintf
+
+
+namespace trimesh {
+
+// Permute faces according to the given table: face i moves to
+// remap_table[i].  Per-face data moves along with the faces.  Tstrips and
+// grid are dropped, since they fix the face order.
+void remap_faces(TriMesh *mesh, const vector<index_t> &remap_table)
+{
+	index_t nf = mesh->faces.size();
+	if ((index_t) remap_table.size() != nf) {
+		eprintf("remap_faces called with wrong table size!\n");
+		return;
+	}
+
+	vector<TriMesh::Face> oldfaces;
+	oldfaces.swap(mesh->faces);
+	mesh->faces.resize(nf);
+	for (index_t i = 0; i < nf; i++)
+		mesh->faces[remap_table[i]] = oldfaces[i];
+
+	if ((index_t) mesh->texfaces.size() == nf) {
+		oldfaces.swap(mesh->texfaces);
+		for (index_t i = 0; i < nf; i++)
+			mesh->texfaces[remap_table[i]] = oldfaces[i];
+	}
+
+	if (!mesh->cornerareas.empty()) {
+		vector<vec> oldareas;
+		oldareas.swap(mesh->cornerareas);
+		mesh->cornerareas.resize(nf);
+		for (index_t i = 0; i < nf; i++)
+			mesh->cornerareas[remap_table[i]] = oldareas[i];
+	}
+	mesh->attribs.remap(AttribBase::FACE, remap_table, nf);
+
+	mesh->tstrips.clear();
+	mesh->grid.clear();
+	if (!mesh->adjacentfaces.empty()) {
+		mesh->adjacentfaces.clear();
+		mesh->need_adjacentfaces();
+	}
+	if (!mesh->across_edge.empty()) {
+		mesh->across_edge.clear();
+		mesh->need_across_edge();
+	}
+	mesh->changed_numbering();
+}
+
+
+// Simulate a FIFO cache of the given size.  A vertex is in the cache if fewer
+// than cache_size misses have happened since it was loaded.
+void cache_stats(TriMesh *mesh, int cache_size, float &acmr, float &atvr)
+{
+	acmr = atvr = 0;
+	mesh->need_faces();
+	index_t nv = mesh->vertices.size(), nf = mesh->faces.size();
+	if (!nf)
+		return;
+
+	vector<long long> loaded(nv, -1);
+	vector<bool> used(nv);
+	long long misses = 0;
+	index_t nused = 0;
+	for (index_t i = 0; i < nf; i++) {
+		for (int j = 0; j < 3; j++) {
+			index_t v = mesh->faces[i][j];
+			if (!used[v]) {
+				used[v] = true;
+				nused++;
+			}
+			if (loaded[v] >= 0 && misses - loaded[v] < cache_size)
+				continue;
+			loaded[v] = misses++;
+		}
+	}
+
+	acmr = float(misses) / nf;
+	atvr = float(misses) / nused;
+}
+
+
+// Helper for reorder_faces: pick the next vertex to fan around.  Prefers the
+// vertex among the candidates that has been in the cache longest, as long as
+// its remaining faces won't push it out.  Failing that, backtracks through
+// the recently-used vertices, then scans for any vertex with faces left.
+static index_t next_vertex(const vector<index_t> &candidates,
+	const vector<int> &live, const vector<long long> &loaded, long long time,
+	int cache_size, vector<index_t> &dead_end, index_t &cursor)
+{
+	index_t best = -1;
+	long long best_priority = -1;
+	for (size_t i = 0; i < candidates.size(); i++) {
+		index_t v = candidates[i];
+		if (!live[v])
+			continue;
+		long long priority = 0;
+		long long age = time - loaded[v];
+		if (age + 2 * live[v] <= cache_size)
+			priority = age;
+		if (priority > best_priority) {
+			best = v;
+			best_priority = priority;
+		}
+	}
+	if (best >= 0)
+		return best;
+
+	while (!dead_end.empty()) {
+		index_t v = dead_end.back();
+		dead_end.pop_back();
+		if (live[v])
+			return v;
+	}
+
+	index_t nv = live.size();
+	for ( ; cursor < nv; cursor++) {
+		if (live[cursor])
+			return cursor++;
+	}
+	return -1;
+}
+
+
+// Reorder the faces of a mesh to make good use of a vertex cache of the
+// given size.  Tstrips and grid are dropped, since they fix the face order.
+void reorder_faces(TriMesh *mesh, int cache_size /* = 16 */)
+{
+	mesh->need_faces();
+	index_t nv = mesh->vertices.size(), nf = mesh->faces.size();
+	if (!nf)
+		return;
+
+	dprintf("Reordering faces... ");
+	mesh->need_adjacentfaces();
+
+	// Number of not-yet-emitted faces touching each vertex
+	vector<int> live(nv);
+	for (index_t i = 0; i < nv; i++)
+		live[i] = mesh->adjacentfaces[i].size();
+
+	// Time at which each vertex was last loaded into the cache, in units
+	// of cache misses.  Starting far in the past means "not in cache".
+	vector<long long> loaded(nv, -(long long) cache_size - 1);
+	long long time = 0;
+
+	vector<bool> emitted(nf);
+	vector<index_t> order, dead_end, candidates;
+	order.reserve(nf);
+	index_t cursor = 0;
+	index_t v = next_vertex(candidates, live, loaded, time, cache_size,
+		dead_end, cursor);
+	while (v >= 0) {
+		// Emit all the remaining faces around v
+		candidates.clear();
+		TriMesh::Adjacency::Row a = mesh->adjacentfaces[v];
+		for (size_t i = 0; i < a.size(); i++) {
+			index_t f = a[i];
+			if (emitted[f])
+				continue;
+			emitted[f] = true;
+			order.push_back(f);
+			for (int j = 0; j < 3; j++) {
+				index_t w = mesh->faces[f][j];
+				dead_end.push_back(w);
+				candidates.push_back(w);
+				live[w]--;
+				if (time - loaded[w] > cache_size)
+					loaded[w] = time++;
+			}
+		}
+		v = next_vertex(candidates, live, loaded, time, cache_size,
+			dead_end, cursor);
+	}
+
+	vector<index_t> face_table(nf);
+	for (index_t i = 0; i < nf; i++)
+		face_table[order[i]] = i;
+	remap_faces(mesh, face_table);
+
+	dprintf("Done.\n");
+}
+
+
+// Reorder faces for the vertex cache, then vertices in the order the faces
+// first use them (for the pre-transform cache and every per-face loop).
+void optimize_vertex_cache(TriMesh *mesh, int cache_size /* = 16 */)
+{
+	float acmr, atvr;
+	cache_stats(mesh, cache_size, acmr, atvr);
+	dprintf("Before: ACMR %.3f, ATVR %.3f\n", acmr, atvr);
+
+	reorder_faces(mesh, cache_size);
+	reorder_verts(mesh);
+
+	cache_stats(mesh, cache_size, acmr, atvr);
+	dprintf("After: ACMR %.3f, ATVR %.3f\n", acmr, atvr);
+}
+
+}; // namespace trimesh
@@ -0,0 +1,173 @@
+/*
+Szymon Rusinkiewicz
+Princeton University
+
+reorder_spatial.cc
+Reorder vertices and faces along a space-filling (Morton) curve, so that
+things close together in space are close together in memory.
+*/
+
+#include "TriMesh.h"
+#include "TriMesh_algo.h"
+#include <vector>
+#include <algorithm>
+using namespace std;
+#define dprintf TriMesh::dprintf
+
+
+// Number of blocks the radix sort splits the keys into.  Fixed, rather than
+// one per thread, so the result doesn't depend on the number of threads.
+#define RADIX_BLOCKS 64
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+
+// Bits of Morton code per axis
+#define MORTON_BITS 21
+
+
+namespace trimesh {
+
+typedef unsigned long long sort_key_t;
+
+// Spread out the low 21 bits of x so that there are two zero bits between
+// each pair of bits
+static inline sort_key_t spread_bits(sort_key_t x)
+{
+	x &= 0x1fffffull;
+	x = (x | (x << 32)) & 0x1f00000000ffffull;
+	x = (x | (x << 16)) & 0x1f0000ff0000ffull;
+	x = (x | (x << 8))  & 0x100f00f00f00f00full;
+	x = (x | (x << 4))  & 0x10c30c30c30c30c3ull;
+	x = (x | (x << 2))  & 0x1249249249249249ull;
+	return x;
+}
+
+
+// Position within the bounding box, scaled to [0, 2^MORTON_BITS)
+static inline sort_key_t quantize(float x)
+{
+	return min(sort_key_t(max(x, 0.0f)), sort_key_t((1 << MORTON_BITS) - 1));
+}
+
+
+// Stable LSD radix sort of (key, value) pairs.  Each pass histograms the
+// blocks in parallel, finds where each (bucket, block) goes with a prefix
+// sum, then scatters the blocks in parallel.
+static void radix_sort(vector<sort_key_t> &keys, vector<index_t> &vals)
+{
+	index_t n = keys.size();
+	vector<sort_key_t> keys2(n);
+	vector<index_t> vals2(n);
+	index_t blocksize = (n + RADIX_BLOCKS - 1) / RADIX_BLOCKS;
+	vector<index_t> hist(RADIX_BLOCKS * RADIX_BUCKETS);
+
+	for (int shift = 0; shift < 64; shift += RADIX_BITS) {
+#pragma omp parallel for
+		for (int b = 0; b < RADIX_BLOCKS; b++) {
+			index_t *h = &hist[b * RADIX_BUCKETS];
+			fill(h, h + RADIX_BUCKETS, 0);
+			index_t start = b * blocksize, end = min(start + blocksize, n);
+			for (index_t i = start; i < end; i++)
+				h[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+		}
+
+		// Skip passes in which all the keys land in one bucket
+		bool trivial = false;
+		for (int d = 0; d < RADIX_BUCKETS; d++) {
+			index_t total = 0;
+			for (int b = 0; b < RADIX_BLOCKS; b++)
+				total += hist[b * RADIX_BUCKETS + d];
+			if (total == n) {
+				trivial = true;
+				break;
+			}
+			if (total)
+				break;
+		}
+		if (trivial)
+			continue;
+
+		index_t sum = 0;
+		for (int d = 0; d < RADIX_BUCKETS; d++) {
+			for (int b = 0; b < RADIX_BLOCKS; b++) {
+				index_t count = hist[b * RADIX_BUCKETS + d];
+				hist[b * RADIX_BUCKETS + d] = sum;
+				sum += count;
+			}
+		}
+
+#pragma omp parallel for
+		for (int b = 0; b < RADIX_BLOCKS; b++) {
+			index_t *h = &hist[b * RADIX_BUCKETS];
+			index_t start = b * blocksize, end = min(start + blocksize, n);
+			for (index_t i = start; i < end; i++) {
+				index_t pos = h[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+				keys2[pos] = keys[i];
+				vals2[pos] = vals[i];
+			}
+		}
+		keys.swap(keys2);
+		vals.swap(vals2);
+	}
+}
+
+
+// Reorder vertices by the Morton code of their position within the bounding
+// box, then faces by their lowest-numbered (hence lowest-code) vertex.
+void reorder_spatial(TriMesh *mesh)
+{
+	index_t nv = mesh->vertices.size();
+	if (!nv)
+		return;
+
+	dprintf("Reordering spatially... ");
+	mesh->need_bbox();
+	const point &lo = mesh->bbox.min;
+	vec size = mesh->bbox.size();
+	float maxsize = max(max(size[0], size[1]), size[2]);
+	float scale = maxsize > 0.0f ?
+		((1 << MORTON_BITS) - 1) / maxsize : 0.0f;
+
+	vector<sort_key_t> keys(nv);
+	vector<index_t> order(nv);
+#pragma omp parallel for
+	for (index_t i = 0; i < nv; i++) {
+		const point &p = mesh->vertices[i];
+		sort_key_t x = quantize(scale * (p[0] - lo[0]));
+		sort_key_t y = quantize(scale * (p[1] - lo[1]));
+		sort_key_t z = quantize(scale * (p[2] - lo[2]));
+		keys[i] = spread_bits(x) | (spread_bits(y) << 1) |
+			  (spread_bits(z) << 2);
+		order[i] = i;
+	}
+	radix_sort(keys, order);
+
+	vector<index_t> remap_table(nv);
+	for (index_t i = 0; i < nv; i++)
+		remap_table[order[i]] = i;
+	remap_verts(mesh, remap_table);
+
+	// Faces.  Tstrips and grid would fix the face order, so only
+	// reorder if faces are the primary representation.
+	index_t nf = mesh->faces.size();
+	if (nf && mesh->tstrips.empty() && mesh->grid.empty()) {
+		keys.resize(nf);
+		order.resize(nf);
+#pragma omp parallel for
+		for (index_t i = 0; i < nf; i++) {
+			const TriMesh::Face &f = mesh->faces[i];
+			keys[i] = min(min(f[0], f[1]), f[2]);
+			order[i] = i;
+		}
+		radix_sort(keys, order);
+
+		vector<index_t> face_table(nf);
+		for (index_t i = 0; i < nf; i++)
+			face_table[order[i]] = i;
+		remap_faces(mesh, face_table);
+	}
+
+	dprintf("Done.\n");
+}
+
+}; // namespace trimesh
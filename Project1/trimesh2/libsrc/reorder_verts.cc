@@ -16,13 +16,32 @@ using namespace std;
 
 namespace trimesh {
 
+// Helper for remap_verts: gather a per-vertex array into its new order, in
+// parallel.  Slots that nothing maps to (src < 0) keep what was there.
+template <class T>
+static void gather(vector<T> &v, const vector<index_t> &src)
+{
+	index_t n = src.size();
+	vector<T> result(n);
+#pragma omp parallel for
+	for (index_t i = 0; i < n; i++)
+		result[i] = v[src[i] >= 0 ? src[i] : i];
+	v.swap(result);
+}
+
+
 // Remap vertices according to the given table
 //
 // Faces are renumbered to reflect the new numbering of vertices, and any
 // faces that included a vertex that went away will also be removed.
 //
-// Any per-vertex properties are renumbered along with the vertices.
-void remap_verts(TriMesh *mesh, const std::vector<int> &remap_table)
+// Any per-vertex properties are renumbered along with the vertices.  With
+// keep_derived, so are normals and curvatures, and, if no two vertices are
+// merged, connectivity (and, if no faces go away, point and corner areas);
+// otherwise those are recomputed.  Without it, all of these are dropped, to
+// be recomputed when next needed.
+void remap_verts(TriMesh *mesh, const std::vector<index_t> &remap_table,
+	bool keep_derived /* = true */)
 {
 	if (remap_table.size() != mesh->vertices.size()) {
 		eprintf("remap_verts called with wrong table size!\n");
@@ -30,24 +49,34 @@ void remap_verts(TriMesh *mesh, const std::vector<int> &remap_table)
 	}
 
 	// Check what we're doing
-	bool removing_verts = false, any_left = false;
-	int last = -1;
-	int nv = mesh->vertices.size();
-	for (int i = 0; i < nv; i++) {
-		if (remap_table[i] < 0) {
+	bool removing_verts = false, injective = true;
+	index_t last = -1;
+	index_t nv = mesh->vertices.size();
+	for (index_t i = 0; i < nv; i++) {
+		if (remap_table[i] < 0)
 			removing_verts = true;
-		} else {
-			any_left = true;
-			if (remap_table[i] > last)
-				last = remap_table[i];
-		}
+		else if (remap_table[i] > last)
+			last = remap_table[i];
 	}
 
-	if (!any_left) {
+	if (last < 0) {
 		mesh->clear();
 		return;
 	}
 
+	// Find where each new vertex comes from.  If several vertices map to
+	// the same place, the last one that moves there wins.
+	vector<index_t> src(last + 1, -1);
+	for (index_t i = 0; i < nv; i++) {
+		index_t j = remap_table[i];
+		if (j < 0)
+			continue;
+		if (src[j] >= 0)
+			injective = false;
+		if (j != i || src[j] < 0)
+			src[j] = i;
+	}
+
 	// Figure out what we have sitting around, so we can remap/recompute
 	bool have_faces = !mesh->faces.empty();
 	bool have_tstrips = !mesh->tstrips.empty();
@@ -64,91 +93,166 @@ void remap_verts(TriMesh *mesh, const std::vector<int> &remap_table)
 		}
 	}
 
-	bool have_col = !mesh->colors.empty();
-	bool have_conf = !mesh->confidences.empty();
-	bool have_flags = !mesh->flags.empty();
-	bool have_normals = !mesh->normals.empty();
-	bool have_pdir1 = !mesh->pdir1.empty();
-	bool have_pdir2 = !mesh->pdir2.empty();
-	bool have_curv1 = !mesh->curv1.empty();
-	bool have_curv2 = !mesh->curv2.empty();
-	bool have_dcurv = !mesh->dcurv.empty();
+	if (!keep_derived) {
+		mesh->normals.clear();
+		mesh->pdir1.clear(); mesh->pdir2.clear();
+		mesh->curv1.clear(); mesh->curv2.clear();
+		mesh->dcurv.clear();
+		mesh->pointareas.clear(); mesh->cornerareas.clear();
+		mesh->neighbors.clear();
+		mesh->adjacentfaces.clear();
+		mesh->across_edge.clear();
+	}
 
-	// Remap the vertices and per-vertex properties
-	TriMesh *oldmesh = new TriMesh;
-	*oldmesh = *mesh;
+	// Remap the vertices and per-vertex properties.  As for normals in
+	// the readers, texture coordinates are taken to be per-vertex if there
+	// are as many of them as vertices.
+#define GATHER(property) if (!mesh->property.empty()) gather(mesh->property, src)
+	GATHER(vertices);
+	GATHER(colors);
+	GATHER(confidences);
+	GATHER(flags);
+	GATHER(normals);
+	GATHER(pdir1);
+	GATHER(pdir2);
+	GATHER(curv1);
+	GATHER(curv2);
+	GATHER(dcurv);
+	if ((index_t) mesh->texcoords.size() == nv)
+		gather(mesh->texcoords, src);
+	GATHER(udirs);
+	GATHER(vdirs);
+	if ((index_t) mesh->vert_changed.size() == nv)
+		gather(mesh->vert_changed, src);
+	mesh->attribs.remap(AttribBase::VERTEX, remap_table, last + 1);
 
-#define REMAP(property) mesh->property[remap_table[i]] = oldmesh->property[i]
+	// Renumber faces in place, then compact the ones that survive
+	index_t nf = mesh->faces.size();
+	vector<index_t> keep(nf), face_table;
+#pragma omp parallel for
+	for (index_t i = 0; i < nf; i++) {
+		TriMesh::Face &f = mesh->faces[i];
+		f[0] = remap_table[f[0]];
+		f[1] = remap_table[f[1]];
+		f[2] = remap_table[f[2]];
+		keep[i] = (f[0] >= 0 && f[1] >= 0 && f[2] >= 0);
+	}
+	prefix_sum(keep, face_table);
+	index_t nextface = face_table[nf];
+	bool removing_faces = (nextface != nf);
 
-	for (int i = 0; i < nv; i++) {
-		if (remap_table[i] < 0 || remap_table[i] == i)
-			continue;
-		REMAP(vertices);
-		if (have_col) REMAP(colors);
-		if (have_conf) REMAP(confidences);
-		if (have_flags) REMAP(flags);
-		if (have_normals) REMAP(normals);
-		if (have_pdir1) REMAP(pdir1);
-		if (have_pdir2) REMAP(pdir2);
-		if (have_curv1) REMAP(curv1);
-		if (have_curv2) REMAP(curv2);
-		if (have_dcurv) REMAP(dcurv);
-	}
-
-#define ERASE(property) mesh->property.erase(mesh->property.begin()+last+1, \
-					     mesh->property.end())
-	ERASE(vertices);
-	if (have_col) ERASE(colors);
-	if (have_conf) ERASE(confidences);
-	if (have_flags) ERASE(flags);
-	if (have_normals) ERASE(normals);
-	if (have_pdir1) ERASE(pdir1);
-	if (have_pdir2) ERASE(pdir2);
-	if (have_curv1) ERASE(curv1);
-	if (have_curv2) ERASE(curv2);
-	if (have_dcurv) ERASE(dcurv);
-
-	// Renumber faces
-	int nf = mesh->faces.size(), nextface = 0;
-	for (int i = 0; i < nf; i++) {
-		int n0 = (mesh->faces[nextface][0] = remap_table[oldmesh->faces[i][0]]);
-		int n1 = (mesh->faces[nextface][1] = remap_table[oldmesh->faces[i][1]]);
-		int n2 = (mesh->faces[nextface][2] = remap_table[oldmesh->faces[i][2]]);
-		if ((n0 >= 0) && (n1 >= 0) && (n2 >= 0))
-			nextface++;
-	}
-	mesh->faces.erase(mesh->faces.begin() + nextface, mesh->faces.end());
+	// Keep track of vertices that lose a face
+	vector<index_t> touched;
+	if (removing_faces) {
+		for (index_t i = 0; i < nf; i++) {
+			if (keep[i])
+				continue;
+			for (int j = 0; j < 3; j++)
+				if (mesh->faces[i][j] >= 0)
+					touched.push_back(mesh->faces[i][j]);
+		}
+
+		vector<TriMesh::Face> newfaces(nextface);
+#pragma omp parallel for
+		for (index_t i = 0; i < nf; i++) {
+			if (keep[i])
+				newfaces[face_table[i]] = mesh->faces[i];
+		}
+		mesh->faces.swap(newfaces);
+
+		// Texture faces go along with the faces
+		if ((index_t) mesh->texfaces.size() == nf) {
+			vector<TriMesh::Face> newtexfaces(nextface);
+#pragma omp parallel for
+			for (index_t i = 0; i < nf; i++) {
+				if (keep[i])
+					newtexfaces[face_table[i]] =
+						mesh->texfaces[i];
+			}
+			mesh->texfaces.swap(newtexfaces);
+		}
+	}
+	face_table.resize(nf);
+#pragma omp parallel for
+	for (index_t i = 0; i < nf; i++) {
+		if (!keep[i])
+			face_table[i] = -1;
+	}
+	mesh->changed_vertices(touched);
 
 	// Renumber grid
 	if (have_grid) {
-		int ng = mesh->grid.size();
-		for (int i = 0; i < ng; i++) {
+		index_t ng = mesh->grid.size();
+#pragma omp parallel for
+		for (index_t i = 0; i < ng; i++) {
 			if (mesh->grid[i] >= 0)
-				mesh->grid[i] = remap_table[oldmesh->grid[i]];
+				mesh->grid[i] = remap_table[mesh->grid[i]];
 		}
 		if (have_faces && mesh->faces.empty())
 			mesh->need_faces();
 	}
 
+	// Per-face attributes follow the faces.  Faces retriangulated from
+	// the grid don't correspond to the old ones, so get zeros.
+	if (mesh->attribs.any(AttribBase::FACE)) {
+		mesh->attribs.remap(AttribBase::FACE, face_table, nextface);
+		mesh->attribs.resize(AttribBase::FACE, mesh->faces.size());
+	}
+
 	// Renumber tstrips if we're keeping (vs. recomputing) them.
 	if (!mesh->tstrips.empty()) {
-		oldmesh->convert_strips(TriMesh::TSTRIP_TERM);
-		int ns = mesh->tstrips.size();
-		for (int i = 0; i < ns; i++) {
-			if (oldmesh->tstrips[i] < 0)
-				mesh->tstrips[i] = -1;
-			else
-				mesh->tstrips[i] = remap_table[oldmesh->tstrips[i]];
+		mesh->convert_strips(TriMesh::TSTRIP_TERM);
+		index_t ns = mesh->tstrips.size();
+#pragma omp parallel for
+		for (index_t i = 0; i < ns; i++) {
+			if (mesh->tstrips[i] >= 0)
+				mesh->tstrips[i] = remap_table[mesh->tstrips[i]];
 		}
 		mesh->convert_strips(TriMesh::TSTRIP_LENGTH);
 	}
 
-	// Recompute whatever needs recomputing...
-	if (!mesh->pointareas.empty() || !mesh->cornerareas.empty()) {
+	// Connectivity and areas: remap what we can, recompute the rest.
+	// Faces kept their order, so face numbers only change if some went
+	// away, and the faces around a vertex stay sorted.
+	bool same_faces = (nextface == (index_t) mesh->faces.size());
+	bool keep_adjacency = injective && same_faces;
+	bool keep_areas = keep_adjacency && !removing_faces;
+
+	bool had_pointareas = !mesh->pointareas.empty() ||
+			      !mesh->cornerareas.empty();
+	if (keep_areas && (index_t) mesh->pointareas.size() == nv &&
+	    (index_t) mesh->cornerareas.size() == nf) {
+		gather(mesh->pointareas, src);
+	} else if (had_pointareas) {
 		mesh->pointareas.clear();
 		mesh->cornerareas.clear();
 		mesh->need_pointareas();
 	}
+
+	bool had_neighbors = !mesh->neighbors.empty();
+	bool had_adjacentfaces = !mesh->adjacentfaces.empty();
+	bool had_across_edge = !mesh->across_edge.empty();
+	if (keep_adjacency && had_adjacentfaces) {
+		mesh->adjacentfaces.remap(src, removing_faces ? face_table :
+			vector<index_t>());
+	} else {
+		mesh->adjacentfaces.clear();
+	}
+	if (keep_adjacency && !removing_faces && had_neighbors) {
+		mesh->neighbors.remap(src, remap_table);
+	} else {
+		mesh->neighbors.clear();
+		if (had_neighbors)
+			mesh->need_neighbors();
+	}
+	if (had_adjacentfaces)
+		mesh->need_adjacentfaces();
+	if (!keep_adjacency || removing_faces) {
+		mesh->across_edge.clear();
+		if (had_across_edge)
+			mesh->need_across_edge();
+	}
+
 	if (mesh->bbox.valid) {
 		mesh->bbox.valid = false;
 		mesh->need_bbox();
@@ -157,18 +261,6 @@ void remap_verts(TriMesh *mesh, const std::vector<int> &remap_table)
 		mesh->bsphere.valid = false;
 		mesh->need_bsphere();
 	}
-	if (!mesh->neighbors.empty()) {
-		mesh->neighbors.clear();
-		mesh->need_neighbors();
-	}
-	if (!mesh->adjacentfaces.empty()) {
-		mesh->adjacentfaces.clear();
-		mesh->need_adjacentfaces();
-	}
-	if (!mesh->across_edge.empty()) {
-		mesh->across_edge.clear();
-		mesh->need_across_edge();
-	}
 
 	// Must recompute tstrips after connectivity is recomputed...
 	if (have_tstrips)
@@ -176,8 +268,7 @@ void remap_verts(TriMesh *mesh, const std::vector<int> &remap_table)
 
 	if (!have_faces)
 		mesh->faces.clear();
-
-	delete oldmesh;
+	mesh->changed_numbering();
 }
 
 
@@ -187,12 +278,12 @@ void reorder_verts(TriMesh *mesh)
 {
 	dprintf("Reordering vertices... ");
 
-	int nv = mesh->vertices.size();
-	vector<int> remap(nv, -1);
-	int next = 0;
+	index_t nv = mesh->vertices.size();
+	vector<index_t> remap(nv, -1);
+	index_t next = 0;
 	if (!mesh->grid.empty()) {
 		for (size_t i = 0; i < mesh->grid.size(); i++) {
-			int v = mesh->grid[i];
+			index_t v = mesh->grid[i];
 			if (v == -1)
 				continue;
 			if (remap[v] == -1)
@@ -201,7 +292,7 @@ void reorder_verts(TriMesh *mesh)
 	} else if (!mesh->tstrips.empty()) {
 		mesh->convert_strips(TriMesh::TSTRIP_TERM);
 		for (size_t i = 0; i < mesh->tstrips.size(); i++) {
-			int v = mesh->tstrips[i];
+			index_t v = mesh->tstrips[i];
 			if (v == -1)
 				continue;
 			if (remap[v] == -1)
@@ -211,7 +302,7 @@ void reorder_verts(TriMesh *mesh)
 	} else {
 		for (size_t i = 0; i < mesh->faces.size(); i++) {
 			for (int j = 0; j < 3; j++) {
-				int v = mesh->faces[i][j];
+				index_t v = mesh->faces[i][j];
 				if (remap[v] == -1)
 					remap[v] = next++;
 			}
@@ -220,7 +311,7 @@ void reorder_verts(TriMesh *mesh)
 
 	if (next != nv) {
 		// Unreferenced vertices...  Just stick them at the end.
-		for (int i = 0; i < nv; i++)
+		for (index_t i = 0; i < nv; i++)
 			if (remap[i] == -1)
 				remap[i] = next++;
 	}
@@ -11,14 +11,35 @@ connected components, but they are very close to each other.
 #include "TriMesh.h"
 #include "TriMesh_algo.h"
 #include <vector>
+#include <algorithm>
+#include <cmath>
 using namespace std;
+#define dprintf TriMesh::dprintf
 
 
 namespace trimesh {
 
+typedef unsigned long long cell_key_t;
+
+// Key for a cell of the spatial hash.  Coordinates wrap around, so far-away
+// cells may share a key - that just adds candidates that fail the distance
+// test.
+static inline cell_key_t cell_key(long long x, long long y, long long z)
+{
+	const cell_key_t mask = 0x1fffff;
+	return (cell_key_t(x) & mask) |
+	       ((cell_key_t(y) & mask) << 21) |
+	       ((cell_key_t(z) & mask) << 42);
+}
+
+
 // Merge vertices within tol
-void shared(TriMesh *mesh, float tol)
+void shared(TriMesh *mesh, float tol, SharedStats *stats /* = NULL */)
 {
+	if (stats) {
+		stats->merged = 0;
+		stats->max_dist = 0.0f;
+	}
 	int nv = mesh->vertices.size();
 	if (nv < 2)
 		return;
@@ -30,7 +51,7 @@ void shared(TriMesh *mesh, float tol)
 
 	// We only merge vertices on different connected components.
 	// First we find those components.
-	vector<int> comps, compsizes;
+	vector<index_t> comps, compsizes;
 	find_comps(mesh, comps, compsizes, true);
 
 	// Find boundary vertices
@@ -40,28 +61,87 @@ void shared(TriMesh *mesh, float tol)
 		bdy[i] = mesh->is_bdy(i);
 	}
 
-	vector<int> remap(nv);
+	// Bucket the boundary vertices into a spatial hash with cells at least
+	// tol across, so that any match is in one of the 27 surrounding cells
+	float cellsize = tol > 0.0f ? tol : mesh->feature_size();
+	if (!(cellsize > 0.0f))
+		cellsize = 1.0f;
+	float scale = 1.0f / cellsize;
+	vector< pair<cell_key_t, int> > cells;
+	for (int i = 0; i < nv; i++) {
+		if (!bdy[i] || mesh->adjacentfaces[i].empty())
+			continue;
+		const point &p = mesh->vertices[i];
+		cells.push_back(make_pair(cell_key(
+			(long long) floor(scale * p[0]),
+			(long long) floor(scale * p[1]),
+			(long long) floor(scale * p[2])), i));
+	}
+	sort(cells.begin(), cells.end());
+
+	// For each boundary vertex, find the lowest-numbered earlier boundary
+	// vertex on a different component within tol.  This is the one the
+	// old all-pairs search found first.
 	float tol2 = sqr(tol);
+	int ncells = cells.size();
+	vector<int> match(nv, -1);
+#pragma omp parallel for schedule(dynamic,256)
+	for (int k = 0; k < ncells; k++) {
+		int i = cells[k].second;
+		const point &p = mesh->vertices[i];
+		int comp = comps[mesh->adjacentfaces[i][0]];
+		long long x = (long long) floor(scale * p[0]);
+		long long y = (long long) floor(scale * p[1]);
+		long long z = (long long) floor(scale * p[2]);
+		int best = -1;
+		for (int n = 0; n < 27; n++) {
+			cell_key_t key = cell_key(x + n / 9 - 1,
+				y + n / 3 % 3 - 1, z + n % 3 - 1);
+			vector< pair<cell_key_t, int> >::const_iterator it =
+				lower_bound(cells.begin(), cells.end(),
+					    make_pair(key, -1));
+			for ( ; it != cells.end() && it->first == key; it++) {
+				// Candidates in a cell are in increasing order
+				int j = it->second;
+				if (j >= i || (best >= 0 && j >= best))
+					break;
+				if (comps[mesh->adjacentfaces[j][0]] == comp)
+					continue;
+				if (dist2(p, mesh->vertices[j]) > tol2)
+					continue;
+				best = j;
+			}
+		}
+		match[i] = best;
+	}
 
-	// TODO: use KD tree to avoid O(n^2)
+	// Build the remapping table
+	vector<index_t> remap(nv);
 	int next = 0;
 	for (int i = 0; i < nv; i++) {
-		remap[i] = next++;
-		if (!bdy[i] || mesh->adjacentfaces[i].empty())
-			continue;
-		for (int j = 0; j < i; j++) {
-			if (!bdy[j] || mesh->adjacentfaces[j].empty())
-				continue;
-			if (comps[mesh->adjacentfaces[i][0]] ==
-			    comps[mesh->adjacentfaces[j][0]])
-				continue;
-			if (dist2(mesh->vertices[i], mesh->vertices[j]) > tol2)
+		if (match[i] >= 0)
+			remap[i] = remap[match[i]];
+		else
+			remap[i] = next++;
+	}
+
+	// remap_verts keeps the data of the last vertex mapped to each slot,
+	// so that's how far the others move
+	if (stats) {
+		vector<int> survivor(next);
+		for (int i = 0; i < nv; i++)
+			survivor[remap[i]] = i;
+		float maxdist2 = 0.0f;
+		for (int i = 0; i < nv; i++) {
+			if (survivor[remap[i]] == i)
 				continue;
-			remap[i] = remap[j];
-			next--;
-			break;
+			stats->merged++;
+			maxdist2 = max(maxdist2, dist2(mesh->vertices[i],
+				mesh->vertices[survivor[remap[i]]]));
 		}
+		stats->max_dist = sqrt(maxdist2);
 	}
+	dprintf("Merged %d vertices\n", nv - next);
 
 	mesh->adjacentfaces.clear();
 	mesh->neighbors.clear();
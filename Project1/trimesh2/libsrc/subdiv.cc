@@ -11,6 +11,7 @@ Perform subdivision on a mesh.
 #include "TriMesh_algo.h"
 using namespace std;
 #define dprintf TriMesh::dprintf
+#define eprintf TriMesh::eprintf
 #ifndef M_TWOPIf
 # define M_TWOPIf 6.2831855f
 #endif
@@ -25,8 +26,8 @@ using namespace std;
 namespace trimesh {
 
 // Compute the ordinary Loop edge stencil
-static point loop(TriMesh *mesh, int /* f1 */, int /* f2 */,
-		  int v0, int v1, int v2, int v3)
+static point loop(TriMesh *mesh, index_t /* f1 */, index_t /* f2 */,
+		  index_t v0, index_t v1, index_t v2, index_t v3)
 {
 	return 0.125f * (mesh->vertices[v0] + mesh->vertices[v3]) +
 	       0.375f * (mesh->vertices[v1] + mesh->vertices[v2]);
@@ -35,11 +36,11 @@ static point loop(TriMesh *mesh, int /* f1 */, int /* f2 */,
 
 // The point at the opposite quadrilateral corner.
 // If it doesn't exist, reflect the given point across the edge.
-static point opposite(TriMesh *mesh, int f, int v)
+static point opposite(TriMesh *mesh, index_t f, index_t v)
 {
 	int ind = mesh->faces[f].indexof(v);
-	int ae = mesh->across_edge[f][ind];
-	if (ae) {
+	index_t ae = mesh->across_edge[f][ind];
+	if (ae >= 0) {
 		int j = mesh->faces[ae].indexof(mesh->faces[f][NEXT(ind)]);
 		return mesh->vertices[mesh->faces[ae][NEXT(j)]];
 	}
@@ -50,8 +51,8 @@ static point opposite(TriMesh *mesh, int f, int v)
 
 
 // Compute the butterfly stencil
-static point butterfly(TriMesh *mesh, int f1, int f2,
-		       int v0, int v1, int v2, int v3)
+static point butterfly(TriMesh *mesh, index_t f1, index_t f2,
+		       index_t v0, index_t v1, index_t v2, index_t v3)
 {
 	point p = 0.5f * (mesh->vertices[v1] + mesh->vertices[v2]) +
 		  0.125f * (mesh->vertices[v0] + mesh->vertices[v3]);
@@ -62,8 +63,8 @@ static point butterfly(TriMesh *mesh, int f1, int f2,
 
 
 // Compute Loop's new edge mask for an extraordinary vertex for SUBDIV_LOOP_NEW
-static point new_loop_edge(TriMesh *mesh, int f1, int f2,
-			   int v0, int v1, int v2, int v3)
+static point new_loop_edge(TriMesh *mesh, index_t f1, index_t f2,
+			   index_t v0, index_t v1, index_t v2, index_t v3)
 {
 	static const float wts[6][5] = {
 		{ 0, 0, 0, 0, 0 },
@@ -79,7 +80,7 @@ static point new_loop_edge(TriMesh *mesh, int f1, int f2,
 		return loop(mesh, f1, f2, v0, v1, v2, v3);
 	point p;
 	float sumwts = 0.0f;
-	int f = f1;
+	index_t f = f1;
 	float s1 = 1.0f / n;
 	float s2 = M_TWOPIf * s1;
 	float l = 0.375f + 0.25f * cos(s2);
@@ -90,7 +91,7 @@ static point new_loop_edge(TriMesh *mesh, int f1, int f2,
 		if (ind == -1)
 			return loop(mesh, f1, f2, v0, v1, v2, v3);
 		ind = NEXT(ind);
-		int v = mesh->faces[f][ind];
+		index_t v = mesh->faces[f][ind];
 		float wt;
 		if (n < 6) {
 			wt = wts[n][i];
@@ -112,8 +113,8 @@ static point new_loop_edge(TriMesh *mesh, int f1, int f2,
 
 // Compute Zorin's edge mask for an extraordinary vertex for
 // SUBDIV_BUTTERFLY_MODIFIED
-static point zorin_edge(TriMesh *mesh, int f1, int f2,
-			int v0, int v1, int v2, int v3)
+static point zorin_edge(TriMesh *mesh, index_t f1, index_t f2,
+			index_t v0, index_t v1, index_t v2, index_t v3)
 {
 	static const float wts[6][5] = {
 		{ 0, 0, 0, 0, 0 },
@@ -129,7 +130,7 @@ static point zorin_edge(TriMesh *mesh, int f1, int f2,
 		return butterfly(mesh, f1, f2, v0, v1, v2, v3);
 	point p;
 	float sumwts = 0.0f;
-	int f = f1;
+	index_t f = f1;
 	float s1 = 1.0f / n;
 	float s2 = M_TWOPIf * s1;
 	for (int i = 0; i < n; i++) {
@@ -137,7 +138,7 @@ static point zorin_edge(TriMesh *mesh, int f1, int f2,
 		if (ind == -1)
 			return butterfly(mesh, f1, f2, v0, v1, v2, v3);
 		ind = NEXT(ind);
-		int v = mesh->faces[f][ind];
+		index_t v = mesh->faces[f][ind];
 		float wt;
 		if (n < 6) {
 			wt = wts[n][i];
@@ -158,13 +159,13 @@ static point zorin_edge(TriMesh *mesh, int f1, int f2,
 
 
 // Average position of all boundary vertices on triangles adjacent to v
-static point avg_bdy(TriMesh *mesh, int v)
+static point avg_bdy(TriMesh *mesh, index_t v)
 {
 	point p;
 	int n = 0;
-	const vector<int> &a = mesh->adjacentfaces[v];
+	TriMesh::Adjacency::Row a = mesh->adjacentfaces[v];
 	for (size_t i = 0; i < a.size(); i++) {
-		int f = a[i];
+		index_t f = a[i];
 		for (int j = 0; j < 3; j++) {
 			if (mesh->across_edge[f][j] == -1) {
 				p += mesh->vertices[mesh->faces[f][NEXT(j)]];
@@ -205,18 +206,14 @@ static inline float loop_update_alpha(int scheme, int n)
 }
 
 
-// Insert a new vertex
-static void insert_vert(TriMesh *mesh, int scheme, int f, int e)
+// Position of the new vertex on edge e of face f
+static point edge_vert(TriMesh *mesh, int scheme, index_t f, int e)
 {
-	int v1 = mesh->faces[f][NEXT(e)], v2 = mesh->faces[f][PREV(e)];
-	if (scheme == SUBDIV_PLANAR) {
-		point p = 0.5f * (mesh->vertices[v1] +
-				  mesh->vertices[v2]);
-		mesh->vertices.push_back(p);
-		return;
-	}
+	index_t v1 = mesh->faces[f][NEXT(e)], v2 = mesh->faces[f][PREV(e)];
+	if (scheme == SUBDIV_PLANAR)
+		return 0.5f * (mesh->vertices[v1] + mesh->vertices[v2]);
 
-	int ae = mesh->across_edge[f][e];
+	index_t ae = mesh->across_edge[f][e];
 	if (ae == -1) {
 		// Boundary
 		point p = 0.5f * (mesh->vertices[v1] +
@@ -226,13 +223,12 @@ static void insert_vert(TriMesh *mesh, int scheme, int f, int e)
 			p *= 1.5f;
 			p -= 0.25f * (avg_bdy(mesh, v1) + avg_bdy(mesh, v2));
 		}
-		mesh->vertices.push_back(p);
-		return;
+		return p;
 	}
 
-	int v0 = mesh->faces[f][e];
+	index_t v0 = mesh->faces[f][e];
 	const TriMesh::Face &aef = mesh->faces[ae];
-	int v3 = aef[NEXT(aef.indexof(v1))];
+	index_t v3 = aef[NEXT(aef.indexof(v1))];
 	point p;
 	if (scheme == SUBDIV_LOOP || scheme == SUBDIV_LOOP_ORIG) {
 		p = loop(mesh, f, ae, v0, v1, v2, v3);
@@ -263,16 +259,333 @@ static void insert_vert(TriMesh *mesh, int scheme, int f, int e)
 		else
 			p = butterfly(mesh, f, ae, v0, v1, v2, v3);
 	}
+	return p;
+}
+
+
+// New position of original vertex i in Loop subdivision
+static point loop_vert(TriMesh *mesh, int scheme, index_t i)
+{
+	const point &p = mesh->vertices[i];
+	point bdyavg, nbdyavg;
+	int nbdy = 0, nnbdy = 0;
+	TriMesh::Adjacency::Row a = mesh->adjacentfaces[i];
+	int naf = a.size();
+	if (!naf)
+		return p;
+	for (int j = 0; j < naf; j++) {
+		index_t af = a[j];
+		int afi = mesh->faces[af].indexof(i);
+		int n1 = NEXT(afi);
+		int n2 = PREV(afi);
+		if (mesh->across_edge[af][n1] == -1) {
+			bdyavg += mesh->vertices[mesh->faces[af][n2]];
+			nbdy++;
+		} else {
+			nbdyavg += mesh->vertices[mesh->faces[af][n2]];
+			nnbdy++;
+		}
+		if (mesh->across_edge[af][n2] == -1) {
+			bdyavg += mesh->vertices[mesh->faces[af][n1]];
+			nbdy++;
+		} else {
+			nbdyavg += mesh->vertices[mesh->faces[af][n1]];
+			nnbdy++;
+		}
+	}
+
+	float alpha;
+	point newpt;
+	if (nbdy) {
+		newpt = bdyavg / (float) nbdy;
+		alpha = 0.75f;
+	} else if (nnbdy) {
+		newpt = nbdyavg / (float) nnbdy;
+		alpha = loop_update_alpha(scheme, nnbdy/2);
+	} else {
+		return p;
+	}
+	point q = p;
+	q *= alpha;
+	q += (1.0f - alpha) * newpt;
+	return q;
+}
+
+
+// The edge of the face across edge e of face f that has the same endpoints
+// and points back at f, or -1
+static inline int edge_mate(const TriMesh *mesh, index_t f, int e)
+{
+	index_t ae = mesh->across_edge[f][e];
+	if (ae < 0)
+		return -1;
+	int j = mesh->faces[ae].indexof(mesh->faces[f][NEXT(e)]);
+	if (j < 0)
+		return -1;
+	j = NEXT(j);
+	return (mesh->across_edge[ae][j] == f) ? j : -1;
+}
+
+
+// Edge e of face f gets the new vertex of the edge across from it, rather
+// than a new one of its own, if the face across comes earlier and the two
+// edges are each other's mates.  This numbers the new vertices in the order
+// the faces first reach them.
+static inline bool shares_edge_vert(const TriMesh *mesh, index_t f, int e)
+{
+	index_t ae = mesh->across_edge[f][e];
+	if (ae < 0 || ae >= f)
+		return false;
+	int k = edge_mate(mesh, f, e);
+	return k >= 0 && edge_mate(mesh, ae, k) == e;
+}
+
+
+// Rebuild adjacentfaces and across_edge for the subdivided mesh from those of
+// the original, which has nf faces and old_nv vertices.  Face i of the
+// original becomes face i (the middle) and faces nf+3*i+j (the corner at
+// vertex j), and the new vertex on edge j is newverts[i][j].
+static void subdiv_connectivity(TriMesh *mesh, index_t nf, index_t old_nv,
+	const vector<TriMesh::Face> &newverts)
+{
+	index_t nv = mesh->vertices.size();
+	const vector<TriMesh::Face> &faces = mesh->faces;
+	const TriMesh::Adjacency &oldadj = mesh->adjacentfaces;
+	const vector<TriMesh::Face> &oldae = mesh->across_edge;
+
+	// Original vertices keep one face per face they were on.  A new vertex
+	// is on the middle face and two corner faces of each face touching its
+	// edge.
+	vector<index_t> count(nv);
+#pragma omp parallel for
+	for (index_t i = 0; i < old_nv; i++)
+		count[i] = oldadj[i].size();
+#pragma omp parallel for
+	for (index_t i = 0; i < nf; i++) {
+		for (int j = 0; j < 3; j++) {
+			if (shares_edge_vert(mesh, i, j))
+				continue;
+			index_t ae = oldae[i][j];
+			int k = (ae > i) ? edge_mate(mesh, i, j) : -1;
+			bool shared = k >= 0 && shares_edge_vert(mesh, ae, k);
+			count[newverts[i][j]] = shared ? 6 : 3;
+		}
+	}
+	TriMesh::Adjacency adj;
+	prefix_sum(count, adj.off);
+	adj.ind.resize(adj.off[nv]);
+
+	// Faces touching each vertex, in increasing order
+#pragma omp parallel for
+	for (index_t i = 0; i < old_nv; i++) {
+		TriMesh::Adjacency::Row a = oldadj[i];
+		index_t *out = adj.ind.empty() ? 0 : &adj.ind[adj.off[i]];
+		int j = -1;
+		for (size_t k = 0; k < a.size(); k++) {
+			index_t f = a[k];
+			// A degenerate face has this vertex at more than one
+			// corner, and is listed once per corner
+			if (k && f == a[k-1]) {
+				do {
+					j++;
+				} while (faces[f][j] != i);
+			} else {
+				j = faces[f].indexof(i);
+			}
+			out[k] = nf + 3 * f + j;
+		}
+	}
+#pragma omp parallel for
+	for (index_t i = 0; i < nf; i++) {
+		for (int j = 0; j < 3; j++) {
+			if (shares_edge_vert(mesh, i, j))
+				continue;
+			index_t v = newverts[i][j];
+			index_t *out = &adj.ind[adj.off[v]];
+			index_t ae = oldae[i][j];
+			int k = (ae > i) ? edge_mate(mesh, i, j) : -1;
+			bool shared = k >= 0 && shares_edge_vert(mesh, ae, k);
+			*out++ = i;
+			if (shared)
+				*out++ = ae;
+			*out++ = nf + 3 * i + min(NEXT(j), PREV(j));
+			*out++ = nf + 3 * i + max(NEXT(j), PREV(j));
+			if (shared) {
+				*out++ = nf + 3 * ae + min(NEXT(k), PREV(k));
+				*out++ = nf + 3 * ae + max(NEXT(k), PREV(k));
+			}
+		}
+	}
+
+	// Faces across each edge.  The middle face is across from all three
+	// corners, and each corner is across from a corner of the original
+	// face across its edges.
+	vector<TriMesh::Face> across(4 * nf);
+#pragma omp parallel for
+	for (index_t i = 0; i < nf; i++) {
+		across[i] = TriMesh::Face(nf + 3 * i, nf + 3 * i + 1,
+					  nf + 3 * i + 2);
+		for (int j = 0; j < 3; j++) {
+			TriMesh::Face &a = across[nf + 3 * i + j];
+			a[0] = i;
+			for (int p = 1; p < 3; p++) {
+				int e = (p == 1) ? NEXT(j) : PREV(j);
+				index_t ae = oldae[i][e];
+				int c = (ae >= 0) ? mesh->faces[ae].indexof(
+					mesh->faces[i][j]) : -1;
+				a[p] = (c >= 0) ? nf + 3 * ae + c : -1;
+			}
+		}
+	}
 
-	mesh->vertices.push_back(p);
+	mesh->adjacentfaces.off.swap(adj.off);
+	mesh->adjacentfaces.ind.swap(adj.ind);
+	mesh->across_edge.swap(across);
 }
 
 
-// Subdivide a mesh
-void subdiv(TriMesh *mesh, int scheme /* = SUBDIV_LOOP */)
+// Number the new vertices on the edges of each face, in order: newverts[i][j]
+// is the new vertex on edge j of face i, or -1 if that edge isn't split.
+// Bit j of split[i] marks the split edges, and the two sides of an edge must
+// agree.  If split is NULL, every edge is split.  Returns the number of new
+// vertices.
+static index_t number_edge_verts(const TriMesh *mesh,
+	const vector<unsigned char> *split, vector<TriMesh::Face> &newverts)
+{
+	index_t nf = mesh->faces.size();
+	index_t old_nv = mesh->vertices.size();
+	vector<index_t> count(nf), first;
+#pragma omp parallel for
+	for (index_t i = 0; i < nf; i++) {
+		int bits = split ? (*split)[i] : 7;
+		count[i] = 0;
+		for (int j = 0; j < 3; j++)
+			if ((bits & (1 << j)) && !shares_edge_vert(mesh, i, j))
+				count[i]++;
+	}
+	prefix_sum(count, first);
+
+	newverts.resize(nf);
+#pragma omp parallel for
+	for (index_t i = 0; i < nf; i++) {
+		int bits = split ? (*split)[i] : 7;
+		index_t v = old_nv + first[i];
+		for (int j = 0; j < 3; j++)
+			newverts[i][j] = ((bits & (1 << j)) &&
+				!shares_edge_vert(mesh, i, j)) ? v++ : -1;
+	}
+#pragma omp parallel for
+	for (index_t i = 0; i < nf; i++) {
+		int bits = split ? (*split)[i] : 7;
+		for (int j = 0; j < 3; j++) {
+			if (!(bits & (1 << j)) || newverts[i][j] >= 0)
+				continue;
+			index_t ae = mesh->across_edge[i][j];
+			newverts[i][j] = newverts[ae][edge_mate(mesh, i, j)];
+		}
+	}
+	return first[nf];
+}
+
+
+// Fill in the positions, colors, confidences, and vertex attributes of the
+// new vertices in newverts.  verts has room for all the vertices.
+static void make_edge_verts(TriMesh *mesh, int scheme,
+	const vector<TriMesh::Face> &newverts, vector<point> &verts)
 {
 	bool have_col = !mesh->colors.empty();
 	bool have_conf = !mesh->confidences.empty();
+	index_t nf = mesh->faces.size();
+	index_t nv = verts.size();
+	if (have_col)
+		mesh->colors.resize(nv);
+	if (have_conf)
+		mesh->confidences.resize(nv);
+	mesh->attribs.resize(AttribBase::VERTEX, nv);
+
+#pragma omp parallel for
+	for (index_t i = 0; i < nf; i++) {
+		for (int j = 0; j < 3; j++) {
+			index_t v = newverts[i][j];
+			if (v < 0 || shares_edge_vert(mesh, i, j))
+				continue;
+			verts[v] = edge_vert(mesh, scheme, i, j);
+			const TriMesh::Face &f = mesh->faces[i];
+			if (have_col)
+				mesh->colors[v] = 0.5f *
+					(mesh->colors[f[NEXT(j)]] +
+					 mesh->colors[f[PREV(j)]]);
+			if (have_conf)
+				mesh->confidences[v] = 0.5f *
+					(mesh->confidences[f[NEXT(j)]] +
+					 mesh->confidences[f[PREV(j)]]);
+			index_t ends[2] = { f[NEXT(j)], f[PREV(j)] };
+			float w[2] = { 0.5f, 0.5f };
+			mesh->attribs.combine(AttribBase::VERTEX, v, 2, ends, w);
+		}
+	}
+}
+
+
+// One level of subdivision.  If keep_connectivity is set, adjacentfaces and
+// across_edge are updated for the next level, otherwise they are cleared.
+static void subdiv_once(TriMesh *mesh, int scheme, bool keep_connectivity)
+{
+	index_t nf = mesh->faces.size();
+	index_t old_nv = mesh->vertices.size();
+
+	vector<TriMesh::Face> newverts;
+	index_t nv = old_nv + number_edge_verts(mesh, NULL, newverts);
+
+	// Positions of new and original vertices
+	vector<point> verts(nv);
+	bool loop_scheme = (scheme == SUBDIV_LOOP ||
+			    scheme == SUBDIV_LOOP_ORIG ||
+			    scheme == SUBDIV_LOOP_NEW);
+#pragma omp parallel for
+	for (index_t i = 0; i < old_nv; i++)
+		verts[i] = loop_scheme ? loop_vert(mesh, scheme, i) :
+					 mesh->vertices[i];
+	make_edge_verts(mesh, scheme, newverts, verts);
+	mesh->vertices.swap(verts);
+
+	// New faces: the middle one replaces the original, and the corners
+	// go at the end.  Each inherits the attributes of its parent.
+	vector<TriMesh::Face> faces(4 * nf);
+	bool face_attribs = mesh->attribs.any(AttribBase::FACE);
+	if (face_attribs)
+		mesh->attribs.resize(AttribBase::FACE, 4 * nf);
+#pragma omp parallel for
+	for (index_t i = 0; i < nf; i++) {
+		const TriMesh::Face &v = mesh->faces[i];
+		const TriMesh::Face &n = newverts[i];
+		faces[i] = n;
+		faces[nf + 3 * i    ] = TriMesh::Face(v[0], n[2], n[1]);
+		faces[nf + 3 * i + 1] = TriMesh::Face(v[1], n[0], n[2]);
+		faces[nf + 3 * i + 2] = TriMesh::Face(v[2], n[1], n[0]);
+		if (face_attribs) {
+			index_t parent = i;
+			float w = 1.0f;
+			for (int j = 0; j < 3; j++)
+				mesh->attribs.combine(AttribBase::FACE,
+					nf + 3 * i + j, 1, &parent, &w);
+		}
+	}
+
+	if (keep_connectivity)
+		subdiv_connectivity(mesh, nf, old_nv, newverts);
+	else {
+		mesh->adjacentfaces.clear();
+		mesh->across_edge.clear();
+	}
+	mesh->faces.swap(faces);
+}
+
+
+// Clear everything that subdivision invalidates, and find the connectivity
+// it needs
+static void subdiv_prepare(TriMesh *mesh)
+{
 	mesh->flags.clear();
 	mesh->normals.clear();
 	mesh->pdir1.clear(); mesh->pdir2.clear();
@@ -286,123 +599,191 @@ void subdiv(TriMesh *mesh, int scheme /* = SUBDIV_LOOP */)
 	mesh->neighbors.clear();
 	mesh->need_adjacentfaces();
 	mesh->need_across_edge();
+}
 
 
+// Subdivide a mesh the given number of times.  Connectivity for each level
+// comes from the one before, rather than being found from scratch.
+void subdiv(TriMesh *mesh, int scheme /* = SUBDIV_LOOP */,
+	int levels /* = 1 */)
+{
+	subdiv_prepare(mesh);
 	dprintf("Subdividing mesh... ");
+	for (int level = 0; level < levels; level++)
+		subdiv_once(mesh, scheme, level < levels - 1);
+	dprintf("Done.\n");
+}
 
-	// Introduce new vertices
-	int nf = mesh->faces.size();
-	vector<TriMesh::Face> newverts(nf, TriMesh::Face(-1,-1,-1));
-	int old_nv = mesh->vertices.size();
-	mesh->vertices.reserve(4 * old_nv);
-	vector<int> newvert_count(old_nv + 3*nf);
-	if (have_col)
-		mesh->colors.reserve(4 * old_nv);
-	if (have_conf)
-		mesh->confidences.reserve(4 * old_nv);
 
-	for (int i = 0; i < nf; i++) {
-		for (int j = 0; j < 3; j++) {
-			if (newverts[i][j] != -1)
-				continue;
-			int ae = mesh->across_edge[i][j];
-			if (ae != -1) {
-				if (mesh->across_edge[ae][0] == i)
-					newverts[i][j] = newverts[ae][0];
-				else if (mesh->across_edge[ae][1] == i)
-					newverts[i][j] = newverts[ae][1];
-				else if (mesh->across_edge[ae][2] == i)
-					newverts[i][j] = newverts[ae][2];
-			}
-			if (newverts[i][j] != -1)
-				continue;
-
-			insert_vert(mesh, scheme, i, j);
-			newverts[i][j] = mesh->vertices.size() - 1;
-			if (ae != -1) {
-				if (mesh->across_edge[ae][0] == i)
-					newverts[ae][0] = newverts[i][j];
-				else if (mesh->across_edge[ae][1] == i)
-					newverts[ae][1] = newverts[i][j];
-				else if (mesh->across_edge[ae][2] == i)
-					newverts[ae][2] = newverts[i][j];
-			}
-			const TriMesh::Face &v = mesh->faces[i];
-			if (have_col) {
-				mesh->colors.push_back(0.5f *
-					(mesh->colors[v[NEXT(j)]] +
-					 mesh->colors[v[PREV(j)]]));
+// Adaptive subdivision, by red-green refinement.  Red faces are split in
+// four, as in subdiv().  So are faces with two or more split edges, until
+// nothing changes.  The remaining faces with one split edge are green, and
+// are split in two.  Original vertices don't move.
+void subdiv_adaptive(TriMesh *mesh, const vector<bool> &refine,
+	int scheme /* = SUBDIV_BUTTERFLY_MODIFIED */)
+{
+	mesh->need_faces();
+	index_t nf = mesh->faces.size();
+	if ((index_t) refine.size() != nf) {
+		eprintf("subdiv_adaptive: refine has %lld entries "
+			"for %lld faces\n",
+			(long long) refine.size(), (long long) nf);
+		return;
+	}
+	subdiv_prepare(mesh);
+
+	dprintf("Adaptive subdivision... ");
+	vector<unsigned char> red(nf), next(nf), split(nf);
+	for (index_t i = 0; i < nf; i++)
+		red[i] = refine[i];
+
+	// Grow the red region until no face has two split edges without
+	// being red, and mark the split edges
+	bool changed;
+	do {
+		changed = false;
+#pragma omp parallel for reduction(||:changed)
+		for (index_t i = 0; i < nf; i++) {
+			int bits = 0, n = 0;
+			for (int j = 0; j < 3; j++) {
+				index_t ae = mesh->across_edge[i][j];
+				if (red[i] || (ae >= 0 && red[ae] &&
+				    edge_mate(mesh, i, j) >= 0)) {
+					bits |= 1 << j;
+					n++;
+				}
 			}
-			if (have_conf)
-				mesh->confidences.push_back(0.5f *
-					(mesh->confidences[v[NEXT(j)]] +
-					 mesh->confidences[v[PREV(j)]]));
+			split[i] = bits;
+			next[i] = red[i] || n >= 2;
+			if (next[i] != red[i])
+				changed = true;
+		}
+		red.swap(next);
+	} while (changed);
+
+	index_t old_nv = mesh->vertices.size();
+	vector<TriMesh::Face> newverts;
+	index_t nv = old_nv + number_edge_verts(mesh, &split, newverts);
+	vector<point> verts(nv);
+	copy(mesh->vertices.begin(), mesh->vertices.end(), verts.begin());
+	make_edge_verts(mesh, scheme, newverts, verts);
+	mesh->vertices.swap(verts);
+
+	// Each red face adds three faces, and each green face one, at the end
+	vector<index_t> count(nf), first;
+#pragma omp parallel for
+	for (index_t i = 0; i < nf; i++)
+		count[i] = red[i] ? 3 : (split[i] ? 1 : 0);
+	prefix_sum(count, first);
+	index_t new_nf = nf + first[nf];
+
+	vector<TriMesh::Face> &faces = mesh->faces;
+	faces.resize(new_nf);
+	bool face_attribs = mesh->attribs.any(AttribBase::FACE);
+	if (face_attribs)
+		mesh->attribs.resize(AttribBase::FACE, new_nf);
+#pragma omp parallel for
+	for (index_t i = 0; i < nf; i++) {
+		if (!count[i])
+			continue;
+		TriMesh::Face v = faces[i];
+		const TriMesh::Face &n = newverts[i];
+		index_t k = nf + first[i];
+		if (red[i]) {
+			faces[i] = n;
+			faces[k    ] = TriMesh::Face(v[0], n[2], n[1]);
+			faces[k + 1] = TriMesh::Face(v[1], n[0], n[2]);
+			faces[k + 2] = TriMesh::Face(v[2], n[1], n[0]);
+		} else {
+			int j = (split[i] & 1) ? 0 : (split[i] & 2) ? 1 : 2;
+			faces[i] = TriMesh::Face(v[j], v[NEXT(j)], n[j]);
+			faces[k] = TriMesh::Face(v[j], n[j], v[PREV(j)]);
+		}
+		if (face_attribs) {
+			index_t parent = i;
+			float w = 1.0f;
+			for (int j = 0; j < count[i]; j++)
+				mesh->attribs.combine(AttribBase::FACE,
+					k + j, 1, &parent, &w);
 		}
 	}
+	mesh->adjacentfaces.clear();
+	mesh->across_edge.clear();
 
-	// Update old vertices
-	if (scheme == SUBDIV_LOOP ||
-	    scheme == SUBDIV_LOOP_ORIG ||
-	    scheme == SUBDIV_LOOP_NEW) {
+	dprintf("Done.  %lld faces -> %lld faces.\n",
+		(long long) nf, (long long) new_nf);
+}
 
-		vector<point> oldvertices = mesh->vertices;
-#pragma omp parallel for
-		for (int i = 0; i < old_nv; i++) {
-			point bdyavg, nbdyavg;
-			int nbdy = 0, nnbdy = 0;
-			int naf = mesh->adjacentfaces[i].size();
-			if (!naf)
-				continue;
-			for (int j = 0; j < naf; j++) {
-				int af = mesh->adjacentfaces[i][j];
-				int afi = mesh->faces[af].indexof(i);
-				int n1 = NEXT(afi);
-				int n2 = PREV(afi);
-				if (mesh->across_edge[af][n1] == -1) {
-					bdyavg += oldvertices[mesh->faces[af][n2]];
-					nbdy++;
-				} else {
-					nbdyavg += oldvertices[mesh->faces[af][n2]];
-					nnbdy++;
-				}
-				if (mesh->across_edge[af][n2] == -1) {
-					bdyavg += oldvertices[mesh->faces[af][n1]];
-					nbdy++;
-				} else {
-					nbdyavg += oldvertices[mesh->faces[af][n1]];
-					nnbdy++;
-				}
-			}
 
-			float alpha;
-			point newpt;
-			if (nbdy) {
-				newpt = bdyavg / (float) nbdy;
-				alpha = 0.75f;
-			} else if (nnbdy) {
-				newpt = nbdyavg / (float) nnbdy;
-				alpha = loop_update_alpha(scheme, nnbdy/2);
-			} else {
-				continue;
-			}
-			mesh->vertices[i] *= alpha;
-			mesh->vertices[i] += (1.0f - alpha) * newpt;
+// Mark faces across which the surface turns by more than max_angle radians:
+// the largest principal curvature at a corner times the longest edge
+void mark_curved_faces(TriMesh *mesh, float max_angle, vector<bool> &refine)
+{
+	mesh->need_faces();
+	mesh->need_curvatures();
+	index_t nf = mesh->faces.size();
+	vector<unsigned char> mark(nf);
+#pragma omp parallel for
+	for (index_t i = 0; i < nf; i++) {
+		const TriMesh::Face &f = mesh->faces[i];
+		float k = 0.0f, l2 = 0.0f;
+		for (int j = 0; j < 3; j++) {
+			k = max(k, max(fabs(mesh->curv1[f[j]]),
+				       fabs(mesh->curv2[f[j]])));
+			l2 = max(l2, dist2(mesh->vertices[f[NEXT(j)]],
+					   mesh->vertices[f[PREV(j)]]));
 		}
+		mark[i] = (k * sqrt(l2) > max_angle);
 	}
+	refine.assign(mark.begin(), mark.end());
+}
 
-	// Insert new faces
-	mesh->adjacentfaces.clear(); mesh->across_edge.clear();
-	mesh->faces.reserve(4*nf);
-	for (int i = 0; i < nf; i++) {
-		TriMesh::Face &v = mesh->faces[i];
-		TriMesh::Face &n = newverts[i];
-		mesh->faces.push_back(TriMesh::Face(v[0], n[2], n[1]));
-		mesh->faces.push_back(TriMesh::Face(v[1], n[0], n[2]));
-		mesh->faces.push_back(TriMesh::Face(v[2], n[1], n[0]));
-		v = n;
+
+// Mark faces that touch the view frustum and have an edge longer than
+// max_len pixels on a width x height screen.  proj_view maps mesh
+// coordinates to clip coordinates.  Faces that cross the plane of the eye
+// aren't marked.
+void mark_large_faces(TriMesh *mesh, const xform &proj_view,
+	int width, int height, float max_len, vector<bool> &refine)
+{
+	mesh->need_faces();
+	index_t nv = mesh->vertices.size(), nf = mesh->faces.size();
+
+	// Screen position of each vertex, and which clip planes it's outside
+	vector<vec2> screen(nv);
+	vector<unsigned char> outside(nv), behind(nv);
+#pragma omp parallel for
+	for (index_t i = 0; i < nv; i++) {
+		const point &p = mesh->vertices[i];
+		float c[4];
+		for (int r = 0; r < 4; r++)
+			c[r] = float(proj_view(r,0) * p[0] + proj_view(r,1) * p[1] +
+				     proj_view(r,2) * p[2] + proj_view(r,3));
+		int out = 0;
+		for (int r = 0; r < 3; r++) {
+			if (c[r] < -c[3]) out |= 1 << (2 * r);
+			if (c[r] >  c[3]) out |= 2 << (2 * r);
+		}
+		outside[i] = out;
+		behind[i] = (c[3] <= 0.0f);
+		if (!behind[i])
+			screen[i] = vec2(0.5f * width  * (c[0] / c[3] + 1.0f),
+					 0.5f * height * (c[1] / c[3] + 1.0f));
 	}
 
-	dprintf("Done.\n");
+	float max_len2 = sqr(max_len);
+	vector<unsigned char> mark(nf);
+#pragma omp parallel for
+	for (index_t i = 0; i < nf; i++) {
+		const TriMesh::Face &f = mesh->faces[i];
+		if ((outside[f[0]] & outside[f[1]] & outside[f[2]]) ||
+		    behind[f[0]] || behind[f[1]] || behind[f[2]])
+			continue;
+		for (int j = 0; j < 3; j++)
+			if (dist2(screen[f[NEXT(j)]], screen[f[PREV(j)]]) > max_len2)
+				mark[i] = true;
+	}
+	refine.assign(mark.begin(), mark.end());
 }
 
 }; // namespace trimesh
@@ -24,9 +24,11 @@ DEPENDPATH += include
 INCLUDEPATH += include
 
 #Input
-HEADERS += include/Box.h \
+HEADERS += include/Attrib.h \
+include/Box.h \
 include/Color.h \
 include/GLCamera.h \
+include/HalfEdge.h \
 include/ICP.h \
 include/KDtree.h \
 include/TriMesh.h \
@@ -37,15 +39,18 @@ include/bsphere.h \
 include/lineqn.h \
 include/mempool.h \
 include/noise3d.h \
+include/rnd.h \
 include/strutil.h \
 include/timestamp.h
 
 SOURCES += libsrc/GLCamera.cc \
+libsrc/HalfEdge.cc \
 libsrc/ICP.cc \
 libsrc/KDtree.cc \
 libsrc/TriMesh_bounding.cc \
 libsrc/TriMesh_connectivity.cc \
 libsrc/TriMesh_curvature.cc \
+libsrc/TriMesh_dirty.cc \
 libsrc/TriMesh_grid.cc \
 libsrc/TriMesh_io.cc \
 libsrc/TriMesh_normals.cc \
@@ -53,13 +58,20 @@ libsrc/TriMesh_pointareas.cc \
 libsrc/TriMesh_stats.cc \
 libsrc/TriMesh_tstrips.cc \
 libsrc/conn_comps.cc \
+libsrc/decimate.cc \
 libsrc/diffuse.cc \
 libsrc/edgeflip.cc \
 libsrc/faceflip.cc \
 libsrc/filter.cc \
+libsrc/global_reg.cc \
+libsrc/implicit_smooth.cc \
 libsrc/lmsmooth.cc \
+libsrc/meshlets.cc \
 libsrc/overlap.cc \
+libsrc/pack_indices.cc \
 libsrc/remove.cc \
+libsrc/reorder_faces.cc \
+libsrc/reorder_spatial.cc \
 libsrc/reorder_verts.cc \
 libsrc/shared.cc \
 libsrc/subdiv.cc
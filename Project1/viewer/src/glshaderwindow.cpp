@@ -15,6 +15,7 @@
 #include <QVBoxLayout>
 #include <QHBoxLayout>
 #include <assert.h>
+#include "TriMesh_algo.h"
 
 
 #include "perlinNoise.h" // defines tables for Perlin Noise
@@ -29,7 +30,7 @@ glShaderWindow::glShaderWindow(QWindow *parent)
       roughness(0.3), lightIntensity(1.5f), noiseMarble(false), noiseJade(true), noiseWood(false), showSphere(false),
       sphericalCoo(false), cartesianCoo(true), noiseNormal(false), PCSS(true), VSM(false), ESM(false), lightSize(1), maxFilterSize(5), biasCoeff(10),
       shininess(50.0f), lightDistance(5.0f), groundDistance(0.78), shadowMap(0), shadowMapDimension(512), fullScreenSnapshots(false),
-      m_indexBuffer(QOpenGLBuffer::IndexBuffer), ground_indexBuffer(QOpenGLBuffer::IndexBuffer)
+      m_indexBuffer(QOpenGLBuffer::IndexBuffer), m_indexType(GL_UNSIGNED_INT), ground_indexBuffer(QOpenGLBuffer::IndexBuffer)
 {
     m_fragShaderSuffix << "*.frag" << "*.fs";
     m_vertShaderSuffix << "*.vert" << "*.vs";
@@ -829,7 +830,26 @@ void glShaderWindow::bindSceneToProgram()
 
     m_indexBuffer.setUsagePattern(QOpenGLBuffer::StaticDraw);
     m_indexBuffer.bind();
-    m_indexBuffer.allocate(&(modelMesh->faces.front()), modelMesh->faces.size() * 3 * sizeof(int));
+    // Small meshes get 16-bit indices, which halves the index traffic. We can
+    // only use them if everything fits in one chunk based at vertex 0, since
+    // there is no base-vertex draw call in QOpenGLFunctions.
+    std::vector<unsigned short> shortIndices;
+    std::vector<trimesh::IndexChunk16> chunks;
+    if (trimesh::pack_indices16(modelMesh, shortIndices, chunks) &&
+        chunks.size() == 1 && chunks[0].base == 0) {
+        m_indexType = GL_UNSIGNED_SHORT;
+        m_indexBuffer.allocate(&(shortIndices.front()), shortIndices.size() * sizeof(unsigned short));
+    } else if (sizeof(trimesh::index_t) == sizeof(unsigned)) {
+        m_indexType = GL_UNSIGNED_INT;
+        m_indexBuffer.allocate(&(modelMesh->faces.front()), modelMesh->faces.size() * 3 * sizeof(unsigned));
+    } else {
+        // 64-bit indices in the mesh: GL only takes 32
+        std::vector<unsigned> intIndices(3 * modelMesh->faces.size());
+        for (size_t i = 0; i < intIndices.size(); i++)
+            intIndices[i] = (unsigned) modelMesh->faces[i / 3][i % 3];
+        m_indexType = GL_UNSIGNED_INT;
+        m_indexBuffer.allocate(&(intIndices.front()), intIndices.size() * sizeof(unsigned));
+    }
 
     if (modelMesh->colors.size() > 0) {
         m_colorBuffer.setUsagePattern(QOpenGLBuffer::StaticDraw);
@@ -1063,6 +1083,8 @@ void glShaderWindow::openScene()
     modelMesh->need_bbox();
     modelMesh->need_normals();
     modelMesh->need_faces();
+    // Reorder for the GPU's vertex caches before uploading
+    trimesh::optimize_vertex_cache(modelMesh);
 
     bindSceneToProgram();
     initializeTransformForScene();
@@ -1514,7 +1536,7 @@ void glShaderWindow::render()
         shadowMapGenerationProgram->setUniformValue("perspective", lightPerspective);
         // Draw the entire scene:
         m_vao.bind();
-        glDrawElements(GL_TRIANGLES, 3 * modelMesh->faces.size(), GL_UNSIGNED_INT, 0);
+        glDrawElements(GL_TRIANGLES, 3 * modelMesh->faces.size(), m_indexType, 0);
         m_vao.release();
         ground_vao.bind();
         glDrawElements(GL_TRIANGLES, g_numIndices, GL_UNSIGNED_INT, 0);
@@ -1579,7 +1601,7 @@ void glShaderWindow::render()
     }
 
     m_vao.bind();
-    glDrawElements(GL_TRIANGLES, 3 * modelMesh->faces.size(), GL_UNSIGNED_INT, 0);
+    glDrawElements(GL_TRIANGLES, 3 * modelMesh->faces.size(), m_indexType, 0);
     m_vao.release();
     m_program->release();
 
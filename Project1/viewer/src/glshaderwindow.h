@@ -148,6 +148,7 @@ private:
     // Model
     QOpenGLBuffer m_vertexBuffer;
     QOpenGLBuffer m_indexBuffer;
+    GLenum m_indexType; // GL_UNSIGNED_SHORT for small meshes
     QOpenGLBuffer m_normalBuffer;
     QOpenGLBuffer m_colorBuffer;
     QOpenGLBuffer m_texcoordBuffer;